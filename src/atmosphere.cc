@@ -131,6 +131,12 @@ Klob::Klob()
     ion[i]=ion_default[i];
 }
 
+Klob::Klob(const double *ion_)
+{
+  for(int i=0; i<8; i++)
+    ion[i]=ion_[i];
+}
+
 // Klobuchar
 double Klob::ionmod(const Time& t, const double *geo, const double *azel) const
 {
@@ -0,0 +1,300 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   clock.cc --RINEX clock file reader (versions 2.00 to 3.04)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include <thread>
+#include <algorithm>
+
+// clock records decoded per worker, below that threads are not worth it
+#define CLK_MIN_BATCH 4096
+
+#define CLK_MAXGAP 300.0 // widest gap (s) bridged by interpolation
+
+// header label (columns 61-80)
+static bool label(const char *s, int n, const char *lab)
+{
+  int k=strlen(lab);
+  return n>=60+k&&!strncmp(s+60,lab,k);
+}
+
+static double tdiff(const Time& a, const Time& b)
+{
+  return (a.t_sec-b.t_sec)+(a.t_frac-b.t_frac);
+}
+
+//////////////////////////////////////////////////////////////////////
+//  RINEX clock file
+
+ClkFile::ClkFile()
+  : ver(0.0), leaps(0), dt(0.0), nep(0)
+{
+  tsys[0]='\0';
+}
+
+bool ClkFile::read(const char *filepath, bool receivers, int nthreads)
+{
+  Mem m;
+
+  if(!m.mmap(filepath))
+    return false;
+#ifdef HAVE_ZLIB
+  if(Mem::gzipped(std::as_const(m).data(),m.size()))
+    m=m.gz_decode();
+#endif
+  return read(std::as_const(m).data(),m.size(),receivers,nthreads);
+}
+
+int ClkFile::find(const char *prn) const
+{
+  int k=EphemerisStore::satindex(prn);
+  return k<0||slot.empty()?-1:slot[k];
+}
+
+int ClkFile::findrcv(const char *name) const
+{
+  for(std::size_t i=0;i<rcv.size();i++)
+    if(!strcmp(rcv[i].name,name))
+      return i;
+  return -1;
+}
+
+// returns the first line after END OF HEADER (0 on error)
+std::size_t ClkFile::header(const Lines& idx)
+{
+  std::size_t i;
+  const char *s;
+  int n;
+
+  for(i=0;i<idx.size();i++){
+    s=idx[i];
+    n=idx.len(i);
+
+    if(label(s,n,"RINEX VERSION / TYPE")){
+      ver=strnflt(s,9);
+      if(s[20]!='C'){
+#ifdef DEBUG
+        warn("not a clock file");
+#endif
+        return 0;
+      }
+    }
+    else if(label(s,n,"TIME SYSTEM ID")){
+      memcpy(tsys,s+3,3);
+      tsys[3]='\0';
+    }
+    else if(label(s,n,"LEAP SECONDS")&&!label(s,n,"LEAP SECONDS GNSS")){
+      leaps=(int)strnflt(s,6);
+    }
+    else if(label(s,n,"END OF HEADER")){
+      if(!tsys[0])
+        strcpy(tsys,"GPS");
+      return ver>0.0?i+1:0;
+    }
+  }
+#ifdef DEBUG
+  warn("missing END OF HEADER");
+#endif
+  return 0;
+}
+
+// Data record: type A2, name A4 (A9 from 3.04), epoch I4,4I3,F10.6,
+// number of values I3, then the values (bias first, in seconds). Only
+// the bias is kept, continuation lines (values 3-6) start blank.
+void ClkFile::decode(const Lines& idx, const std::vector<uint32_t>& rec,
+  const std::vector<int32_t>& col, std::size_t beg, std::size_t end,
+  std::size_t *noff)
+{
+  const int te=ver>=3.04?13:8; // epoch column
+  const char *s;
+  double u,v;
+  Time t;
+  int n;
+  int64_t i;
+
+  for(std::size_t k=beg;k<end;k++){
+    s=idx[rec[k]];
+    n=idx.len(rec[k]);
+    t.from_rnx(s+te);
+    u=tdiff(t,t0)/dt;
+    i=(int64_t)floor(u+0.5);
+    if(fabs(u-i)>1e-6||i<0||i>=(int64_t)nep){ // not on the grid
+      (*noff)++;
+      continue;
+    }
+    v=n>te+29?strnflt(s+te+29,n-te-29):0.0;
+    std::vector<double>& b=col[k]>=0?sat[col[k]].bias:rcv[-col[k]-1].bias;
+    b[i]=v;
+  }
+}
+
+// One sequential pass classifies the data lines (record type and clock
+// column, cheap character tests) and finds the grid: first epoch, epoch
+// interval from the first two distinct epochs, last epoch. Records must
+// be in time order; one earlier than the last kept is skipped. Epoch and
+// value parsing then runs in parallel, each record written in place at
+// its grid index.
+bool ClkFile::read(const char *buf, std::size_t n, bool receivers, int nthreads)
+{
+  std::vector<uint32_t> rec; // kept record lines
+  std::vector<int32_t> col;  // their clocks: sat k, or receiver -k-1
+  std::vector<std::size_t> noff;
+  std::size_t i,k,nl,nrec,nord=0;
+  const char *s,*sf=0,*sl=0;
+  char prn[4];
+  Time t1;
+  Lines idx;
+  int te,j;
+
+  sat.clear();
+  rcv.clear();
+  nep=0;
+  dt=0.0;
+  ver=0.0;
+  tsys[0]='\0';
+
+  idx.index(buf,n);
+  if(!(i=header(idx)))
+    return false;
+  te=ver>=3.04?13:8;
+
+  slot.assign(EphemerisStore::NSLOT,-1);
+  nl=idx.size();
+  for(;i<nl;i++){
+    s=idx[i];
+    if(s[2]!=' '||s[0]!='A'||(s[1]!='S'&&s[1]!='R')||idx.len(i)<te+29)
+      continue; // other types (CR,DR,MS) and continuation lines
+
+    if(sl&&memcmp(s+te,sl+te,26)<0){ // fixed width fields sort as text
+      nord++;
+      continue;
+    }
+
+    if(s[1]=='S'){
+      memcpy(prn,s+3,3);
+      prn[3]='\0';
+      if((j=EphemerisStore::satindex(prn))<0)
+        continue;
+      if(slot[j]<0){
+        slot[j]=sat.size();
+        sat.emplace_back();
+        memcpy(sat.back().name,prn,4);
+      }
+      j=slot[j];
+    } else {
+      char name[10];
+      if(!receivers)
+        continue;
+      for(k=0;k<(std::size_t)te-4&&s[3+k]!=' ';k++)
+        name[k]=s[3+k];
+      name[k]='\0';
+      if((j=findrcv(name))<0){ // few receivers, new ones are rare
+        j=rcv.size();
+        rcv.emplace_back();
+        strcpy(rcv.back().name,name);
+      }
+      j=-j-1;
+    }
+
+    if(!sf){
+      sf=s;
+      t0.from_rnx(s+te);
+    } else if(dt==0.0&&memcmp(sf+te,s+te,26)){
+      t1.from_rnx(s+te);
+      dt=tdiff(t1,t0);
+    }
+    sl=s;
+    rec.push_back(i);
+    col.push_back(j);
+  }
+  if(!sf||dt<=0.0){
+#ifdef DEBUG
+    warn("no clock data");
+#endif
+    return false;
+  }
+  t1.from_rnx(sl+te);
+  nep=(std::size_t)floor(tdiff(t1,t0)/dt+0.5)+1;
+  for(auto& c: sat)
+    c.bias.assign(nep,NAN);
+  for(auto& c: rcv)
+    c.bias.assign(nep,NAN);
+
+  nrec=rec.size();
+  if(nthreads<=0)
+    nthreads=std::thread::hardware_concurrency();
+  if((std::size_t)nthreads>nrec/CLK_MIN_BATCH)
+    nthreads=nrec/CLK_MIN_BATCH;
+  if(nthreads<1)
+    nthreads=1;
+  noff.assign(nthreads,0);
+
+  // records of one clock may be split among workers, but every grid
+  // element is written by the single record carrying its epoch
+  if(nthreads==1){
+    decode(idx,rec,col,0,nrec,&noff[0]);
+  } else {
+    std::vector<std::thread> pool;
+    k=(nrec+nthreads-1)/nthreads;
+    for(i=0,j=0;i<nrec;i+=k,j++)
+      pool.emplace_back(&ClkFile::decode,this,std::cref(idx),std::cref(rec),
+        std::cref(col),i,std::min(i+k,nrec),&noff[j]);
+    for(auto& w: pool)
+      w.join();
+  }
+  for(k=0,i=0;i<noff.size();i++)
+    k+=noff[i];
+#ifdef DEBUG
+  if(k)
+    warn("clock records off the epoch grid skipped");
+  if(nord)
+    warn("clock records out of time order skipped");
+#endif
+  return true;
+}
+
+// O(1) grid lookup, linear interpolation between the bracketing samples
+bool ClkFile::interp(const Clk& c, const Time& t, double *dts) const
+{
+  double u,f;
+  int64_t i,lo,hi;
+
+  u=tdiff(t,t0)/dt;
+  i=(int64_t)floor(u);
+  f=u-i;
+  if(f>1.0-1e-9){ // on the next sample (rounding)
+    i++;
+    f=0.0;
+  }
+  if(i<0||i>=(int64_t)nep)
+    return false;
+  if(f<1e-9&&!std::isnan(c.bias[i])){
+    *dts=c.bias[i];
+    return true;
+  }
+  for(lo=i;lo>=0&&std::isnan(c.bias[lo]);lo--)
+    if((i-lo)*dt>CLK_MAXGAP)
+      return false;
+  for(hi=i+1;hi<(int64_t)nep&&std::isnan(c.bias[hi]);hi++)
+    if((hi-i)*dt>CLK_MAXGAP)
+      return false;
+  if(lo<0||hi>=(int64_t)nep||(hi-lo)*dt>CLK_MAXGAP+1e-6)
+    return false;
+  f=(u-lo)/(hi-lo);
+  *dts=(1.0-f)*c.bias[lo]+f*c.bias[hi];
+  return true;
+}
+
+bool ClkFile::satclk(const char *prn, const Time& t, double *dts) const
+{
+  int k=find(prn);
+  return k>=0&&interp(sat[k],t,dts);
+}
+
+bool ClkFile::rcvclk(const char *name, const Time& t, double *dtr) const
+{
+  int k=findrcv(name);
+  return k>=0&&interp(rcv[k],t,dtr);
+}
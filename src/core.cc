@@ -2,6 +2,18 @@
 #include "kepler.h"
 #include <filesystem>
 #include <fstream>
+#include <charconv>
+
+#ifdef HAVE_MMAP
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif 
+
+#ifdef HAVE_ZLIB
+  #include <zlib.h>
+#endif 
 
 //////////////////////////////////////////////////////////////////////
 //  Debugging 
@@ -22,20 +34,78 @@ void warn_(const char *from, const char *msg)
 //////////////////////////////////////////////////////////////////////
 //  Memory chunk
 
+Mem::Mem()
+  : map(0), len(0), pos(0)
+{}
+
+Mem::Mem(const Mem& b)
+  : map(0), len(0), pos(b.pos)
+{
+  dat.assign(b.data(), b.data()+b.size());
+}
+
+Mem::Mem(Mem&& b)
+  : dat(std::move(b.dat)), map(b.map), len(b.len), pos(b.pos)
+{
+  b.map=0;
+  b.len=0;
+  b.pos=0;
+}
+
+Mem::~Mem()
+{
+  unmap();
+}
+
+Mem& Mem::operator=(const Mem& b)
+{
+  if(this!=&b){
+    unmap();
+    dat.assign(b.data(), b.data()+b.size());
+    pos=b.pos;
+  }
+  return *this;
+}
+
+Mem& Mem::operator=(Mem&& b)
+{
+  if(this!=&b){
+    unmap();
+    dat=std::move(b.dat);
+    map=b.map; 
+    len=b.len;
+    pos=b.pos;
+    b.map=0;
+    b.len=0;
+    b.pos=0;
+  }
+  return *this;
+}
+
 void Mem::set(const char *buf, std::size_t num)
 {
+  unmap();
   dat.resize(num);
   std::memcpy(dat.data(), buf, num);
+  pos=0;
 }
   
-void Mem::load(const char *filename)
+bool Mem::load(const char *filename)
 {
+  std::error_code ec;
+
 #ifdef DEBUG
   if(!std::filesystem::exists(filename))
     error("file does not exist");
 #endif 
 
-  std::size_t filesize = std::filesystem::file_size(filename);
+  std::size_t filesize = std::filesystem::file_size(filename, ec);
+  
+  unmap();
+  dat.clear();
+  pos=0;
+  if(ec)
+    return false;
   
 #ifdef DEBUG
   if(!filesize)
@@ -43,26 +113,100 @@ void Mem::load(const char *filename)
 #endif 
 
   dat.resize(filesize);
-  pos=0;
   
   std::ifstream stream(filename, std::ifstream::binary);
   stream.read(reinterpret_cast<char*>(&dat[0]), filesize);
+  if(!stream){
+    dat.clear();
+    return false;
+  }
+  return true;
+}
+
+// Zero-copy load: the file is mapped read-only and data() points 
+// straight into the page cache. The view is NOT null terminated 
+// (parsers must honour size()), and writes into it are not allowed. 
+// Falls back to load() when mmap is unavailable or fails.
+bool Mem::mmap(const char *filename, bool sequential)
+{
+#ifdef HAVE_MMAP
+  int fd;
+  struct stat st;
+  void *p;
+
+  unmap();
+  dat.clear();
+  dat.shrink_to_fit();
+  pos=0;
+
+  fd=open(filename, O_RDONLY);
+  if(fd<0){
+#ifdef DEBUG
+    warn("cannot open file");
+#endif 
+    return false;
+  }
+  if(fstat(fd,&st)<0||!st.st_size){
+#ifdef DEBUG
+    warn("empty file");
+#endif 
+    close(fd);
+    return false;
+  }
+  p=::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps its own reference
+  
+  if(p==MAP_FAILED){
+#ifdef DEBUG
+    warn("mmap failed, reading file instead");
+#endif 
+    return load(filename);
+  }
+  
+  // parsers run front to back: ask for aggressive read-ahead
+  madvise(p, st.st_size, sequential?MADV_SEQUENTIAL:MADV_NORMAL);
+  madvise(p, st.st_size, MADV_WILLNEED);
+  
+  map=(char*)p;
+  len=st.st_size;
+  return true;
+#else 
+  return load(filename);
+#endif 
+}
+
+void Mem::unmap()
+{
+#ifdef HAVE_MMAP
+  if(map)
+    munmap(map, len);
+#endif 
+  map=0;
+  len=0;
+}
+
+void Mem::own()
+{
+  if(!map)
+    return;
+  dat.assign(map, map+len);
+  unmap();
 }
 
 void Mem::save(const char *filename) const 
 {
 #ifdef DEBUG
-  if(!dat.size())
+  if(!size())
     warn("no data to write");
 #endif 
 
   std::ofstream stream(filename, std::ofstream::binary);
-  stream.write(reinterpret_cast<const char*>(&dat[0]), dat.size());
+  stream.write(data(), size());
 }
 
 Mem& Mem::seek(std::size_t offset, eSEEKPOS from)
 {
-  std::size_t n=dat.size();
+  std::size_t n=size();
   
   switch(from)
   {
@@ -95,18 +239,19 @@ Mem& Mem::seek(std::size_t offset, eSEEKPOS from)
 
 Mem& Mem::append(const Mem& b)
 {
-  dat.insert(dat.end(), b.dat.begin(), b.dat.end());
+  own();
+  dat.insert(dat.end(), b.data(), b.data()+b.size());
   return *this;
 }
 
 std::size_t Mem::read(char *buf, std::size_t num)
 {
-  std::size_t n=dat.size();
+  std::size_t n=size();
   
   if(pos+num>n)
     num=n-pos;
   
-  std::memcpy(buf, &dat[0] +pos, num);
+  std::memcpy(buf, (map?map:dat.data()) +pos, num);
   
   pos += num;
   return num;
@@ -114,7 +259,10 @@ std::size_t Mem::read(char *buf, std::size_t num)
 
 std::size_t Mem::write(const char *buf, std::size_t num)
 {
-  std::size_t n=dat.size();
+  std::size_t n;
+
+  own(); // mapping is read-only
+  n=dat.size();
   
   if(pos+num>n)
     num=n-pos;
@@ -125,6 +273,74 @@ std::size_t Mem::write(const char *buf, std::size_t num)
   return num;
 }
 
+// gzip member header: magic 1f 8b, method 8 (deflate)
+bool Mem::gzipped(const char *s, std::size_t n)
+{
+  return n>=3&&(uint8_t)s[0]==0x1f&&(uint8_t)s[1]==0x8b&&s[2]==8;
+}
+
+#ifdef HAVE_ZLIB
+Mem Mem::gz_encode(int level) const
+{
+  z_stream z;
+  Mem m;
+  
+  memset(&z,0,sizeof(z));
+  if(deflateInit2(&z,level,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK)
+    return m;
+  m.dat.resize(deflateBound(&z,size()));
+  z.next_in=(Bytef*)data();
+  z.avail_in=size();
+  z.next_out=(Bytef*)m.dat.data();
+  z.avail_out=m.dat.size();
+  if(::deflate(&z,Z_FINISH)!=Z_STREAM_END){
+#ifdef DEBUG
+    warn("deflate failed");
+#endif 
+    z.total_out=0;
+  }
+  m.dat.resize(z.total_out);
+  deflateEnd(&z);
+  return m;
+}
+
+// members are inflated one after the other into the same output
+Mem Mem::gz_decode() const
+{
+  z_stream z;
+  Mem m;
+  std::size_t k=0;
+  int r=Z_OK;
+  
+  memset(&z,0,sizeof(z));
+  if(inflateInit2(&z,15+16)!=Z_OK)
+    return m;
+  m.dat.resize(std::max<std::size_t>(size()*4,1<<12));
+  z.next_in=(Bytef*)data();
+  z.avail_in=size();
+  while(z.avail_in||r!=Z_STREAM_END){
+    if(k==m.dat.size())
+      m.dat.resize(2*k);
+    z.next_out=(Bytef*)&m.dat[k];
+    z.avail_out=m.dat.size()-k;
+    r=::inflate(&z,Z_NO_FLUSH);
+    k=m.dat.size()-z.avail_out;
+    if(r==Z_STREAM_END&&z.avail_in)
+      r=inflateReset(&z);
+    else if(r!=Z_OK&&r!=Z_STREAM_END&&!(r==Z_BUF_ERROR&&z.avail_in)){
+#ifdef DEBUG
+      warn("invalid or truncated gzip data");
+#endif 
+      k=0;
+      break;
+    }
+  }
+  m.dat.resize(k);
+  inflateEnd(&z);
+  return m;
+}
+#endif 
+
 //////////////////////////////////////////////////////////////////////
 // Text utility
 
@@ -137,16 +353,127 @@ int strlen_ctrl(const char *s)
   return p-s;
 }
 
-int count_lines(const char *s)
+// exactly representable powers of ten
+static const double pow10_exact[23] = 
 {
-  int i,j;
+  1e0 ,1e1 ,1e2 ,1e3 ,1e4 ,1e5 ,1e6 ,1e7 ,1e8 ,1e9 ,1e10,1e11,
+  1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22
+};
+
+// Fixed-width FORTRAN float field (RINEX, SP3, clock files) read in 
+// place: at most n columns, stopping early at end of line. Accepts 
+// D/d/E/e exponents (or a bare signed exponent, "1.5-03"), missing 
+// leading zeros (".8100e+02") and blank fields (return 0.0, *blank set).
+// Locale independent and correctly rounded (bit-identical to strtod).
+double strnflt(const char *s, int n, bool *blank)
+{
+  int i,nd,nz,e,ex,es;
+  bool neg,dig;
+  uint64_t m;
+  double v;
+  
+  for(i=0;i<n&&s[i]==' ';i++);
+  if(i>=n||(unsigned char)s[i]<' '){
+    if(blank)
+      *blank=true;
+    return 0.0;
+  }
+  if(blank)
+    *blank=false;
+  
+  neg=s[i]=='-';
+  if(s[i]=='-'||s[i]=='+')
+    i++;
   
-  for(j=0,i=0;s[i];i++){
-    if(s[i]=='\n'||(s[i]=='\r'&&s[i+1]!='\n')){
-      j++;
+  // mantissa: up to 19 significant digits fit in 64 bits
+  m=0; nd=0; nz=0; e=0; dig=false;
+  for(;i<n&&s[i]>='0'&&s[i]<='9';i++){
+    dig=true;
+    if(nd<19){
+      m=m*10+(s[i]-'0'); 
+      nd+=m!=0;
+    } else {
+      e++; nz|=s[i]!='0';
     }
   }
-  return j;
+  if(i<n&&s[i]=='.'){
+    for(i++;i<n&&s[i]>='0'&&s[i]<='9';i++){
+      dig=true;
+      if(nd<19){
+        m=m*10+(s[i]-'0'); 
+        nd+=m!=0; 
+        e--;
+      } else 
+        nz|=s[i]!='0';
+    }
+  }
+  
+  // exponent
+  ex=0;
+  if(i<n&&(s[i]=='D'||s[i]=='d'||s[i]=='E'||s[i]=='e'))
+    i++;
+  if(i<n&&(s[i]=='-'||s[i]=='+')){
+    es=s[i++]=='-'?-1:1;
+    for(;i<n&&s[i]>='0'&&s[i]<='9';i++)
+      if(ex<10000)
+        ex=ex*10+(s[i]-'0');
+    ex*=es;
+  } else {
+    for(;i<n&&s[i]>='0'&&s[i]<='9';i++)
+      if(ex<10000)
+        ex=ex*10+(s[i]-'0');
+  }
+  e+=ex;
+  
+#ifdef DEBUG
+  if(!dig)
+    warn("invalid float field");
+#endif 
+  
+  // Clinger's fast path: mantissa and power of ten are both exact,
+  // so a single IEEE multiply (divide) gives the correctly rounded value
+  if(!nz&&m<=(UINT64_C(1)<<53)&&e>=-22&&e<=22){
+    v=(double)m;
+    v=e<0?v/pow10_exact[-e]:v*pow10_exact[e];
+    return neg?-v:v;
+  }
+  if(!m&&!nz)
+    return neg?-0.0:0.0;
+  
+  // rare (more than 15 digits or huge exponents): full conversion
+  char buf[64];
+  int k,j;
+  
+  for(i=0;i<n&&s[i]==' ';i++);
+  for(k=0;i<n&&k<62&&!iscntrl(s[i])&&s[i]!=' ';i++){
+    if(s[i]=='D'||s[i]=='d'||s[i]=='e')
+      buf[k++]='E';
+    else if((s[i]=='-'||s[i]=='+')&&k&&buf[k-1]>='0'&&buf[k-1]<='9'){
+      buf[k++]='E'; buf[k++]=s[i]; // bare exponent
+    } else 
+      buf[k++]=s[i];
+  }
+  j=buf[0]=='+'?1:0; // from_chars does not take a leading '+'
+  v=0.0;
+  if(std::from_chars(buf+j,buf+k,v).ec==std::errc::result_out_of_range){
+    buf[k]='\0'; // v untouched: strtod gives +-HUGE_VAL, 0 or a denormal
+    v=strtod(buf,0);
+  }
+  return v;
+}
+
+int count_lines(const char *s)
+{
+  uint64_t offs[256];
+  std::size_t i,j,k,n;
+  
+  n=strlen(s);
+  for(k=0,i=0;i<n;){ // resume the index where the last call stopped 
+    j=index_lines(s,n,offs,256,i);
+    k+=j;
+    i=offs[j];
+  }
+  return k;
 }
 
 int parse_lines_n(const char *s, const char **lines, int max_lines)
@@ -165,14 +492,456 @@ int parse_lines_n(const char *s, const char **lines, int max_lines)
   return i;
 }
 
+// the returned array must be released with free()
 const char **parse_lines(const char *s)
 {
-  int num;
+  std::size_t i,k,n;
   const char **lines;
+  Lines idx;
   
-  num=count_lines(s);
-  lines=(const char**)malloc(num*sizeof(char*));
-  parse_lines_n(s, lines, num);
+  n=strlen(s);
+  k=idx.index(s,n);
+  lines=(const char**)malloc((k?k:1)*sizeof(char*));
+  for(i=0;i<k;i++)
+    lines[i]=idx[i];
   
   return lines;
 }
+
+// Single pass line splitter for CR, LF and CR+LF terminated text 
+// (the buffer need not be null terminated). Writes the offset of each 
+// line start found from 'beg' into offs and returns the number of 
+// lines k. offs[k] is always written: it is n once the whole buffer 
+// has been indexed, otherwise the start of the next line (offs was 
+// full), so the call can be resumed from there.
+template<typename T>
+static std::size_t lnidx(const char *s, std::size_t n, 
+  T *offs, std::size_t max_offs, std::size_t beg)
+{
+  std::size_t i,j,k,m;
+  
+  if(!max_offs)
+    return 0;
+  if(beg>=n||max_offs<2){
+    offs[0]=beg<n?beg:n;
+    return 0;
+  }
+  m=max_offs-1; // room for the closing offset
+  k=0;
+  offs[k++]=beg;
+
+  i=beg;
+#ifdef SIMD_x86
+  const __m256i lf=_mm256_set1_epi8('\n');
+  const __m256i cr=_mm256_set1_epi8('\r');
+  uint32_t mlf,mcr,mnx,b;
+  
+  for(;i+32<=n;i+=32){
+    __m256i c=_mm256_loadu_si256((const __m256i*)(s+i));
+    mlf=_mm256_movemask_epi8(_mm256_cmpeq_epi8(c,lf));
+    mcr=_mm256_movemask_epi8(_mm256_cmpeq_epi8(c,cr));
+    // LF at the following byte (a CR before it is part of CR+LF)
+    mnx=(mlf>>1)|(i+32<n&&s[i+32]=='\n'?0x80000000u:0);
+    b=mlf|(mcr&~mnx);
+    while(b){
+      j=i+__builtin_ctz(b)+1;
+      b&=b-1;
+      if(j>=n)
+        break;
+      if(k==m){
+        offs[k]=j;
+        return k;
+      }
+      offs[k++]=j;
+    }
+  }
+#endif 
+  for(;i<n;i++){
+    if(s[i]=='\n' // Win32, Unix (POSIX) and MacOS 10 or later
+    ||(s[i]=='\r'&&(i+1>=n||s[i+1]!='\n'))){ // for MacOS 9 and older
+      j=i+1;
+      if(j>=n)
+        break;
+      if(k==m){
+        offs[k]=j;
+        return k;
+      }
+      offs[k++]=j;
+    }
+  }
+  offs[k]=n;
+  return k;
+}
+
+std::size_t index_lines(const char *s, std::size_t n, 
+  uint32_t *offs, std::size_t max_offs, std::size_t beg)
+{
+  if(n>UINT32_MAX){ // offsets would wrap
+#ifdef DEBUG
+    warn("buffer too large for 32-bit offsets");
+#endif 
+    return 0;
+  }
+  return lnidx(s,n,offs,max_offs,beg);
+}
+
+std::size_t index_lines(const char *s, std::size_t n, 
+  uint64_t *offs, std::size_t max_offs, std::size_t beg)
+{
+  return lnidx(s,n,offs,max_offs,beg);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Line index
+
+Lines::Lines()
+  : s(0), num(0), wide(false)
+{}
+
+template<typename T>
+std::size_t Lines::index(std::vector<T>& o, std::size_t n)
+{
+  std::size_t k;
+  
+  if(o.size()<n/64+2) // RINEX lines are 60 to 80 columns long
+    o.resize(n/64+2);
+  
+  for(;;){
+    k=lnidx(s,n,&o[0]+num,o.size()-num,num?(std::size_t)o[num]:0);
+    num+=k;
+    if(o[num]>=n)
+      break;
+    o.resize(o.size()*2);
+  }
+  return num;
+}
+
+// 32-bit offsets up to 4 GiB, 64-bit beyond
+std::size_t Lines::index(const char *buf, std::size_t n)
+{
+  s=buf;
+  num=0;
+  wide=n>UINT32_MAX;
+  return wide?index(offl,n):index(offs,n);
+}
+
+int Lines::len(std::size_t i) const
+{
+  std::size_t a,b;
+  
+  a=offset(i);
+  b=offset(i+1);
+  while(b>a&&(s[b-1]=='\n'||s[b-1]=='\r'))
+    b--;
+  return b-a;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sequential line reader (bounded buffer over a file, or a memory block)
+
+#define LINE_BUFSIZE (1<<16)
+
+LineReader::LineReader()
+  : fp(0), src(0), beg(0), end(0), base(0), eof(true), zs(0), zerr(false), len(0)
+{}
+
+LineReader::~LineReader()
+{
+  close();
+}
+
+bool LineReader::open(const char *filepath)
+{
+  close();
+  if(!(fp=fopen(filepath,"rb"))){
+#ifdef DEBUG
+    warn("cannot open file");
+#endif
+    return false;
+  }
+  buf.resize(LINE_BUFSIZE);
+  eof=false;
+  if(!fseeko(fp,0,SEEK_END)){
+    len=ftello(fp);
+    fseeko(fp,0,SEEK_SET);
+  }
+  
+  // gzip is detected from the first bytes, given back to the window
+  // (plain) or to the inflater
+  end=fread(&buf[0],1,3,fp);
+  if(Mem::gzipped(&buf[0],end)){
+    zin.resize(LINE_BUFSIZE);
+    memcpy(&zin[0],&buf[0],end);
+    len=0;
+    if(!gzopen(&zin[0],end))
+      return false;
+    end=0;
+  }
+  return true;
+}
+
+// lines are returned in place (plain), the block must outlive the reader
+void LineReader::open(const char *s, std::size_t n)
+{
+  close();
+  if(Mem::gzipped(s,n)){
+    buf.resize(LINE_BUFSIZE);
+    eof=false;
+    gzopen(s,n);
+    return;
+  }
+  src=s;
+  end=len=n;
+}
+
+void LineReader::close()
+{
+  if(fp)
+    fclose(fp);
+#ifdef HAVE_ZLIB
+  if(zs){
+    inflateEnd((z_stream*)zs);
+    delete (z_stream*)zs;
+  }
+#endif 
+  fp=0;
+  src=0;
+  zs=0;
+  beg=end=0;
+  base=0;
+  eof=true;
+  zerr=false;
+  len=0;
+}
+
+// inflater over the first n compressed bytes at s (the whole block for
+// memory input, more is read from the file as needed)
+bool LineReader::gzopen(const char *s, std::size_t n)
+{
+#ifdef HAVE_ZLIB
+  z_stream *z=new z_stream;
+  
+  memset(z,0,sizeof(*z));
+  if(inflateInit2(z,15+16)!=Z_OK){
+    delete z;
+    eof=true;
+    return false;
+  }
+  z->next_in=(Bytef*)s;
+  z->avail_in=n;
+  zs=z;
+  return true;
+#else
+#ifdef DEBUG
+  warn("gzip input needs zlib (HAVE_ZLIB)");
+#endif 
+  eof=true;
+  return false;
+#endif 
+}
+
+// up to n bytes of uncompressed data, concatenated members in sequence;
+// the input must end with a complete member
+std::size_t LineReader::inflate(char *s, std::size_t n)
+{
+#ifdef HAVE_ZLIB
+  z_stream *z=(z_stream*)zs;
+  std::size_t k;
+  int r;
+  
+  z->next_out=(Bytef*)s;
+  z->avail_out=n;
+  while(z->avail_out){
+    if(!z->avail_in){
+      if(!fp||!(k=fread(&zin[0],1,zin.size(),fp))){
+        if(z->total_in&&!zerr){ // member started, not ended
+#ifdef DEBUG
+          warn("truncated gzip data");
+#endif 
+          zerr=true;
+        }
+        break;
+      }
+      z->next_in=(Bytef*)&zin[0];
+      z->avail_in=k;
+    }
+    r=::inflate(z,Z_NO_FLUSH);
+    if(r==Z_STREAM_END){
+      inflateReset(z); // next member, if any
+    } else if(r!=Z_OK){
+#ifdef DEBUG
+      if(!zerr)
+        warn("invalid gzip data");
+#endif 
+      zerr=true;
+      break;
+    }
+  }
+  return n-z->avail_out;
+#else
+  return 0;
+#endif 
+}
+
+// moves the unread bytes to the front and reads more of the file, the
+// buffer only grows for a line longer than itself
+void LineReader::fill()
+{
+  std::size_t k;
+  
+  if(beg){
+    memmove(&buf[0],&buf[beg],end-beg);
+    base+=beg;
+    end-=beg;
+    beg=0;
+  }
+  if(end==buf.size())
+    buf.resize(buf.size()*2);
+  if(zs)
+    k=inflate(&buf[end],buf.size()-end);
+  else
+    k=fread(&buf[end],1,buf.size()-end,fp);
+  end+=k;
+  if(!k)
+    eof=true;
+}
+
+// next line without EOL (0 at the end), valid until the next call
+const char *LineReader::next(int *len)
+{
+  const char *p,*q;
+  std::size_t a,b;
+  
+  for(;;){
+    p=src?src:buf.data();
+    if((q=(const char*)memchr(p+beg,'\n',end-beg))||eof)
+      break;
+    fill();
+  }
+  if(beg>=end)
+    return 0;
+  a=beg;
+  b=q?q-p:end;
+  beg=q?b+1:end;
+  if(b>a&&p[b-1]=='\r')
+    b--;
+  *len=b-a;
+  return p+a;
+}
+
+bool LineReader::seek(uint64_t off)
+{
+  if(src){
+    beg=off<end?off:end;
+    return off<=end;
+  }
+  if(!fp||zs||fseeko(fp,off,SEEK_SET))
+    return false;
+  base=off;
+  beg=end=0;
+  eof=false;
+  return true;
+}
+
+#ifdef HAVE_ZLIB
+//////////////////////////////////////////////////////////////////////
+// Gzip file writer
+
+#define GZ_BUFSIZE (1<<16)
+
+GzWriter::GzWriter()
+  : fp(0), zs(0), level(6), pend(false), nout(0), nin(0)
+{}
+
+GzWriter::~GzWriter()
+{
+  close();
+}
+
+bool GzWriter::open(const char *filepath, int level_)
+{
+  z_stream *z;
+  
+  close();
+  if(!(fp=fopen(filepath,"wb"))){
+#ifdef DEBUG
+    warn("could not create file");
+#endif 
+    return false;
+  }
+  z=new z_stream;
+  memset(z,0,sizeof(*z));
+  if(deflateInit2(z,level_,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK){
+    delete z;
+    fclose(fp);
+    fp=0;
+    return false;
+  }
+  zs=z;
+  zout.resize(GZ_BUFSIZE);
+  level=level_;
+  pend=false;
+  nout=nin=0;
+  return true;
+}
+
+// runs the deflater over the pending input, output goes to the file
+bool GzWriter::deflate(int flush)
+{
+  z_stream *z=(z_stream*)zs;
+  std::size_t k;
+  int r;
+  
+  do{
+    z->next_out=(Bytef*)&zout[0];
+    z->avail_out=zout.size();
+    r=::deflate(z,flush);
+    k=zout.size()-z->avail_out;
+    if(r==Z_STREAM_ERROR||fwrite(&zout[0],1,k,fp)!=k)
+      return false;
+    nout+=k;
+  } while(z->avail_in||(flush==Z_FINISH&&r!=Z_STREAM_END));
+  return true;
+}
+
+bool GzWriter::write(const char *s, std::size_t n)
+{
+  z_stream *z=(z_stream*)zs;
+  
+  if(!fp)
+    return false;
+  if(!n)
+    return true;
+  z->next_in=(Bytef*)s;
+  z->avail_in=n;
+  nin+=n;
+  pend=true;
+  return deflate(Z_NO_FLUSH);
+}
+
+// completes the member (trailer written), the next write starts another
+bool GzWriter::member()
+{
+  if(!fp)
+    return false;
+  if(!pend)
+    return true;
+  pend=false;
+  return deflate(Z_FINISH)&&deflateReset((z_stream*)zs)==Z_OK;
+}
+
+bool GzWriter::close()
+{
+  bool ok;
+  
+  if(!fp)
+    return true;
+  ok=member();
+  deflateEnd((z_stream*)zs);
+  delete (z_stream*)zs;
+  zs=0;
+  ok=fclose(fp)==0&&ok;
+  fp=0;
+  return ok;
+}
+#endif 
@@ -1,6 +1,7 @@
 
 #include "kepler.h"
 #include "constants.h"
+#include <algorithm>
 
 #define POW2(x) (x*x)
 
@@ -25,16 +26,6 @@ static int uraindex(double value)
   return 0;
 }
 
-// FORTRAN to C double exponent 
-// We need to replace the exponent character from 'D' to 'E'  
-// due to legacy FORTRAN compatibility on the RINEX format 
-// specification (for writing double precision floating point) 
-static void fixflt(char *s)
-{
-  for(;*s;s++)
-    *s=(*s=='D'||*s=='d')?'E':*s;
-}
-
 // adjust time considering week handover 
 static void adjweek(Time& t, const Time& t0)
 {
@@ -45,6 +36,22 @@ static void adjweek(Time& t, const Time& t0)
     t.t_sec-=604800;
 }
 
+// gravitational constant and earth rotation rate of each system
+static void syscnst(char sys, double *mu, double *omge)
+{
+  switch(sys){
+  case 'E': // Galileo
+    *mu=MU_GAL; *omge=OMGE_GAL; 
+  break;
+  case 'C': // BeiDou
+    *mu=MU_CMP; *omge=OMGE_CMP; 
+  break;
+  default: // GPS, QZSS, IRNSS
+    *mu=MU_GPS; *omge=OMGE_GPS; 
+  break;
+  }
+}
+
 #ifdef DEBUG
 void check_prn(const char *prn)
 {
@@ -56,12 +63,20 @@ void check_prn(const char *prn)
     if(satnum<1||satnum>32)
       error("invalid GPS satellite PRN");
   break; 
-  //case 'E': // Galileo
-  //break;
+  case 'E': // Galileo
+    if(satnum<1||satnum>36)
+      error("invalid Galileo satellite PRN");
+  break;
+  case 'J': // QZSS
+    if(satnum<1||satnum>10)
+      error("invalid QZSS satellite PRN");
+  break;
+  case 'I': // NavIC/IRNSS
+    if(satnum<1||satnum>14)
+      error("invalid IRNSS satellite PRN");
+  break;
   //case 'C':
   //break;
-  //case 'I':
-  //break;
   default:
     error("invalid satellite system");
   break;
@@ -79,16 +94,56 @@ Nav::Nav(const char *rnx)
 
 void Nav::rnx2nav(const char *rnx)
 {
-  int i,j,k,n,w;
+  int i,n;
   const char *lines[8];
+  int len[8];
+
+  n=parse_lines_n(rnx,lines,8);
+  for(i=0;i<8;i++)
+    len[i]=i<n?strlen_ctrl(lines[i]):0;
+  
+  rnx2nav(lines,len,3);
+}
+
+// RINEX 2 epoch of the first record line, "yy mm dd hh mm ss.s"
+static void rnx2toc2(Time& t, const char *rnx)
+{
+  int cal[6];
+  double sec;
+  
+  cal[0]=strtol(rnx   ,0,10);
+  cal[1]=strtol(rnx+ 2,0,10);
+  cal[2]=strtol(rnx+ 5,0,10);
+  cal[3]=strtol(rnx+ 8,0,10);
+  cal[4]=strtol(rnx+11,0,10);
+  sec   =strtod(rnx+14,0);
+  cal[0]+=cal[0]<80?2000:1900;
+  cal[5]=(int)floor(sec);
+  
+  t.from_cal(cal);
+  t.t_frac=sec-cal[5];
+}
+
+// Decodes the 8 lines of a record (len: line lengths without EOL). 
+// RINEX 2 records (ver<3) have a 2-digit GPS PRN, a 2-digit year 
+// and start the data fields one column earlier than RINEX 3.
+void Nav::rnx2nav(const char *const *lines, const int *len, int ver)
+{
+  int i,j,k,n,w,w0;
   char buf[20]={0};
   double par[32]={0};
 
-  parse_lines_n(rnx,lines,8);
-
-  prn[0]=lines[0][0];     
-  prn[1]=lines[0][1]==' '?'0':lines[0][1]; 
-  prn[2]=lines[0][2];
+  if(ver<3){
+    prn[0]='G';
+    prn[1]=lines[0][0]==' '?'0':lines[0][0]; 
+    prn[2]=lines[0][1];
+    w0=3;
+  } else {
+    prn[0]=lines[0][0];     
+    prn[1]=lines[0][1]==' '?'0':lines[0][1]; 
+    prn[2]=lines[0][2];
+    w0=4;
+  }
   prn[3]=0;
 
 #ifdef DEBUG
@@ -97,21 +152,24 @@ void Nav::rnx2nav(const char *rnx)
 
   // reading parameters
   for(k=0,i=0;i<8;i++){
-    n=strlen_ctrl(lines[i]);        
+    n=len[i];
     for(j=0;j<4;j++){
-      w=4+19*j;
+      w=w0+19*j;
       if(w+19>n){
       // some entries might not have the entire line populated
       // thus, we need to check the line length before reading 
         k++; // skip parameter
         continue; 
       }      
-      strncpy(buf,&lines[i][w],19);      
       if(!i&&!j){ // first parameter is the time of clock (toc)
-        toc.from_rnx(buf);
+        strncpy(buf,&lines[i][w],19);      
+        if(ver<3)
+          rnx2toc2(toc,buf);
+        else 
+          toc.from_rnx(buf);
       } else {
-        fixflt(buf);
-        par[k++]=strtod(buf,0);       
+        // FORTRAN 'D' exponents are handled by strnflt
+        par[k++]=strnflt(&lines[i][w],19);
       }      
     }
   }
@@ -140,21 +198,37 @@ void Nav::rnx2nav(const char *rnx)
   sva =uraindex(par[23]);
   flag=(int)par[22];
   tgd[0]=   par[25];
+  tgd[1]=tgd[2]=tgd[3]=0.0;
   fit =     par[28];
+  Adot=ndot=0.0;
+  if(prn[0]=='E'){ // BGD E5b/E1 in place of IODC
+    tgd[1]=par[26];
+    iodc=iode;
+  }
 }
 
 void Nav::nav2ecf(const Time& t, double *xyz, double *clock_bias) const
+{
+  nav2ecf(t,xyz,0,clock_bias,0);
+}
+
+// Position and, when vel/clock_drift are given, velocity (m/s) and clock
+// drift (s/s) from the analytic time derivatives of the Keplerian model,
+// reusing E, u, r and i (no second evaluation or finite differences)
+void Nav::nav2ecf(const Time& t, double *xyz, double *vel, 
+  double *clock_bias, double *clock_drift) const
 {
   int itr;
-  double tk,M,E,Ek,sinE,cosE,Q,sinQ,cosQ;
-  double u,r,i,x,y,dts,cosi,sin2u,cos2u;
+  double tk,n,M,E,Ek,sinE,cosE,Q,sinQ,cosQ;
+  double u,r,i,x,y,dts,cosi,sini,sinu,cosu,sin2u,cos2u;
   double mu,omge;
+  double Ed,ud,rd,id,xd,yd,Qd;
 
-  mu=MU_GPS;
-  omge=OMGE_GPS;
+  syscnst(prn[0],&mu,&omge);
 
   tk=(t-toe).to_double();
-  M=M0+(sqrt(mu/(A*A*A))+deln)*tk;
+  n=sqrt(mu/(A*A*A))+deln;
+  M=M0+n*tk;
 
   for(E=M,Ek=0, itr=0;itr<30 && fabs(E-Ek)>1e-14;itr++){
     Ek=E; E-=(E-e*sin(E)-M)/(1.0-e*cos(E));
@@ -175,17 +249,34 @@ void Nav::nav2ecf(const Time& t, double *xyz, double *clock_bias) const
   u+=cus*sin2u+cuc*cos2u;
   r+=crs*sin2u+crc*cos2u;
   i+=cis*sin2u+cic*cos2u;
-  x=r*cos(u); 
-  y=r*sin(u); 
+  sinu=sin(u);
+  cosu=cos(u);
+  x=r*cosu; 
+  y=r*sinu; 
   cosi=cos(i);
+  sini=sin(i);
 
-  // GPS
   Q=OMG0+(OMGd-omge)*tk-omge*toes;
   sinQ=sin(Q); 
   cosQ=cos(Q);
   xyz[0]=x*cosQ-y*cosi*sinQ;
   xyz[1]=x*sinQ+y*cosi*cosQ;
-  xyz[2]=y*sin(i);
+  xyz[2]=y*sini;
+
+  Ed=n/(1.0-e*cosE); // dE/dt
+  if(vel){
+    // rates of the corrected argument of latitude, radius, inclination
+    ud=sqrt(1.0-e*e)*Ed/(1.0-e*cosE); // dv/dt
+    rd=A*e*sinE*Ed+2.0*ud*(crs*cos2u-crc*sin2u);
+    id=idot       +2.0*ud*(cis*cos2u-cic*sin2u);
+    ud*=1.0       +2.0*   (cus*cos2u-cuc*sin2u);
+    xd=rd*cosu-y*ud;
+    yd=rd*sinu+x*ud;
+    Qd=OMGd-omge;
+    vel[0]=xd*cosQ-yd*cosi*sinQ+y*sini*id*sinQ-Qd*xyz[1];
+    vel[1]=xd*sinQ+yd*cosi*cosQ-y*sini*id*cosQ+Qd*xyz[0];
+    vel[2]=yd*sini+y*cosi*id;
+  }
 
   // relativity correction
   tk=(t-toc).to_double();
@@ -194,6 +285,8 @@ void Nav::nav2ecf(const Time& t, double *xyz, double *clock_bias) const
 
   if(clock_bias)
     *clock_bias=dts;
+  if(clock_drift)
+    *clock_drift=f1+2.0*f2*tk-2.0*sqrt(mu*A)*e*cosE*Ed/POW2(CLIGHT);
 }
 
 Vec3 Nav::nav2ecf(const Time& t, double *clock_bias) const 
@@ -225,7 +318,7 @@ std::string Nav::nav2rnx() const
   par[ 9]=cus ;   par[12]=cic; par[14]=cis ;
 
   par[ 3]=iode;
-  par[26]=iodc;
+  par[26]=prn[0]=='E'?tgd[1]:iodc;
   par[11]=toes;
   par[21]=week;
   
@@ -288,3 +381,262 @@ double Nav::eph2clk(const Time& t) const
    
   return f0+f1*tk+f2*tk*tk;   
 }
+
+
+//////////////////////////////////////////////////////////////////////
+// Prepared broadcast ephemeris
+
+NavPrep::NavPrep()
+{}
+
+NavPrep::NavPrep(const Nav& eph)
+{
+  set(eph);
+}
+
+// everything in nav2ecf() that does not depend on time
+void NavPrep::set(const Nav& eph)
+{
+  double mu,omge;
+
+  syscnst(eph.prn[0],&mu,&omge);
+  toe =eph.toe;
+  toc =eph.toc;
+  A   =eph.A;
+  e   =eph.e;
+  sqe =sqrt(1.0-eph.e*eph.e);
+  n   =sqrt(mu/(eph.A*eph.A*eph.A))+eph.deln;
+  M0  =eph.M0;
+  omg =eph.omg;
+  i0  =eph.i0;
+  idot=eph.idot;
+  OMG0=eph.OMG0-omge*eph.toes;
+  OMGd=eph.OMGd-omge;
+  crc =eph.crc; crs=eph.crs;
+  cuc =eph.cuc; cus=eph.cus;
+  cic =eph.cic; cis=eph.cis;
+  f0  =eph.f0; f1=eph.f1; f2=eph.f2;
+  rel =-2.0*sqrt(mu*eph.A)*eph.e/POW2(CLIGHT);
+}
+
+void NavPrep::nav2ecf(const Time& t, double *xyz, double *clock_bias) const
+{
+  int itr;
+  double tk,M,E,Ek,sinE,cosE,Q,sinQ,cosQ;
+  double u,r,i,x,y,cosi,sin2u,cos2u;
+
+  tk=(t-toe).to_double();
+  M=M0+n*tk;
+
+  for(E=M,Ek=0, itr=0;itr<30 && fabs(E-Ek)>1e-14;itr++){
+    Ek=E; E-=(E-e*sin(E)-M)/(1.0-e*cos(E));
+  }
+
+  sinE=sin(E);
+  cosE=cos(E);
+  u=atan2(sqe*sinE,cosE-e)+omg;
+  r=A*(1.0-e*cosE);
+  i=i0+idot*tk;
+  sin2u=sin(2.0*u); 
+  cos2u=cos(2.0*u);
+  u+=cus*sin2u+cuc*cos2u;
+  r+=crs*sin2u+crc*cos2u;
+  i+=cis*sin2u+cic*cos2u;
+  x=r*cos(u); 
+  y=r*sin(u); 
+  cosi=cos(i);
+
+  Q=OMG0+OMGd*tk;
+  sinQ=sin(Q); 
+  cosQ=cos(Q);
+  xyz[0]=x*cosQ-y*cosi*sinQ;
+  xyz[1]=x*sinQ+y*cosi*cosQ;
+  xyz[2]=y*sin(i);
+
+  if(clock_bias){
+    tk=(t-toc).to_double();
+    *clock_bias=f0+f1*tk+f2*tk*tk+rel*sinE;
+  }
+}
+
+// same as Nav::eph2clk
+double NavPrep::eph2clk(const Time& t) const
+{
+  double tk,ts;
+  
+  tk=ts=(t-toc).to_double();
+  for(int i=0; i<2; i++)
+     tk=ts-(f0+f1*tk+f2*tk*tk);
+  return f0+f1*tk+f2*tk*tk;   
+}
+
+//////////////////////////////////////////////////////////////////////
+// Broadcast ephemeris store
+
+#define MAXPRN 64 // satellites per system in the store index
+
+static const char sysid[]="GRECJIS";
+
+static_assert(sizeof(sysid)*MAXPRN==EphemerisStore::NSLOT,"store index size");
+
+// half the fit interval, or the nominal age when it is not given
+double EphemerisStore::maxdtoe(const Nav& eph)
+{
+  if(eph.prn[0]=='J') // QZSS fit flag in RINEX 3 (0: 2 h, 1: > 2 h)
+    return eph.fit>0.0?7200.0:3600.0;
+  if(eph.fit>0.0)
+    return eph.fit*1800.0; // half the fit interval (h)
+  return eph.prn[0]=='E'?14400.0:7200.0;
+}
+
+EphemerisStore::EphemerisStore()
+  : sat(NSLOT), num(0)
+{
+  clear();
+}
+
+void EphemerisStore::clear()
+{
+  for(auto& s: sat){
+    s.eph.clear();
+    s.cur=0;
+    s.sorted=true;
+  }
+  num=0;
+}
+
+// flat satellite index: system block of MAXPRN, then PRN (-1 if invalid);
+// SBAS IDs are PRN-100 (S20..S58) as in RINEX and SP3
+int EphemerisStore::satindex(const char *prn)
+{
+  const char *p;
+  int n;
+
+  if(!(p=strchr(sysid,prn[0]))||!prn[0])
+    return -1;
+  n=strtol(prn+1,0,10);
+  if(n<1||n>MAXPRN)
+    return -1;
+  return (p-sysid)*MAXPRN+n-1;
+}
+
+void EphemerisStore::add(const Nav& eph)
+{
+  int k=satindex(eph.prn);
+
+  if(k<0){
+#ifdef DEBUG
+    warn("invalid satellite PRN");
+#endif 
+    return;
+  }
+  Sat& s=sat[k];
+  s.eph.push_back(eph);
+  s.sorted=false;
+  num++;
+}
+
+void EphemerisStore::add(const std::vector<Nav>& eph)
+{
+  for(const auto& e: eph)
+    add(e);
+}
+
+// satellite entry, sorted by toe with repeated broadcasts removed
+// (merged multi-station files carry the same record many times)
+EphemerisStore::Sat *EphemerisStore::get(const char *prn)
+{
+  int k=satindex(prn);
+  std::size_t i,j;
+
+  if(k<0||sat[k].eph.empty())
+    return 0;
+  Sat& s=sat[k];
+  if(s.sorted)
+    return &s;
+  
+  std::stable_sort(s.eph.begin(),s.eph.end(),
+    [](const Nav& a, const Nav& b){ return a.toe<b.toe; });
+  for(j=0,i=1;i<s.eph.size();i++){
+    if(s.eph[i].toe.t_sec==s.eph[j].toe.t_sec&&s.eph[i].iode==s.eph[j].iode)
+      continue;
+    if(++j!=i)
+      s.eph[j]=s.eph[i];
+  }
+  num-=s.eph.size()-(j+1);
+  s.eph.resize(j+1);
+  s.cur=0;
+  s.sorted=true;
+  return &s;
+}
+
+// Healthy ephemeris with toe closest to t, within its fit interval. 
+// The per satellite cursor starts at the record selected last time, 
+// so monotonically increasing query times resolve in amortized O(1).
+// Not thread safe: use one store per thread.
+const Nav *EphemerisStore::select(const char *prn, const Time& t)
+{
+  Sat *s;
+  std::size_t i,n,k;
+  double dt,d0;
+  const Nav *best;
+
+  if(!(s=get(prn)))
+    return 0;
+  n=s->eph.size();
+  i=s->cur;
+  
+  // move the cursor to the record with the closest toe
+  d0=fabs((t-s->eph[i].toe).to_double());
+  while(i+1<n&&(dt=fabs((t-s->eph[i+1].toe).to_double()))<=d0){
+    d0=dt; i++;
+  }
+  while(i>0&&(dt=fabs((t-s->eph[i-1].toe).to_double()))<d0){
+    d0=dt; i--;
+  }
+  s->cur=i;
+
+  // closest healthy record, searching outwards from the cursor
+  best=0;
+  for(k=0;k<n;k++){
+    const Nav *a=i+k<n?&s->eph[i+k]:0;
+    const Nav *b=k&&i>=k?&s->eph[i-k]:0;
+    double da=a?fabs((t-a->toe).to_double()):1e99;
+    double db=b?fabs((t-b->toe).to_double()):1e99;
+    if(!a&&!b)
+      break;
+    if(b&&db<da){ // try the closer one first
+      std::swap(a,b); 
+      std::swap(da,db);
+    }
+    if(a&&!a->svh&&da<=maxdtoe(*a)){ best=a; break; }
+    if(b&&!b->svh&&db<=maxdtoe(*b)){ best=b; break; }
+    if(da>86400.0&&db>86400.0)
+      break; // beyond any fit interval
+  }
+  return best;
+}
+
+// ephemeris with the given IODE closest to t (RTK base/rover matching)
+const Nav *EphemerisStore::select(const char *prn, int iode, const Time& t)
+{
+  Sat *s;
+  std::size_t i;
+  double dt,d0;
+  const Nav *best;
+
+  if(!(s=get(prn)))
+    return 0;
+  best=0;
+  d0=1e99;
+  for(i=0;i<s->eph.size();i++){ // IODEs repeat, a few records per day
+    if(s->eph[i].iode!=iode)
+      continue;
+    dt=fabs((t-s->eph[i].toe).to_double());
+    if(dt<d0){ 
+      d0=dt; 
+      best=&s->eph[i]; 
+    }
+  }
+  return best;
+}
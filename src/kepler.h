@@ -19,9 +19,14 @@
   #define SIMD_x86 1 /// Assuming we have both AVX2 and FMA3 
 #endif 
 
+#if defined(__unix__) || defined(__APPLE__)
+  #define HAVE_MMAP 1 /// POSIX mmap()/madvise() available
+#endif 
+
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <utility>
 #include <string>
 #include <cstring>
 
@@ -63,6 +68,8 @@ real pythag(real x, real y, real z)
 class Mem{
 protected:
   std::vector<char> dat;
+  char *map;          // read-only file mapping (null when owning dat)
+  std::size_t len;    // length of the mapping
   std::size_t pos;
 public:
   enum eSEEKPOS{
@@ -71,29 +78,135 @@ public:
     CUR
   };
 public:
-  Mem() {}
+  Mem();
+  Mem(const Mem& b);
+  Mem(Mem&& b);
+  ~Mem();
+  Mem& operator=(const Mem& b);
+  Mem& operator=(Mem&& b);
   void set(const char *buf, std::size_t num);
-  void load(const char *filepath);
+  bool load(const char *filepath);
+  bool mmap(const char *filepath, bool sequential=true);
+  void unmap();
   void save(const char *filepath) const;
-        char *data()      { return &dat[0]; }
-  const char *data() const{ return &dat[0]; }
+  bool mapped() const{ return map!=0; }
+        char *data()      { own(); return dat.data(); } // detaches a mapping
+  const char *data() const{ return map?map:dat.data(); }
   std::size_t tell() const{ return pos; }
-  std::size_t size() const{ return dat.size(); }
+  std::size_t size() const{ return map?len:dat.size(); }
   Mem& seek(std::size_t offset, eSEEKPOS from=BEG);
   Mem& append(const Mem& b);
   std::size_t read(char *buf, std::size_t num);
   std::size_t write(const char *buf, std::size_t num);
 #ifdef HAVE_ZLIB
-//  Mem gz_encode() const;
-//  Mem gz_decode() const;
+  Mem gz_encode(int level=6) const; // one gzip member
+  Mem gz_decode() const; // all members (concatenated), empty on error
 #endif 
+  static bool gzipped(const char *s, std::size_t n);
+private:
+  void own(); // copies a mapping into dat (for writing)
 };
 
 int strlen_ctrl(const char *s);
+double strnflt(const char *s, int n, bool *blank=0);
 int count_lines(const char *s);
 int parse_lines_n(const char *s, const char **lines, int max_lines);
 const char **parse_lines(const char *s);
 
+std::size_t index_lines(const char *s, std::size_t n, 
+  uint32_t *offs, std::size_t max_offs, std::size_t beg=0);
+std::size_t index_lines(const char *s, std::size_t n, 
+  uint64_t *offs, std::size_t max_offs, std::size_t beg=0);
+
+//////////////////////////////////////////////////////////////////////
+//  Line index (offsets of line starts into a text buffer)
+//  line i spans [offs[i],offs[i+1]), 64-bit offsets for buffers over 4 GiB
+
+class Lines{
+protected:
+  const char *s;
+  std::vector<uint32_t> offs; // storage is reused by index()
+  std::vector<uint64_t> offl; // offsets of buffers over 4 GiB (offs unused)
+  std::size_t num;
+  bool wide;                  // offl in use
+public:
+  Lines();
+  std::size_t index(const char *buf, std::size_t n);
+  std::size_t index(const Mem& m){ return index(m.data(),m.size()); }
+  std::size_t size() const{ return num; }
+  std::size_t offset(std::size_t i) const{ return wide?offl[i]:offs[i]; }
+  const char *operator[](std::size_t i) const{ return s+offset(i); }
+  int len(std::size_t i) const; // line length without EOL 
+private:
+  template<typename T> 
+  std::size_t index(std::vector<T>& o, std::size_t n);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Sequential line reader, constant memory for files of any size. Gzip
+//  input (file or memory) is inflated into the window as it is consumed.
+
+class LineReader{
+protected:
+  FILE *fp;
+  const char *src;        // memory source (null for files and gzip)
+  std::vector<char> buf;  // file window 
+  std::size_t beg,end;    // unread bytes [beg,end) of the window
+  uint64_t base;          // file offset of the window (uncompressed)
+  bool eof;               // nothing left to read into the window
+  void *zs;               // inflate state (z_stream), null: plain input
+  std::vector<char> zin;  // compressed input read from the file
+  bool zerr;              // invalid or truncated gzip input
+  uint64_t len;           // plain input length (file or block)
+public:
+  LineReader();
+  LineReader(const LineReader&)=delete;
+  LineReader& operator=(const LineReader&)=delete;
+  ~LineReader();
+  bool open(const char *filepath);
+  void open(const char *s, std::size_t n);
+  void close();
+  const char *next(int *len);
+  uint64_t tell() const{ return base+beg; } // offset of the next line
+  uint64_t size() const{ return len; } // plain input length, 0: gzip
+  bool seek(uint64_t off); // plain input only
+  bool bad() const{ return zerr; } // gzip input ended early (at next()==0)
+private:
+  void fill();
+  bool gzopen(const char *s, std::size_t n);
+  std::size_t inflate(char *s, std::size_t n);
+};
+
+#ifdef HAVE_ZLIB
+//////////////////////////////////////////////////////////////////////
+//  Gzip file writer, streaming. member() ends the current gzip member:
+//  the file is a concatenation of members inflatable on their own.
+
+class GzWriter{
+protected:
+  FILE *fp;
+  void *zs;               // deflate state (z_stream)
+  std::vector<char> zout; // compressed output
+  int level;
+  bool pend;              // the current member has data
+  uint64_t nout;          // compressed bytes written
+  uint64_t nin;           // uncompressed bytes written
+public:
+  GzWriter();
+  GzWriter(const GzWriter&)=delete;
+  GzWriter& operator=(const GzWriter&)=delete;
+  ~GzWriter();
+  bool open(const char *filepath, int level=6);
+  bool write(const char *s, std::size_t n);
+  bool member();
+  bool close();
+  uint64_t tell() const{ return nout; } // compressed bytes, a member offset after member()
+  uint64_t size() const{ return nin; }
+private:
+  bool deflate(int flush);
+};
+#endif
+
 //////////////////////////////////////////////////////////////////////
 //  Unix Time point
 
@@ -234,6 +347,11 @@ public:
   friend std::ostream& operator<<(std::ostream& os, const Mat& b);
 };
 
+#define LSQ_MAXN 16   // parameters of lsq()
+
+bool lsq(const double *H, const double *v, const double *w, int m, int n,
+  double *x, double *Q=0);
+
 
 //////////////////////////////////////////////////////////////////////
 //  Spheroid 
@@ -299,15 +417,117 @@ public:
   Nav();
   Nav(const char *rnx);
   void rnx2nav(const char *rnx);
+  void rnx2nav(const char *const *lines, const int *len, int ver=3);
   void nav2ecf(const Time& t, double *xyz, double *clock_bias) const;
+  void nav2ecf(const Time& t, double *xyz, double *vel, 
+               double *clock_bias, double *clock_drift) const;
   Vec3 nav2ecf(const Time& t, double *clock_bias) const;
   std::string nav2rnx() const;
   double eph2clk(const Time& t) const;
 };
 
 
+//////////////////////////////////////////////////////////////////////
+//  Prepared broadcast ephemeris: the time invariant terms of Nav 
+//  propagation, computed once (propagation reads only this hot set)
+
+struct NavPrep{
+public:
+  Time toe,toc;       // Toe,Toc
+  double A,e,M0,omg,i0,idot;
+  double sqe;         // sqrt(1-e^2)
+  double n;           // corrected mean motion sqrt(mu/A^3)+deln
+  double OMG0;        // OMG0-omge*toes
+  double OMGd;        // OMGd-omge
+  double crc,crs,cuc,cus,cic,cis;
+  double f0,f1,f2;    // SV clock parameters 
+  double rel;         // relativity term -2*sqrt(mu*A)*e/c^2 (x sinE)
+public:
+  NavPrep();
+  NavPrep(const Nav& eph);
+  void set(const Nav& eph);
+  void nav2ecf(const Time& t, double *xyz, double *clock_bias) const;
+  double eph2clk(const Time& t) const;
+};
+
+
+//////////////////////////////////////////////////////////////////////
+//  Broadcast ephemerides as structure of arrays (batched propagation)
+
+class NavSoA{
+protected:
+  std::size_t n,np;        // records, padded to multiple of 4 
+  std::vector<double> par; // parameter rows of np elements
+  std::vector<Time> toe,toc;
+public:
+  NavSoA();
+  void set(const Nav *eph, std::size_t num);
+  void set(const std::vector<Nav>& eph);
+  std::size_t size() const{ return n; }
+  void nav2ecf(const Time *t, double *x, double *y, double *z, 
+               double *clk) const;
+private:
+  void nav2ecf4(std::size_t i, const double *tk, const double *tc,
+                double *x, double *y, double *z, double *clk) const;
+  void nav2ecf1(std::size_t i, double tk, double tc,
+                double *x, double *y, double *z, double *clk) const;
+};
+
+
+//////////////////////////////////////////////////////////////////////
+//  Chebyshev compressed orbit (x,y,z,clock) over uniform segments
+
+class Cheb{
+protected:
+  Time t0;                 // start of the fitted window
+  double h;                // segment length (s)
+  int nseg,deg;
+  std::vector<double> c;   // nseg x (deg+1) x 4 coefficients
+  double err[2];           // verified max error, position (m) and clock (s)
+public:
+  typedef void (*orbfn)(void *ctx, const Time& t, double *xyzc);
+  Cheb();
+  bool fit(const Nav& eph, double tol=1e-4, int deg=10);
+  bool fit(orbfn f, void *ctx, const Time& t0, const Time& t1, 
+           double tol=1e-4, int deg=10);
+  bool eval(const Time& t, double *xyz, double *clock_bias) const;
+  int segments() const{ return nseg; }
+  double maxerr() const{ return err[0]; }
+  double maxerr_clk() const{ return err[1]; }
+};
+
+
+//////////////////////////////////////////////////////////////////////
+//  Broadcast ephemeris store, indexed by satellite 
+
+class EphemerisStore{
+protected:
+  struct Sat{
+    std::vector<Nav> eph; // sorted by toe 
+    std::size_t cur;      // record selected by the last query
+    bool sorted;          // sorted, repeated broadcasts removed
+  };
+  std::vector<Sat> sat;   // by satindex()
+  std::size_t num;
+public:
+  EphemerisStore();
+  void add(const Nav& eph);
+  void add(const std::vector<Nav>& eph);
+  void clear();
+  std::size_t size() const{ return num; }
+  const Nav *select(const char *prn, const Time& t);
+  const Nav *select(const char *prn, int iode, const Time& t);
+  static const int NSLOT=8*64; // satindex() range, per-satellite table size
+  static int satindex(const char *prn);
+  static double maxdtoe(const Nav& eph); // maximum age of the ephemeris (s)
+private:
+  Sat *get(const char *prn);
+};
+
+
 double geomdist(const double *sat, const double *rec, double *los);
 double satazel(const double *geo, const double *los, double *azel);
+double tropmod(const double *geo, const double *azel, double humi);
 
 //////////////////////////////////////////////////////////////////////
 //  Klobuchar model
@@ -317,10 +537,539 @@ private:
   double ion[8];
 public:
   Klob();
+  Klob(const double *ion_); // alpha0..3, beta0..3
   Klob(const char *rnx);
   void rnx2klb(const char *rnx);
   std::string klb2rnx() const;
   double ionmod(const Time& t, const double *geo, const double *azel) const;
 };
 
+//////////////////////////////////////////////////////////////////////
+//  RINEX navigation file (2.10 to 3.05), GPS/GAL/QZS/IRN records
+
+class NavFile{
+public:
+  double ver;         // format version
+  char sys;           // satellite system ('M': mixed)
+  double ion[8];      // GPS Klobuchar alpha0..3, beta0..3
+  double utc[4];      // GPS-UTC A0,A1,T,W
+  int leaps;          // leap seconds 
+  int nskip;          // records of other systems (GLO,SBS,BDS) skipped
+  std::vector<Nav> eph;
+public:
+  NavFile();
+  bool read(const char *filepath, int nthreads=0);
+  bool read(const char *buf, std::size_t n, int nthreads=0);
+  Klob klob() const{ return Klob(ion); }
+  std::size_t header(const Lines& idx); // first line after the header, 0: error
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Lazy view of a RINEX navigation file: records indexed by satellite
+//  and toc from their first line, decoded when first selected and kept
+
+class NavView{
+public:
+  NavFile hdr;        // header fields (eph unused)
+protected:
+  struct Rec{
+    Time toc;
+    uint64_t off;     // first line
+    int sat;          // EphemerisStore::satindex()
+    int nav;          // decoded record, -1: not yet
+  };
+  Mem m;              // file text
+  const char *s;      // text viewed (m or the caller's buffer)
+  std::size_t n;
+  std::vector<Rec> rec;       // by satellite, then toc
+  std::vector<uint32_t> first; // records of satellite k: [first[k],first[k+1])
+  std::vector<Nav> nav;       // decoded, capacity reserved (pointers stay valid)
+public:
+  NavView();
+  NavView(const NavView&)=delete;
+  NavView& operator=(const NavView&)=delete;
+  bool open(const char *filepath);
+  bool open(const char *buf, std::size_t n); // buf kept by the caller
+  std::size_t size() const{ return rec.size(); }
+  std::size_t decoded() const{ return nav.size(); }
+  const Nav *select(const char *prn, const Time& t);
+private:
+  const Nav *get(std::size_t i);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  SP3 precise orbit file
+
+class Sp3File{
+public:
+  struct Sat{
+    char prn[4];
+    int acc;                        // accuracy exponent (2**acc mm, 0: unknown)
+    std::vector<double> x,y,z,clk;  // ECEF (m), clock (s) by epoch, NaN: missing
+    std::vector<double> vx,vy,vz,clkr; // (m/s), (s/s), empty if no V records
+    std::vector<double> sdp,sdv;    // EP/EV std dev x,y,z,clk (4 per epoch)
+  };
+  char ver;           // 'a', 'c' or 'd'
+  char pv;            // 'P' or 'V' (velocities)
+  char tsys[4];       // time system (GPS, GLO, GAL, TAI, UTC)
+  char crd[6];        // coordinate system
+  char agency[5];
+  Time t0;            // first epoch
+  double dt;          // epoch interval (s)
+  std::vector<Time> t;  // epochs
+  std::vector<Sat> sat; // header order
+public:
+  Sp3File();
+  bool read(const char *filepath, int nthreads=0);
+  bool read(const char *buf, std::size_t n, int nthreads=0);
+  std::size_t size() const{ return t.size(); }
+  int find(const char *prn) const; // index into sat, -1 if absent
+private:
+  std::vector<int> slot; // EphemerisStore::satindex() to sat
+  std::size_t header(const Lines& idx);
+  void decode(const Lines& idx, const std::vector<uint32_t>& ep,
+              std::size_t beg, std::size_t end, std::size_t nl);
+};
+
+#define SP3_MAXORD 12
+
+class Sp3Interp{
+protected:
+  const Sp3File *sp3;
+  int ord;                // interpolation points
+  double wb[SP3_MAXORD];  // barycentric weights of the uniform grid
+  double c[SP3_MAXORD];   // Lagrange coefficients at the current time
+  double u;               // current time in epochs from the first one
+  double h;               // epoch interval (s)
+  int i0;                 // first epoch of the window, -1: no time set
+public:
+  Sp3Interp(const Sp3File& sp3, int order=10);
+  bool set(const Time& t);
+  bool eval(int k, double *xyz, double *clk) const;
+  int eval(double *xyz, double *clk) const;
+  bool eval(const char *prn, const Time& t, double *xyz, double *clk);
+private:
+  bool sparse(const Sp3File::Sat& p, double *xyz) const;
+};
+
+//////////////////////////////////////////////////////////////////////
+//  RINEX clock file (AS satellite, optionally AR receiver records)
+
+class ClkFile{
+public:
+  struct Clk{
+    char name[10];            // satellite PRN or receiver name
+    std::vector<double> bias; // clock bias (s) by grid epoch, NaN: missing
+  };
+  double ver;         // format version
+  char tsys[4];       // time system
+  int leaps;          // leap seconds
+  Time t0;            // first epoch of the grid
+  double dt;          // grid interval (s)
+  std::size_t nep;    // grid epochs
+  std::vector<Clk> sat;
+  std::vector<Clk> rcv; // only if read with receivers
+public:
+  ClkFile();
+  bool read(const char *filepath, bool receivers=false, int nthreads=0);
+  bool read(const char *buf, std::size_t n, bool receivers=false, int nthreads=0);
+  int find(const char *prn) const;     // index into sat, -1 if absent
+  int findrcv(const char *name) const; // index into rcv, -1 if absent
+  bool satclk(const char *prn, const Time& t, double *dts) const;
+  bool rcvclk(const char *name, const Time& t, double *dtr) const;
+  bool interp(const Clk& c, const Time& t, double *bias) const;
+private:
+  std::vector<int> slot; // EphemerisStore::satindex() to sat
+  std::size_t header(const Lines& idx);
+  void decode(const Lines& idx, const std::vector<uint32_t>& rec,
+              const std::vector<int32_t>& col, std::size_t beg, 
+              std::size_t end, std::size_t *noff);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Observation epoch, structure of arrays: one column per observable
+//  code (ObsFile::code), val[col*cap+i] for satellite i
+
+class ObsEpoch{
+public:
+  Time t;
+  int flag;                 // 0: ok, 1: power failure, 2-5: event, 6: slips
+  double clk;               // receiver clock offset (s), 0: not given
+  int n;                    // satellites
+  int ncol;                 // columns
+  int cap;                  // satellite capacity of the buffers
+  std::vector<char> sat;    // PRN of satellite i at sat[4*i]
+  std::vector<double> val;  // observations, NaN: missing
+  std::vector<uint8_t> lli; // loss of lock indicators
+  std::vector<uint8_t> ssi; // signal strength (1-9, 0: unknown)
+public:
+  ObsEpoch();
+  void resize(int ncol, int nsat);
+  void clear(int nsat);
+  int find(const char *prn) const;
+  const char *prn(int i) const{ return &sat[4*i]; }
+  double obs(int col, int i) const{ return val[(std::size_t)col*cap+i]; }
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Observation selection, applied while parsing
+
+class ObsSelect{
+public:
+  std::string sys;    // systems kept ("GE"), empty: all
+  std::vector<std::string> code; // codes kept ("L1" keeps L1C, L1W...), empty: all
+  Time beg,end;       // epochs kept (beg<=t<=end) when window is set
+  bool window;
+public:
+  ObsSelect();
+  bool system(char c) const;
+  bool observable(const char *obs) const;
+  bool epoch(const Time& t) const{ return !window||(t>=beg&&t<=end); }
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Compact RINEX (Hatanaka) differential state of one numeric series
+
+#define CRX_MAXORD 9
+
+struct CrxArc{
+  int64_t d[CRX_MAXORD+1]; // differences of order 0 to k, last epoch
+  int k;                   // current order
+  int m;                   // maximum order, 0: no arc (next value initializes)
+};
+
+//////////////////////////////////////////////////////////////////////
+//  RINEX observation file, streaming reader (plain or Compact RINEX)
+
+class ObsIndex;
+
+class ObsFile{
+public:
+  double ver;         // format version
+  char type;          // 'O'
+  char sys;           // satellite system ('M': mixed)
+  char tsys[4];       // time system
+  char marker[61];    // marker name
+  double pos[3];      // approximate position XYZ (m)
+  double del[3];      // antenna delta H/E/N (m)
+  double interval;    // observation interval (s), 0: not given
+  double crx;         // Compact RINEX version, 0: plain RINEX
+  std::vector<std::string> code; // observable code of each column
+  std::size_t nskip;  // CRINEX: satellite records dropped (no satindex())
+protected:
+  LineReader in;
+  std::vector<int> cmap[8]; // record order to column, by system "GRECJIS"
+  int npend;          // observable types still to read (continuation)
+  char psys;          // system of the types being read ('*': all)
+  ObsSelect sel;
+  bool use[8];        // system has selected columns
+  std::string cline;  // CRINEX: last epoch line
+  std::vector<CrxArc> carc;   // arcs of state k at [k*ctyp+j]
+  std::vector<char> cflag;    // LLI/SSI text of state k at [2*k*ctyp]
+  std::vector<int> cslot;     // state of EphemerisStore::satindex(), -1: none
+  std::vector<uint32_t> cseen; // last epoch of each state
+  CrxArc cclk;        // receiver clock
+  int ctyp;           // observation types per state
+  uint32_t cep;       // epoch counter
+public:
+  ObsFile();
+  void select(const ObsSelect& s){ sel=s; } // from the next open
+  bool open(const char *filepath);
+  bool open(const char *buf, std::size_t n);
+  void close();
+  bool next(ObsEpoch& ep);
+  int column(const char *obs) const; // -1 if not in the file
+  const std::vector<int>& columns(char sys) const; // record order to column
+  uint64_t tell() const{ return in.tell(); } // offset of the next epoch (plain text)
+  bool seek(uint64_t off); // to an epoch header, plain text only
+  bool seek(const ObsIndex& idx, const Time& t); // to the mark before t
+private:
+  void reset();
+  bool header();
+  void hdrline(const char *s, int n);
+  int addcode(const char *s, int n);
+  void types(const char *s, int n, int first, int step, int width, int per);
+  void usemap();
+  bool skip(int nl);
+  bool special(ObsEpoch& ep, int f, int ns);
+  bool records2(ObsEpoch& ep, int ns);
+  bool records3(ObsEpoch& ep, int ns);
+  bool next2(ObsEpoch& ep);
+  bool next3(ObsEpoch& ep);
+  void crxreset();
+  int crxstate(int k);
+  bool nextcrx(ObsEpoch& ep);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Compact RINEX 3.0 writer, streaming (state bounded by the number of
+//  satellites, output flushed as it grows)
+
+class GzWriter;
+
+class CrxWriter{
+protected:
+  FILE *fp;
+  GzWriter *gz;       // output of ".gz" files (fp null), null until needed
+  bool on;            // file open
+  std::string out;    // pending output
+  int ord;            // maximum order of the differences
+  bool hdr;           // header written
+  std::string head;   // header up to the observation types
+  char tsys[4];
+  std::string line;   // epoch line being written
+  std::vector<int> cmap[8];  // record order to epoch column, by system
+  std::string eline;  // last epoch line, empty: next epoch initialized
+  std::vector<CrxArc> carc;  // arcs of state k at [k*ctyp+j]
+  std::vector<char> cflag;   // LLI/SSI text of state k at [2*k*ctyp]
+  std::vector<int> cslot;    // state of EphemerisStore::satindex(), -1: none
+  std::vector<uint32_t> cseen; // last epoch of each state
+  CrxArc cclk;
+  int ctyp;
+  uint32_t cep;
+public:
+  CrxWriter();
+  CrxWriter(const CrxWriter&)=delete;
+  CrxWriter& operator=(const CrxWriter&)=delete;
+  ~CrxWriter();
+  bool open(const char *filepath, const ObsFile& obs, int order=3);
+  bool write(const ObsEpoch& ep);
+  bool close();
+private:
+  void reset();
+  int state(int k);
+  void header(const Time& t0);
+  bool flush(bool all=false);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Time index of an observation file, kept next to it in "<file>.idx":
+//  the time and offset of selected epoch headers
+
+struct ObsMark{
+  Time t;             // epoch at the mark
+  uint64_t off;       // file offset (compressed in gzip archives)
+  uint64_t raw;       // uncompressed text offset
+};
+
+class ObsIndex{
+public:
+  std::vector<ObsMark> mark; // time order, last one: end of the epochs
+  uint64_t head;      // header length (uncompressed)
+  bool gz;            // marks start the members of a blocked gzip archive
+public:
+  ObsIndex();
+  bool build(const char *filepath, int every=120);
+  bool build(const char *buf, std::size_t n, int every=120);
+  bool save(const char *filepath) const;
+  bool load(const char *filepath);
+  std::size_t find(const Time& t) const; // last mark before t (0 if none)
+  void slices(int n, std::vector<std::size_t>& k) const; // marks k[i] to k[i+1]
+};
+
+#ifdef HAVE_ZLIB
+//////////////////////////////////////////////////////////////////////
+//  Blocked gzip observation archive: the text is cut at epoch headers
+//  into gzip members of about a block each, one index mark per member,
+//  so a time window is read inflating only the members it covers
+
+class ObsArchive{
+protected:
+  Mem m;              // archive mapping
+  ObsIndex idx;
+public:
+  static bool write(const char *src, const char *filepath,
+    std::size_t block=1<<20, int level=6);
+  bool open(const char *filepath);
+  bool read(const Time& beg, const Time& end, Mem& txt, int nthreads=0) const;
+  const ObsIndex& index() const{ return idx; }
+};
+#endif
+
+//////////////////////////////////////////////////////////////////////
+//  u-blox UBX binary stream: frames synced on 0xB5 0x62 and checked
+//  by their Fletcher checksum, RXM-RAWX into observation epochs,
+//  RXM-SFRBX (GPS/QZSS LNAV, Galileo I/NAV) into Nav, NAV-PVT
+
+#define UBX_RAWX 1    // next(): ep holds an epoch
+#define UBX_NAV  2    //         eph holds a new ephemeris
+#define UBX_PVT  3    //         pvt updated
+
+struct UbxPvt{
+  Time t;             // UTC
+  int fix;            // 0: no fix, 2: 2D, 3: 3D, 4: GNSS+DR, 5: time only
+  bool ok;            // gnssFixOK
+  int nsat;           // satellites used
+  double lat,lon;     // (deg)
+  double hgt,hmsl;    // ellipsoidal and mean sea level height (m)
+  double hacc,vacc;   // accuracy estimates (m)
+  double vel[3];      // north, east, down (m/s)
+  double pdop;
+};
+
+class UbxReader{
+public:
+  std::vector<std::string> code; // observable code of each epoch column
+  UbxPvt pvt;         // last NAV-PVT
+  uint64_t nbad;      // frames dropped by their checksum
+protected:
+  FILE *fp;
+  const char *src;        // memory source (null for files)
+  std::vector<char> buf;  // file window
+  std::size_t beg,end;    // unscanned bytes [beg,end)
+  bool eof;
+  int col[8][16];         // first column of gnssId, sigId (-1: none yet)
+  std::vector<uint16_t> lock; // lock time of signal group g at [g*512+slot]
+  std::vector<int> row;   // epoch row of each slot, -1: none
+  std::vector<uint8_t> sub; // navigation words of each slot (UBX_SUBLEN)
+  std::vector<uint32_t> have; // words present (bit mask) of each slot
+  std::vector<int> iod;   // last ephemeris issue sent of each slot
+  int week;               // GPS week of the last epoch (0: none yet)
+public:
+  UbxReader();
+  UbxReader(const UbxReader&)=delete;
+  UbxReader& operator=(const UbxReader&)=delete;
+  ~UbxReader();
+  bool open(const char *filepath);
+  void open(const char *s, std::size_t n);
+  void close();
+  const uint8_t *frame(int *len); // next valid frame (len: payload), 0 at end
+  int next(ObsEpoch& ep, Nav& eph); // UBX_RAWX, UBX_NAV or UBX_PVT, 0 at end
+private:
+  void reset();
+  void fill();
+  int sigcol(int gnss, int sig);
+  bool rawx(const uint8_t *p, int n, ObsEpoch& ep);
+  bool sfrbx(const uint8_t *p, int n, Nav& eph);
+  bool navpvt(const uint8_t *p, int n);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  RTCM 3 stream: frames synced on 0xD3 and checked by their CRC-24Q,
+//  MSM4/5/7 (GPS, GLONASS, Galileo, SBAS, QZSS, BeiDou) into epochs,
+//  1019 (GPS LNAV) and 1045 (Galileo F/NAV) into Nav
+
+#define RTCM_OBS 1    // next(): ep holds an epoch
+#define RTCM_NAV 2    //         eph holds an ephemeris
+
+class RtcmReader{
+public:
+  std::vector<std::string> code; // observable code of each epoch column
+  Time tref;          // approximate GPS time, resolves weeks; follows the
+                      // epochs (0: system clock when first needed)
+  int leaps;          // GPS-UTC leap seconds, for GLONASS epochs (18)
+  int staid;          // reference station of the last MSM
+  uint64_t nbad;      // frames dropped by their CRC
+protected:
+  FILE *fp;
+  const char *src;        // memory source (null for files)
+  std::vector<char> buf;  // window of the file or pipe
+  std::size_t beg,end,cur; // unscanned bytes [beg,end), last frame at cur
+  bool eof;
+  int col[6][32];         // first column of system, MSM signal (-1: none yet)
+  std::vector<uint16_t> lock; // lock indicator of signal group g at [g*384+slot]
+  std::vector<int> row;   // epoch row of each slot, -1: none
+  std::vector<int> used;  // slots of the epoch being assembled
+  std::vector<int> iod;   // last ephemeris issue sent of each slot
+  int fcn[64];            // GLONASS frequency channel+7 (-1: unknown)
+  bool pend;              // ep holds a partial epoch
+public:
+  RtcmReader();
+  RtcmReader(const RtcmReader&)=delete;
+  RtcmReader& operator=(const RtcmReader&)=delete;
+  ~RtcmReader();
+  bool open(const char *filepath); // file or named pipe
+  void open(const char *s, std::size_t n);
+  void close();
+  const uint8_t *frame(int *len); // next valid frame (len: message bytes), 0 at end
+  int next(ObsEpoch& ep, Nav& eph); // RTCM_OBS or RTCM_NAV, 0 at end
+private:
+  void reset();
+  void fill();
+  Time gpst(int sys, const uint8_t *p);
+  int sigcol(int sys, int sig);
+  int msm(const uint8_t *p, int n, ObsEpoch& ep);
+  void done();
+  bool eph1019(const uint8_t *p, int n, Nav& eph);
+  bool eph1045(const uint8_t *p, int n, Nav& eph);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Standard point positioning: single frequency pseudoranges and
+//  broadcast ephemerides (GPS, QZSS, Galileo), iterated weighted least
+//  squares per epoch. The workspace is sized for maxsat satellites once
+//  and reused, so solve() does not allocate in steady state.
+
+#define SPP_NCLK 2            // receiver clocks: GPS/QZSS, Galileo
+#define SPP_NX   (3+SPP_NCLK) // parameters
+
+struct SppSol{
+  Time t;             // epoch (receiver time tag)
+  double pos[3];      // ECEF XYZ (m)
+  double geo[3];      // latitude, longitude (deg), height (m)
+  double clk[SPP_NCLK]; // receiver clock of each system (m)
+  double Q[SPP_NX*SPP_NX]; // covariance of the parameters (m^2)
+  double pdop;
+  double rms;         // post-fit residuals (m)
+  int nsat;           // satellites used
+  int niter;          // iterations
+  bool ok;
+};
+
+class Spp{
+public:
+  double elmask;      // elevation mask (rad), 15 deg
+  double sigma;       // code noise at zenith (m), 0.3
+  int maxiter;        // 10
+  bool iono;          // Klobuchar delay (klob) applied
+  bool trop;          // Saastamoinen delay applied
+  Klob klob;
+  SppSol sol;         // last solution, a priori of the next when ok
+protected:
+  Spheroid ell;
+  int cap;            // satellites of the workspace
+  int ncode;          // epoch codes mapped into pcol
+  int pcol[3][9];     // pseudorange columns of G, E, J by priority (-1: end)
+  std::vector<double> xs;   // satellite ECEF at transmission [3*i] (m)
+  std::vector<double> pr;   // pseudorange corrected for satellite clock (m)
+  std::vector<double> H,v,w; // design matrix, residuals, weights
+  std::vector<int> clk;     // receiver clock of satellite i
+public:
+  Spp(int maxsat=64);
+  void reserve(int maxsat);
+  bool solve(const ObsEpoch& ep, const std::vector<std::string>& code,
+             EphemerisStore& nav);
+private:
+  void mapcodes(const std::vector<std::string>& code);
+  int satpos(const ObsEpoch& ep, EphemerisStore& nav);
+  int resid(const double *x, int ns, const Time& t, int *nrow);
+};
+
+//////////////////////////////////////////////////////////////////////
+//  Binary ephemeris cache (memory mapped, little-endian)
+
+class NavCache{
+public:
+  struct Hdr;
+  struct Idx;
+  struct Rec;
+protected:
+  Mem m;
+  const Hdr *hdr;
+  const Idx *idx;     // one entry per satellite
+  const Rec *rec;     // sorted by satellite, then toe
+  std::size_t nsat,nrec;
+public:
+  NavCache();
+  NavCache(const NavCache&)=delete;
+  NavCache& operator=(const NavCache&)=delete;
+  static bool save(const char *filepath, const std::vector<Nav>& eph);
+  bool load(const char *filepath);
+  std::size_t size() const{ return rec?nrec:0; }
+  std::size_t satellites() const{ return idx?nsat:0; }
+  void get(std::size_t i, Nav& eph) const;
+  void get(std::vector<Nav>& eph) const;
+  std::size_t find(const char *prn, std::size_t *count) const;
+};
+
 #endif 
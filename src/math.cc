@@ -234,9 +234,8 @@ std::ostream& operator<<(std::ostream& os, const Vec3& b)
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
-#if 0
-// Cholesky factorization 
-static void chol(double *A, int n)
+// Cholesky factorization (lower triangle, in place), false if not S.P.D.
+static bool chol(double *A, int n)
 {
   int i,j,k;
   double x, r;
@@ -244,12 +243,12 @@ static void chol(double *A, int n)
     x=A[j*n+j];
     for(k=0;k<j;k++)
       x-=A[j*n+k]*A[j*n+k];
+    if(x<=0.0){
 #ifdef DEBUG
-    if(x<0.0){
       warn("matrix is not S.P.D.");
-      return;
-    }
 #endif 
+      return false;
+    }
     x=sqrt(x);
     A[j*n+j]=x;
     r=1.0/x;
@@ -260,6 +259,7 @@ static void chol(double *A, int n)
       A[i*n+j]=x*r;
     }
   }
+  return true;
 }
 
 // Cholesky back-substitution
@@ -281,7 +281,47 @@ static void chbksb(const double *L, int n, double *x, int j)
     x[k]/=L[k*n+k];
   }
 }
-#endif 
+
+// Weighted least squares on caller buffers (no allocation, n<=LSQ_MAXN):
+// x=(H'WH)^-1 H'Wv and, if Q is given, Q=(H'WH)^-1. H is m x n row-major,
+// w the weights (null: unit weights). False if H'WH is singular.
+bool lsq(const double *H, const double *v, const double *w, int m, int n,
+  double *x, double *Q)
+{
+  double N[LSQ_MAXN*LSQ_MAXN],b[LSQ_MAXN],hw;
+  int i,j,k;
+
+  if(n>LSQ_MAXN)
+    return false;
+  memset(N,0,sizeof(double)*n*n);
+  memset(b,0,sizeof(double)*n);
+  for(k=0;k<m;k++,H+=n){
+    for(i=0;i<n;i++){
+      if(H[i]==0.0)
+        continue;
+      hw=H[i]*(w?w[k]:1.0);
+      b[i]+=hw*v[k];
+      for(j=0;j<=i;j++)
+        N[i*n+j]+=hw*H[j];
+    }
+  }
+  if(!chol(N,n))
+    return false;
+  for(i=0;i<n;i++)
+    x[i]=b[i];
+  chbksb(N,n,x,0);
+  if(Q){
+    for(j=0;j<n;j++){ // column j, the rows above from the columns before
+      double *q=Q+j*n;
+      memset(q,0,sizeof(double)*n);
+      q[j]=1.0;
+      chbksb(N,n,q,j);
+      for(i=0;i<j;i++)
+        q[i]=Q[i*n+j];
+    }
+  }
+  return true;
+}
 
 //LU decomposition
 static double ludcmp(double *A, int m, int n, int *piv)
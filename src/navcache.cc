@@ -0,0 +1,280 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   navcache.cc --Binary broadcast ephemeris cache (memory mapped)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include <algorithm>
+
+// File layout, all little-endian, every block 8-byte aligned:
+//
+//   header   64 bytes   magic "KEPLNAV", version, sizes and offsets
+//   index    nsat x 16  prn[4], first record, record count, spare
+//   records  nrec x 288 fixed-size NavCache::Rec, sorted by sat and toe
+//
+// Records hold the parsed Nav fields (Time split into seconds and
+// fraction) so loading is a mmap and a bounds check, no text parsing.
+
+#define NAVC_MAGIC   "KEPLNAV"
+#define NAVC_VERSION 2 // 2: Galileo BGD E5b/E1 in tgd[1], not iodc
+
+struct NavCache::Hdr{
+  char magic[8];
+  uint32_t version;
+  uint32_t recsize;
+  uint32_t nsat;
+  uint32_t nrec;
+  uint64_t idxoff;
+  uint64_t recoff;
+  uint8_t spare[24];
+};
+
+struct NavCache::Idx{
+  char prn[4];
+  uint32_t first;
+  uint32_t count;
+  uint32_t spare;
+};
+
+struct NavCache::Rec{
+  char prn[4];
+  int32_t iode,iodc,sva,svh,week,code,flag;
+  int64_t toe_sec,toc_sec,ttr_sec;
+  double toe_frac,toc_frac,ttr_frac;
+  double A,e,i0,OMG0,omg,M0,deln,OMGd,idot;
+  double crc,crs,cuc,cus,cic,cis;
+  double toes,fit,f0,f1,f2,tgd[4],Adot,ndot;
+};
+
+static_assert(sizeof(NavCache::Hdr)==64,"cache header must be 64 bytes");
+static_assert(sizeof(NavCache::Idx)==16,"cache index must be 16 bytes");
+static_assert(sizeof(NavCache::Rec)==288,"cache record must be 288 bytes");
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__==__ORDER_BIG_ENDIAN__)
+  #define NAVC_SWAP 1 // file is little-endian, swap on big-endian hosts
+#endif
+
+#ifdef NAVC_SWAP
+static void swap(void *p, int n)
+{
+  char *c=(char*)p;
+  for(int i=0;i<n/2;i++)
+    std::swap(c[i],c[n-1-i]);
+}
+
+// every field of Rec and Idx but prn is 4 or 8 bytes wide
+static void swapfields(void *p, std::size_t n, std::size_t nchar)
+{
+  char *c=(char*)p+nchar;
+  std::size_t i;
+  for(i=nchar;i<n&&i<nchar+4*7;i+=4,c+=4) // int32 block of Rec/Idx
+    swap(c,4);
+  for(;i<n;i+=8,c+=8)
+    swap(c,8);
+}
+
+static void swaphdr(NavCache::Hdr& h)
+{
+  swap(&h.version,4); swap(&h.recsize,4);
+  swap(&h.nsat,4); swap(&h.nrec,4);
+  swap(&h.idxoff,8); swap(&h.recoff,8);
+}
+#endif
+
+static void nav2rec(const Nav& a, NavCache::Rec& r)
+{
+  memset(&r,0,sizeof(r));
+  memcpy(r.prn,a.prn,4);
+  r.iode=a.iode; r.iodc=a.iodc; r.sva=a.sva; r.svh=a.svh;
+  r.week=a.week; r.code=a.code; r.flag=a.flag;
+  r.toe_sec=a.toe.t_sec; r.toe_frac=a.toe.t_frac;
+  r.toc_sec=a.toc.t_sec; r.toc_frac=a.toc.t_frac;
+  r.ttr_sec=a.ttr.t_sec; r.ttr_frac=a.ttr.t_frac;
+  r.A=a.A; r.e=a.e; r.i0=a.i0; r.OMG0=a.OMG0; r.omg=a.omg; r.M0=a.M0;
+  r.deln=a.deln; r.OMGd=a.OMGd; r.idot=a.idot;
+  r.crc=a.crc; r.crs=a.crs; r.cuc=a.cuc; r.cus=a.cus; r.cic=a.cic; r.cis=a.cis;
+  r.toes=a.toes; r.fit=a.fit; r.f0=a.f0; r.f1=a.f1; r.f2=a.f2;
+  for(int i=0;i<4;i++)
+    r.tgd[i]=a.tgd[i];
+  r.Adot=a.Adot; r.ndot=a.ndot;
+#ifdef NAVC_SWAP
+  swapfields(&r,sizeof(r),4);
+#endif
+}
+
+static void rec2nav(const NavCache::Rec& r_, Nav& a)
+{
+#ifdef NAVC_SWAP
+  NavCache::Rec r(r_);
+  swapfields(&r,sizeof(r),4);
+#else
+  const NavCache::Rec& r=r_;
+#endif
+  memcpy(a.prn,r.prn,4);
+  a.iode=r.iode; a.iodc=r.iodc; a.sva=r.sva; a.svh=r.svh;
+  a.week=r.week; a.code=r.code; a.flag=r.flag;
+  a.toe.t_sec=r.toe_sec; a.toe.t_frac=r.toe_frac;
+  a.toc.t_sec=r.toc_sec; a.toc.t_frac=r.toc_frac;
+  a.ttr.t_sec=r.ttr_sec; a.ttr.t_frac=r.ttr_frac;
+  a.A=r.A; a.e=r.e; a.i0=r.i0; a.OMG0=r.OMG0; a.omg=r.omg; a.M0=r.M0;
+  a.deln=r.deln; a.OMGd=r.OMGd; a.idot=r.idot;
+  a.crc=r.crc; a.crs=r.crs; a.cuc=r.cuc; a.cus=r.cus; a.cic=r.cic; a.cis=r.cis;
+  a.toes=r.toes; a.fit=r.fit; a.f0=r.f0; a.f1=r.f1; a.f2=r.f2;
+  for(int i=0;i<4;i++)
+    a.tgd[i]=r.tgd[i];
+  a.Adot=r.Adot; a.ndot=r.ndot;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  Binary ephemeris cache
+
+NavCache::NavCache()
+  : hdr(0), idx(0), rec(0)
+{}
+
+bool NavCache::save(const char *filepath, const std::vector<Nav>& eph)
+{
+  std::vector<const Nav*> p;
+  std::vector<Idx> ix;
+  std::vector<Rec> rs;
+  std::size_t i;
+  Hdr h;
+  bool ok;
+  FILE *fp;
+
+  for(i=0;i<eph.size();i++)
+    if(EphemerisStore::satindex(eph[i].prn)>=0)
+      p.push_back(&eph[i]);
+  std::stable_sort(p.begin(),p.end(),[](const Nav *a, const Nav *b){
+    int ka=EphemerisStore::satindex(a->prn);
+    int kb=EphemerisStore::satindex(b->prn);
+    return ka!=kb?ka<kb:a->toe<b->toe;
+  });
+
+  rs.resize(p.size());
+  for(i=0;i<p.size();i++){
+    nav2rec(*p[i],rs[i]);
+    if(!i||strncmp(p[i]->prn,p[i-1]->prn,3)){
+      Idx x;
+      memset(&x,0,sizeof(x));
+      memcpy(x.prn,p[i]->prn,4);
+      x.first=i;
+      ix.push_back(x);
+    }
+    ix.back().count++;
+  }
+
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,NAVC_MAGIC,8);
+  h.version=NAVC_VERSION;
+  h.recsize=sizeof(Rec);
+  h.nsat=ix.size();
+  h.nrec=rs.size();
+  h.idxoff=sizeof(Hdr);
+  h.recoff=sizeof(Hdr)+ix.size()*sizeof(Idx);
+#ifdef NAVC_SWAP
+  swaphdr(h);
+  for(auto& x: ix)
+    swapfields(&x,sizeof(x),4);
+#endif
+
+  if(!(fp=fopen(filepath,"wb"))){
+#ifdef DEBUG
+    warn("cannot create file");
+#endif
+    return false;
+  }
+  ok=fwrite(&h,sizeof(h),1,fp)==1;
+  if(ix.size())
+    ok=fwrite(&ix[0],sizeof(Idx),ix.size(),fp)==ix.size()&&ok;
+  if(rs.size())
+    ok=fwrite(&rs[0],sizeof(Rec),rs.size(),fp)==rs.size()&&ok;
+  ok=fclose(fp)==0&&ok;
+#ifdef DEBUG
+  if(!ok)
+    warn("cannot write file");
+#endif
+  return ok;
+}
+
+// maps the cache file, no parsing: records are read in place once the
+// header and index are checked against the mapping
+bool NavCache::load(const char *filepath)
+{
+  Hdr h;
+  Idx x;
+  const char *d;
+  std::size_t i,n;
+  bool ok;
+
+  hdr=0; idx=0; rec=0;
+  if(!m.mmap(filepath,false)||m.size()<sizeof(Hdr))
+    return false;
+  d=std::as_const(m).data(); // read in place, not detached
+
+  memcpy(&h,d,sizeof(h));
+#ifdef NAVC_SWAP
+  swaphdr(h);
+#endif
+  n=m.size();
+  ok=!memcmp(h.magic,NAVC_MAGIC,8)&&h.version==NAVC_VERSION&&
+     h.recsize==sizeof(Rec)&&h.idxoff%8==0&&h.recoff%8==0&&
+     h.idxoff<=n&&h.nsat<=(n-h.idxoff)/sizeof(Idx)&&
+     h.recoff<=n&&h.nrec<=(n-h.recoff)/sizeof(Rec);
+  for(i=0;ok&&i<h.nsat;i++){ // records of every satellite in the file
+    memcpy(&x,d+h.idxoff+i*sizeof(Idx),sizeof(x));
+#ifdef NAVC_SWAP
+    swapfields(&x,sizeof(x),4);
+#endif
+    ok=x.first<=h.nrec&&x.count<=h.nrec-x.first;
+  }
+  if(!ok){
+#ifdef DEBUG
+    warn("invalid or incompatible ephemeris cache");
+#endif
+    m.unmap();
+    return false;
+  }
+  nsat=h.nsat;
+  nrec=h.nrec;
+  hdr=(const Hdr*)d;
+  idx=(const Idx*)(d+h.idxoff);
+  rec=(const Rec*)(d+h.recoff);
+  return true;
+}
+
+void NavCache::get(std::size_t i, Nav& eph) const
+{
+  if(i>=size()){
+#ifdef DEBUG
+    warn("record index out of range");
+#endif
+    return;
+  }
+  rec2nav(rec[i],eph);
+}
+
+void NavCache::get(std::vector<Nav>& eph) const
+{
+  eph.resize(nrec);
+  for(std::size_t i=0;i<nrec;i++)
+    rec2nav(rec[i],eph[i]);
+}
+
+// first record of a satellite (records are contiguous), count=0 if none
+std::size_t NavCache::find(const char *prn, std::size_t *count) const
+{
+  for(std::size_t i=0;i<nsat;i++){ // at most a few hundred satellites
+    if(!strncmp(idx[i].prn,prn,3)){
+      Idx x=idx[i];
+#ifdef NAVC_SWAP
+      swapfields(&x,sizeof(x),4);
+#endif
+      *count=x.count;
+      return x.first;
+    }
+  }
+  *count=0;
+  return 0;
+}
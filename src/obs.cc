@@ -0,0 +1,1093 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   obs.cc --RINEX observation file reader (versions 2.10 to 4.01, streaming)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include <algorithm>
+#include <ctime>
+
+static const char sysid[]="GRECJIS";
+
+// header label (columns 61-80)
+static bool label(const char *s, int n, const char *lab)
+{
+  int k=strlen(lab);
+  return n>=60+k&&!strncmp(s+60,lab,k);
+}
+
+// system block of the observable maps (-1: not supported)
+static int sysindex(char c)
+{
+  const char *p=c?strchr(sysid,c):0;
+  return p?p-sysid:-1;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  Observation epoch (structure of arrays)
+
+ObsEpoch::ObsEpoch()
+  : flag(0), clk(0.0), n(0), ncol(0), cap(0)
+{}
+
+// keeps the storage: only grows when an epoch has more satellites or
+// the file more columns than seen before
+void ObsEpoch::resize(int ncol_, int nsat)
+{
+  if(ncol_!=ncol||nsat>cap){
+    ncol=ncol_;
+    cap=nsat>cap?(nsat+15)&~15:cap;
+    sat.resize(4*cap);
+    val.resize((std::size_t)ncol*cap);
+    lli.resize((std::size_t)ncol*cap);
+    ssi.resize((std::size_t)ncol*cap);
+  }
+}
+
+// empty values for the first nsat satellites
+void ObsEpoch::clear(int nsat)
+{
+  for(int c=0;c<ncol;c++){
+    std::fill_n(&val[(std::size_t)c*cap],nsat,NAN);
+    memset(&lli[(std::size_t)c*cap],0,nsat);
+    memset(&ssi[(std::size_t)c*cap],0,nsat);
+  }
+}
+
+int ObsEpoch::find(const char *prn) const
+{
+  for(int i=0;i<n;i++)
+    if(!strncmp(&sat[4*i],prn,3))
+      return i;
+  return -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  Observation selection
+
+ObsSelect::ObsSelect()
+  : window(false)
+{}
+
+bool ObsSelect::system(char c) const
+{
+  return sys.empty()||sys.find(c)!=std::string::npos;
+}
+
+// a selected code without attribute ("C1") keeps all tracking modes
+bool ObsSelect::observable(const char *obs) const
+{
+  if(code.empty())
+    return true;
+  for(const auto& c: code)
+    if(!strncmp(obs,c.c_str(),c.size()))
+      return true;
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  RINEX observation file
+
+ObsFile::ObsFile()
+{
+  reset();
+}
+
+void ObsFile::reset()
+{
+  ver=0.0;
+  type=sys=0;
+  tsys[0]=marker[0]='\0';
+  for(int i=0;i<3;i++)
+    pos[i]=del[i]=0.0;
+  interval=0.0;
+  code.clear();
+  for(auto& m: cmap)
+    m.clear();
+  npend=0;
+  psys=0;
+  crx=0.0;
+  nskip=0;
+  cline.clear();
+  ctyp=0;
+  cep=0;
+  for(int j=0;j<8;j++)
+    use[j]=false;
+}
+
+bool ObsFile::open(const char *filepath)
+{
+  reset();
+  return in.open(filepath)&&header();
+}
+
+bool ObsFile::open(const char *buf, std::size_t n)
+{
+  reset();
+  in.open(buf,n);
+  return header();
+}
+
+void ObsFile::close()
+{
+  in.close();
+}
+
+int ObsFile::column(const char *obs) const
+{
+  for(std::size_t c=0;c<code.size();c++)
+    if(code[c]==obs)
+      return c;
+  return -1;
+}
+
+const std::vector<int>& ObsFile::columns(char sys) const
+{
+  return cmap[std::max(sysindex(sys),0)];
+}
+
+// column of an observable code, new codes are appended (-1: not selected)
+int ObsFile::addcode(const char *s, int n)
+{
+  std::string c(s,n);
+  int k;
+
+  while(c.size()&&c.back()==' ')
+    c.pop_back();
+  if((k=column(c.c_str()))>=0)
+    return k;
+  if(!sel.observable(c.c_str()))
+    return -1;
+  code.push_back(c);
+  return code.size()-1;
+}
+
+// Observable list of one system, RINEX 2 (9 per line) or 3 (13 per line).
+// Unselected fields stay in the maps as -1: the record layout is kept, so
+// they are stepped over without conversion.
+void ObsFile::types(const char *s, int n, int first, int step, int width, int per)
+{
+  int k,c,s0=psys=='*'?0:sysindex(psys),s1=psys=='*'?7:s0+1;
+
+  for(k=0;k<per&&npend>0&&first+step*k+width<=n;k++,npend--){
+    if(s0<0) // system not supported: its records are skipped
+      continue;
+    c=addcode(s+first+step*k,width);
+    for(int j=s0;j<s1;j++)
+      cmap[j].push_back(sel.system(sysid[j])?c:-1);
+  }
+}
+
+// systems with at least one selected column, the others are skipped
+void ObsFile::usemap()
+{
+  for(int j=0;j<7;j++){
+    use[j]=false;
+    for(int c: cmap[j])
+      use[j]=use[j]||c>=0;
+  }
+}
+
+// skips nl lines unread (false: end of file)
+bool ObsFile::skip(int nl)
+{
+  int n;
+
+  for(int k=0;k<nl;k++)
+    if(!in.next(&n))
+      return false;
+  return true;
+}
+
+void ObsFile::hdrline(const char *s, int n)
+{
+  if(label(s,n,"CRINEX VERS   / TYPE")){
+    crx=strnflt(s,9);
+  }
+  else if(label(s,n,"RINEX VERSION / TYPE")){
+    ver=strnflt(s,9);
+    type=s[20];
+    sys=s[40]==' '?'G':s[40];
+  }
+  else if(label(s,n,"MARKER NAME")){
+    memcpy(marker,s,60);
+    marker[60]='\0';
+    for(int k=59;k>=0&&marker[k]==' ';k--)
+      marker[k]='\0';
+  }
+  else if(label(s,n,"APPROX POSITION XYZ")){
+    for(int k=0;k<3;k++)
+      pos[k]=strnflt(s+14*k,14);
+  }
+  else if(label(s,n,"ANTENNA: DELTA H/E/N")){
+    for(int k=0;k<3;k++)
+      del[k]=strnflt(s+14*k,14);
+  }
+  else if(label(s,n,"# / TYPES OF OBSERV")){ // RINEX 2, all systems
+    if(s[5]!=' '){
+      for(auto& m: cmap)
+        m.clear();
+      npend=(int)strnflt(s,6);
+      psys='*';
+    }
+    types(s,n,10,6,2,9);
+  }
+  else if(label(s,n,"SYS / # / OBS TYPES")){ // RINEX 3 and 4, by system
+    if(s[0]!=' '){
+      psys=s[0];
+      if(sysindex(psys)>=0)
+        cmap[sysindex(psys)].clear();
+      npend=(int)strnflt(s+3,3);
+    }
+    types(s,n,7,4,3,13);
+  }
+  else if(label(s,n,"INTERVAL")){
+    interval=strnflt(s,10);
+  }
+  else if(label(s,n,"TIME OF FIRST OBS")){
+    if(s[48]!=' '){
+      memcpy(tsys,s+48,3);
+      tsys[3]='\0';
+    }
+  }
+}
+
+bool ObsFile::header()
+{
+  const char *s;
+  int n;
+
+  while((s=in.next(&n))){
+    if(label(s,n,"END OF HEADER"))
+      break;
+    hdrline(s,n);
+  }
+  usemap();
+  if(!s||ver<=0.0||type!='O'||
+     std::all_of(cmap,cmap+8,[](const std::vector<int>& m){ return m.empty(); })){
+#ifdef DEBUG
+    warn("invalid observation file header");
+#endif
+    return false;
+  }
+  if(!tsys[0])
+    strcpy(tsys,sys=='R'?"GLO":sys=='E'?"GAL":"GPS");
+  if(crx>0.0)
+    crxreset();
+  return true;
+}
+
+// Compact RINEX cannot be entered mid-file, its differences start at
+// the first epoch
+bool ObsFile::seek(uint64_t off)
+{
+  if(crx>0.0)
+    return false;
+  return in.seek(off);
+}
+
+// the closing mark of the index must end at the end of this file, an
+// index of another (or an older) file is not seeked into
+bool ObsFile::seek(const ObsIndex& idx, const Time& t)
+{
+  if(idx.gz||idx.mark.empty())
+    return false;
+  if(idx.mark.back().raw!=in.size()){
+#ifdef DEBUG
+    warn("index does not match the file");
+#endif
+    return false;
+  }
+  return seek(idx.mark[idx.find(t)].raw);
+}
+
+bool ObsFile::next(ObsEpoch& ep)
+{
+  if(crx>0.0)
+    return nextcrx(ep);
+  return ver<3.0?next2(ep):next3(ep);
+}
+
+// satellite id "G01", "G 1" or " 1" (system from the header)
+static void satid(const char *s, char sys, char *prn)
+{
+  prn[0]=s[0]==' '?(sys=='M'?'G':sys):s[0];
+  prn[1]=s[1]==' '?'0':s[1];
+  prn[2]=s[2];
+  prn[3]='\0';
+}
+
+// epoch time, RINEX 2 " yy mm dd hh mm ss.sssssss" or RINEX 3
+// "> yyyy mm dd hh mm ss.sssssss" (blank in event records: kept)
+static void epoch(const char *s, bool v3, Time& t)
+{
+  int k,cal[6];
+  double sec;
+
+  if(s[2]==' ')
+    return;
+  if(v3){
+    cal[0]=(int)strnflt(s+2,4);
+    for(k=1;k<5;k++)
+      cal[k]=(int)strnflt(s+4+3*k,2);
+    sec=strnflt(s+18,11);
+  } else {
+    cal[0]=(int)strnflt(s+1,2);
+    cal[0]+=cal[0]<80?2000:1900;
+    for(k=1;k<5;k++)
+      cal[k]=(int)strnflt(s+1+3*k,2);
+    sec=strnflt(s+15,11);
+  }
+  cal[5]=(int)floor(sec);
+  t.from_cal(cal);
+  t.t_frac=sec-cal[5];
+}
+
+// F14.3, LLI I1, SSI I1 fields of one observation line
+static void fields(const char *s, int n, const int *col, int nf, ObsEpoch& ep, int i)
+{
+  std::size_t k;
+  bool blank;
+  double v;
+
+  for(int j=0;j<nf;j++){
+    if(col[j]<0||16*j>=n)
+      continue;
+    v=strnflt(s+16*j,std::min(14,n-16*j),&blank);
+    k=(std::size_t)col[j]*ep.cap+i;
+    ep.val[k]=blank||v==0.0?NAN:v; // blank or 0.0: missing
+    if(16*j+14<n&&s[16*j+14]>'0'&&s[16*j+14]<='9')
+      ep.lli[k]=s[16*j+14]-'0';
+    if(16*j+15<n&&s[16*j+15]>'0'&&s[16*j+15]<='9')
+      ep.ssi[k]=s[16*j+15]-'0';
+  }
+}
+
+// special records of flags 2-5: event, new site, header lines
+bool ObsFile::special(ObsEpoch& ep, int f, int ns)
+{
+  const char *s;
+  int n;
+
+  for(int k=0;k<ns;k++){
+    if(!(s=in.next(&n)))
+      return false;
+    if(f==3||f==4)
+      hdrline(s,n);
+  }
+  usemap();
+  ep.resize(code.size(),0);
+  return true;
+}
+
+// RINEX 2 observations of the ns satellites listed in ep.sat, 5 per
+// line, satellites of other systems skipped
+bool ObsFile::records2(ObsEpoch& ep, int ns)
+{
+  const char *s;
+  int n,nl,i,k,j,sy;
+  char prn[4];
+
+  ep.clear(ns);
+  for(k=0;k<ns;k++){
+    memcpy(prn,&ep.sat[4*k],4);
+    sy=sysindex(prn[0]);
+    const std::vector<int>& m=cmap[std::max(sy,0)];
+    nl=((int)m.size()+4)/5;
+    if(sy<0||!use[sy]){
+      if(!skip(nl))
+        return false;
+      continue;
+    }
+    i=ep.n++;
+    if(i!=k)
+      memcpy(&ep.sat[4*i],prn,4);
+    for(j=0;j<nl;j++){
+      if(!(s=in.next(&n)))
+        return false;
+      fields(s,n,&m[5*j],std::min(5,(int)m.size()-5*j),ep,i);
+    }
+  }
+  return true;
+}
+
+// RINEX 3 observations, one line per satellite: "G01" and the
+// observations of its system
+bool ObsFile::records3(ObsEpoch& ep, int ns)
+{
+  const char *s;
+  int n,i,k,j;
+
+  ep.clear(ns);
+  for(k=0;k<ns;k++){
+    if(!(s=in.next(&n)))
+      return false;
+    if(n<3||(j=sysindex(s[0]))<0||!use[j])
+      continue;
+    const std::vector<int>& m=cmap[j];
+    i=ep.n++;
+    satid(s,sys,&ep.sat[4*i]);
+    fields(s+3,n-3,&m[0],m.size(),ep,i);
+  }
+  return true;
+}
+
+// RINEX 2 epoch: " yy mm dd hh mm ss.sssssss  f nnnG01G02...      clk"
+bool ObsFile::next2(ObsEpoch& ep)
+{
+  const char *s;
+  int n,f,ns,k,j;
+  char prn[4];
+
+  for(;;){
+    if(!(s=in.next(&n)))
+      return false;
+    if(n<32||s[28]<'0'||s[28]>'9') // not an epoch line
+      continue;
+    f=s[28]-'0';
+    ns=(int)strnflt(s+29,3);
+    epoch(s,false,ep.t);
+    ep.flag=f;
+    ep.n=0;
+    ep.clk=n>68?strnflt(s+68,std::min(12,n-68)):0.0;
+
+    if(f>=2&&f<=5)
+      return special(ep,f,ns);
+
+    // outside the window: the record has the same number of lines for
+    // every system, skipped from the epoch header alone
+    if(!sel.epoch(ep.t)){
+      if(sel.window&&ep.t>sel.end) // files are in time order
+        return false;
+      if(!skip((ns-1)/12+ns*(((int)cmap[0].size()+4)/5)))
+        return false;
+      continue;
+    }
+
+    // satellite list, 12 per line
+    ep.resize(code.size(),ns);
+    for(k=0;k<ns;k++){
+      if(k&&k%12==0&&!(s=in.next(&n)))
+        return false;
+      j=32+3*(k%12);
+      if(j+3>n)
+        satid("   ",sys,prn);
+      else
+        satid(s+j,sys,prn);
+      memcpy(&ep.sat[4*k],prn,4);
+    }
+    return records2(ep,ns);
+  }
+}
+
+// RINEX 3 epoch: "> yyyy mm dd hh mm ss.sssssss  f nnn      clk"
+bool ObsFile::next3(ObsEpoch& ep)
+{
+  const char *s;
+  int n,f,ns;
+
+  for(;;){
+    if(!(s=in.next(&n)))
+      return false;
+    if(n<35||s[0]!='>')
+      continue;
+    f=s[31]-'0';
+    ns=(int)strnflt(s+32,3);
+    epoch(s,true,ep.t);
+    ep.flag=f;
+    ep.n=0;
+    ep.clk=n>41?strnflt(s+41,std::min(15,n-41)):0.0;
+
+    if(f>=2&&f<=5)
+      return special(ep,f,ns);
+
+    if(!sel.epoch(ep.t)){ // one line per satellite
+      if(sel.window&&ep.t>sel.end)
+        return false;
+      if(!skip(ns))
+        return false;
+      continue;
+    }
+
+    ep.resize(code.size(),ns);
+    return records3(ep,ns);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+//  Compact RINEX (Hatanaka) 1.0 and 3.0
+
+// text differences: blank keeps the previous character, '&' blanks it
+static void crxtext(char *old, int nold, const char *s, int n)
+{
+  for(int k=0;k<n&&k<nold;k++)
+    if(s[k]!=' ')
+      old[k]=s[k]=='&'?' ':s[k];
+}
+
+// numeric series: "m&x" starts an arc of maximum order m with value x,
+// "x" is the difference of the current order, empty: missing (arc ends)
+static bool crxnum(const char *s, int n, CrxArc& a, int64_t *v)
+{
+  int64_t x=0;
+  bool neg,init;
+  int k;
+
+  if(n<=0){
+    a.m=0;
+    return false;
+  }
+  if((init=n>1&&s[1]=='&')){
+    a.m=s[0]-'0';
+    a.k=0;
+    s+=2;
+    n-=2;
+  }
+  if(a.m<1||a.m>CRX_MAXORD){ // difference out of an arc
+    a.m=0;
+    return false;
+  }
+  neg=n>0&&s[0]=='-';
+  for(k=neg;k<n&&s[k]>='0'&&s[k]<='9';k++)
+    x=10*x+(s[k]-'0');
+  x=neg?-x:x;
+
+  if(init){
+    a.d[0]=x;
+  } else {
+    if(a.k<a.m)
+      a.k++;
+    a.d[a.k]=x;
+    for(k=a.k-1;k>=0;k--)
+      a.d[k]+=a.d[k+1];
+  }
+  *v=a.d[0];
+  return true;
+}
+
+// all series restart: after the header, initialized epochs and events
+void ObsFile::crxreset()
+{
+  ctyp=0;
+  for(auto& m: cmap)
+    ctyp=std::max(ctyp,(int)m.size());
+  carc.clear();
+  cflag.clear();
+  cseen.clear();
+  cslot.assign(EphemerisStore::NSLOT,-1);
+  cclk.m=0;
+}
+
+// differential state of a satellite (EphemerisStore::satindex)
+int ObsFile::crxstate(int k)
+{
+  if(k<0)
+    return -1;
+  if(cslot[k]<0){
+    cslot[k]=cseen.size();
+    cseen.push_back(UINT32_MAX);
+    carc.resize(carc.size()+ctyp);
+    cflag.resize(cflag.size()+2*ctyp);
+  }
+  return cslot[k];
+}
+
+// Epoch line as text differences (RINEX epoch record up to the flag and
+// satellite count, the satellite list appended at column 33 in 1.0 and
+// 42 in 3.0), receiver clock line, then one line per satellite: the
+// numeric series of each type separated by single blanks, then the
+// LLI/SSI text differences. Events and cycle slip records (flag >1) are
+// plain RINEX and are followed by initialized series. Values are rebuilt
+// in integer units of the last decimal straight into the epoch buffers.
+bool ObsFile::nextcrx(ObsEpoch& ep)
+{
+  const bool v3=crx>=3.0;
+  const int cf=v3?31:28,cs=v3?41:32; // flag and satellite list columns
+  const char *s,*p,*q,*e;
+  int n,f,ns,i,j,k,c,sy,st;
+  std::size_t w;
+  char prn[4],*fl;
+  CrxArc *a;
+  int64_t v;
+
+  for(;;){
+    if(!(s=in.next(&n)))
+      return false;
+    if(n>0&&s[0]==(v3?'>':'&')){ // initialized
+      cline.assign(s,n);
+      cline[0]=v3?'>':' ';
+      crxreset();
+    } else if((v3&&n>0&&s[0]=='&')||cline.empty()){
+      continue; // escape line, or no initialized epoch yet
+    } else {
+      if(cline.size()<(std::size_t)n)
+        cline.resize(n,' ');
+      crxtext(&cline[0],cline.size(),s,n);
+    }
+    if((int)cline.size()<cf+4||cline[cf]<'0'||cline[cf]>'9'){
+#ifdef DEBUG
+      warn("invalid CRINEX epoch line");
+#endif
+      continue;
+    }
+    s=cline.c_str();
+    f=s[cf]-'0';
+    ns=(int)strnflt(s+cf+1,3);
+    epoch(s,v3,ep.t);
+    ep.flag=f;
+    ep.n=0;
+    ep.clk=0.0;
+
+    if(f>1){ // plain records, series initialized in the next epoch
+      if(f<=5){
+        cline.clear();
+        return special(ep,f,ns);
+      }
+      ep.resize(code.size(),ns);
+      for(k=0;!v3&&k<ns;k++)
+        satid(cs+3*k+3<=(int)cline.size()?s+cs+3*k:"   ",sys,&ep.sat[4*k]);
+      cline.clear();
+      return v3?records3(ep,ns):records2(ep,ns);
+    }
+
+    if(!(s=in.next(&n)))
+      return false;
+    if(crxnum(s,n,cclk,&v))
+      ep.clk=v*(v3?1e-12:1e-9);
+
+    // state updates cannot be skipped, epochs out of the window are
+    // decoded and dropped
+    cep++;
+    ep.resize(code.size(),ns);
+    ep.clear(ns);
+    for(k=0;k<ns;k++){
+      if(!(s=in.next(&n)))
+        return false;
+      j=cs+3*k;
+      satid(j+3<=(int)cline.size()?&cline[j]:"   ",sys,prn);
+      if((sy=sysindex(prn[0]))<0||!use[sy])
+        continue;
+      if((st=crxstate(EphemerisStore::satindex(prn)))<0){ // no state slot
+#ifdef DEBUG
+        if(!nskip)
+          warn("CRINEX satellite without a state index dropped");
+#endif
+        nskip++;
+        continue;
+      }
+      const std::vector<int>& m=cmap[sy];
+      a=&carc[(std::size_t)st*ctyp];
+      fl=&cflag[2*(std::size_t)st*ctyp];
+      if(cseen[st]+1!=cep){ // not in the last epoch: new series
+        for(j=0;j<ctyp;j++)
+          a[j].m=0;
+        memset(fl,' ',2*ctyp);
+      }
+      cseen[st]=cep;
+      i=ep.n++;
+      memcpy(&ep.sat[4*i],prn,4);
+
+      e=s+n;
+      for(p=s,j=0;j<(int)m.size();j++){
+        q=p<e?(const char *)memchr(p,' ',e-p):0;
+        if(!q)
+          q=e;
+        if((c=m[j])>=0&&crxnum(p,q-p,a[j],&v)&&v!=0)
+          ep.val[(std::size_t)c*ep.cap+i]=v/1000.0;
+        else if(c<0) // not selected, its series is not followed
+          a[j].m=0;
+        p=q<e?q+1:e;
+      }
+      crxtext(fl,2*m.size(),p,e-p);
+      for(j=0;j<(int)m.size();j++){
+        if((c=m[j])<0)
+          continue;
+        w=(std::size_t)c*ep.cap+i;
+        if(fl[2*j]>'0'&&fl[2*j]<='9')
+          ep.lli[w]=fl[2*j]-'0';
+        if(fl[2*j+1]>'0'&&fl[2*j+1]<='9')
+          ep.ssi[w]=fl[2*j+1]-'0';
+      }
+    }
+    if(!sel.epoch(ep.t)){
+      if(sel.window&&ep.t>sel.end)
+        return false;
+      continue;
+    }
+    return true;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+//  Compact RINEX 3.0 writer
+
+#define CRX_MAXDIFF 10000000000LL // differences above restart the arc
+#define CRX_FLUSH (1<<16)
+
+// header line: text in columns 1-60, label in 61-80
+static void hline(std::string& out, const char *text, const char *lab)
+{
+  std::size_t k=out.size();
+
+  out+=text;
+  out.resize(k+60,' ');
+  out+=lab;
+  out+='\n';
+}
+
+static void crxint(std::string& out, int64_t x)
+{
+  char b[24];
+  int k=24;
+  uint64_t u=x<0?-(uint64_t)x:x;
+
+  do{
+    b[--k]='0'+u%10;
+    u/=10;
+  } while(u);
+  if(x<0)
+    b[--k]='-';
+  out.append(b+k,24-k);
+}
+
+// next term of a numeric series: "m&x" when the arc starts, else the
+// difference of the current order
+static void crxput(std::string& out, CrxArc& a, int64_t x, int m)
+{
+  int64_t d[CRX_MAXORD+1];
+  int j,k;
+
+  if(a.m){
+    k=a.k<a.m?a.k+1:a.m;
+    d[0]=x;
+    for(j=1;j<=k;j++)
+      d[j]=d[j-1]-a.d[j-1];
+    if(d[k]<CRX_MAXDIFF&&d[k]>-CRX_MAXDIFF){
+      memcpy(a.d,d,(k+1)*sizeof(int64_t));
+      a.k=k;
+      crxint(out,d[k]);
+      return;
+    }
+  }
+  a.m=m;
+  a.k=0;
+  a.d[0]=x;
+  out+='0'+m;
+  out+='&';
+  crxint(out,x);
+}
+
+// text differences of s against old, old becomes s
+static void crxdiff(std::string& out, std::string& old, const char *s, int n)
+{
+  std::size_t k,k0=out.size(),m=std::max(old.size(),(std::size_t)n);
+  char o,c;
+
+  for(k=0;k<m;k++){
+    o=k<old.size()?old[k]:' ';
+    c=k<(std::size_t)n?s[k]:' ';
+    out+=c==o?' ':c==' '?'&':c;
+  }
+  while(out.size()>k0&&out.back()==' ')
+    out.pop_back();
+  old.assign(s,n);
+}
+
+CrxWriter::CrxWriter()
+  : fp(0), gz(0), on(false), ord(3), hdr(false), ctyp(0), cep(0)
+{}
+
+CrxWriter::~CrxWriter()
+{
+  close();
+#ifdef HAVE_ZLIB
+  delete gz;
+#endif
+}
+
+// The header is kept until the first epoch (TIME OF FIRST OBS). Only
+// RINEX 3 observable codes can be written. Names ending in ".gz" are
+// written gzip compressed.
+bool CrxWriter::open(const char *filepath, const ObsFile& obs, int order)
+{
+  char buf[96];
+  int j,k,n=strlen(filepath);
+
+  close();
+  if(order<1||order>CRX_MAXORD){
+#ifdef DEBUG
+    warn("invalid differencing order");
+#endif
+    return false;
+  }
+  for(auto& c: obs.code)
+    if(c.size()!=3){
+#ifdef DEBUG
+      warn("CRINEX 3.0 needs RINEX 3 observable codes");
+#endif
+      return false;
+    }
+#ifdef HAVE_ZLIB
+  if(n>3&&!strcmp(filepath+n-3,".gz")){
+    if(!gz)
+      gz=new GzWriter();
+    on=gz->open(filepath);
+  } else
+#endif
+  on=(fp=fopen(filepath,"wb"))!=0;
+  if(!on){
+#ifdef DEBUG
+    warn("could not create file");
+#endif
+    return false;
+  }
+  ord=order;
+  hdr=false;
+  eline.clear();
+  out.clear();
+  head.clear();
+  memcpy(tsys,obs.tsys,4);
+
+  snprintf(buf,sizeof(buf),"     3.04           OBSERVATION DATA    %c",
+    obs.sys&&strchr(sysid,obs.sys)?obs.sys:'M');
+  hline(head,buf,"RINEX VERSION / TYPE");
+  if(obs.marker[0])
+    hline(head,obs.marker,"MARKER NAME");
+  snprintf(buf,sizeof(buf),"%14.4f%14.4f%14.4f",obs.pos[0],obs.pos[1],obs.pos[2]);
+  hline(head,buf,"APPROX POSITION XYZ");
+  snprintf(buf,sizeof(buf),"%14.4f%14.4f%14.4f",obs.del[0],obs.del[1],obs.del[2]);
+  hline(head,buf,"ANTENNA: DELTA H/E/N");
+
+  // selected observables of each system, 13 per line
+  for(j=0;j<7;j++){
+    cmap[j].clear();
+    for(int c: obs.columns(sysid[j]))
+      if(c>=0)
+        cmap[j].push_back(c);
+    n=cmap[j].size();
+    for(k=0;k<n;k++){
+      if(k%13==0){
+        if(k)
+          hline(head,buf,"SYS / # / OBS TYPES");
+        snprintf(buf,sizeof(buf),k?"      ":"%c  %3d",sysid[j],n);
+      }
+      snprintf(buf+6+4*(k%13),sizeof(buf)-6-4*(k%13)," %3s",
+        obs.code[cmap[j][k]].c_str());
+    }
+    if(n)
+      hline(head,buf,"SYS / # / OBS TYPES");
+  }
+  if(obs.interval>0.0){
+    snprintf(buf,sizeof(buf),"%10.3f",obs.interval);
+    hline(head,buf,"INTERVAL");
+  }
+  return true;
+}
+
+void CrxWriter::header(const Time& t0)
+{
+  char buf[96];
+  int cal[6];
+  time_t now=time(0);
+
+  hline(out,"3.0                 COMPACT RINEX FORMAT","CRINEX VERS   / TYPE");
+  strftime(buf,sizeof(buf),"KEPLER                                  %d-%b-%y %H:%M",
+    gmtime(&now));
+  hline(out,buf,"CRINEX PROG / DATE");
+  out+=head;
+  Time::unx2cal(t0.t_sec,cal);
+  snprintf(buf,sizeof(buf),"%6d%6d%6d%6d%6d%13.7f     %-3s",cal[0],cal[1],cal[2],
+    cal[3],cal[4],cal[5]+t0.t_frac,tsys);
+  hline(out,buf,"TIME OF FIRST OBS");
+  hline(out,"","END OF HEADER");
+  head.clear();
+  hdr=true;
+}
+
+// all series restart: first epoch and after events
+void CrxWriter::reset()
+{
+  ctyp=0;
+  for(auto& m: cmap)
+    ctyp=std::max(ctyp,(int)m.size());
+  carc.clear();
+  cflag.clear();
+  cseen.clear();
+  cslot.assign(EphemerisStore::NSLOT,-1);
+  cclk.m=0;
+}
+
+int CrxWriter::state(int k)
+{
+  if(cslot[k]<0){
+    cslot[k]=cseen.size();
+    cseen.push_back(UINT32_MAX);
+    carc.resize(carc.size()+ctyp);
+    cflag.resize(cflag.size()+2*ctyp);
+  }
+  return cslot[k];
+}
+
+// pending output to the file, all of it or once it is large enough
+bool CrxWriter::flush(bool all)
+{
+  bool ok=true;
+
+  if(out.size()>=CRX_FLUSH||all){
+#ifdef HAVE_ZLIB
+    if(!fp)
+      ok=gz->write(out.data(),out.size());
+    else
+#endif
+    ok=fwrite(out.data(),1,out.size(),fp)==out.size();
+    out.clear();
+  }
+  return ok;
+}
+
+// Satellites of systems without observables are left out. Values are
+// rounded to F14.3 (F15.12 for the clock), 0 and NaN are written blank.
+// Events carry no special records (they are not kept in ObsEpoch).
+bool CrxWriter::write(const ObsEpoch& ep)
+{
+  char buf[64],c,*fl;
+  const char *prn;
+  std::size_t k0,w;
+  int cal[6],i,j,k,n,ns,sy,st,nt;
+  bool fresh;
+  double sec,v;
+  CrxArc *a;
+
+  if(!on)
+    return false;
+  if(!hdr)
+    header(ep.t);
+
+  for(i=ns=0;i<ep.n;i++) // satellites written
+    if((sy=sysindex(ep.prn(i)[0]))>=0&&cmap[sy].size()&&
+       EphemerisStore::satindex(ep.prn(i))>=0)
+      ns++;
+  if(ep.flag>=2&&ep.flag<=5)
+    ns=0;
+  Time::unx2cal(ep.t.t_sec,cal);
+  sec=cal[5]+ep.t.t_frac;
+  if(sec<0.0){
+    Time::unx2cal(ep.t.t_sec-1,cal);
+    sec=cal[5]+1.0+ep.t.t_frac;
+  }
+  n=snprintf(buf,sizeof(buf),"> %04d %02d %02d %02d %02d%11.7f  %d%3d      ",
+    cal[0],cal[1],cal[2],cal[3],cal[4],sec,ep.flag,ns);
+  line.assign(buf,n);
+  for(i=0;i<ep.n&&ns;i++)
+    if((sy=sysindex(ep.prn(i)[0]))>=0&&cmap[sy].size()&&
+       EphemerisStore::satindex(ep.prn(i))>=0)
+      line.append(ep.prn(i),3);
+
+  if(ep.flag>1){ // plain records, the next epoch is initialized
+    if(ep.flag<=5)
+      line.resize(35);
+    out+=line;
+    out+='\n';
+    for(i=0;i<ep.n&&ep.flag==6;i++){
+      prn=ep.prn(i);
+      if((sy=sysindex(prn[0]))<0||cmap[sy].empty()||EphemerisStore::satindex(prn)<0)
+        continue;
+      out.append(prn,3);
+      for(int c: cmap[sy]){
+        w=(std::size_t)c*ep.cap+i;
+        v=ep.val[w];
+        n=std::isnan(v)||v==0.0?snprintf(buf,sizeof(buf),"%14s","")
+                               :snprintf(buf,sizeof(buf),"%14.3f",v);
+        buf[n++]=ep.lli[w]?'0'+ep.lli[w]:' ';
+        buf[n++]=ep.ssi[w]?'0'+ep.ssi[w]:' ';
+        out.append(buf,n);
+      }
+      while(out.back()==' ')
+        out.pop_back();
+      out+='\n';
+    }
+    eline.clear();
+    return flush();
+  }
+
+  if(eline.empty()){ // initialized
+    reset();
+    out+=line;
+    eline=line;
+  } else {
+    crxdiff(out,eline,line.data(),line.size());
+  }
+  out+='\n';
+  if(ep.clk!=0.0)
+    crxput(out,cclk,llround(ep.clk*1e12),ord);
+  else
+    cclk.m=0;
+  out+='\n';
+
+  cep++;
+  for(i=0;i<ep.n;i++){
+    prn=ep.prn(i);
+    if((sy=sysindex(prn[0]))<0||cmap[sy].empty()||
+       (st=EphemerisStore::satindex(prn))<0)
+      continue;
+    st=state(st);
+    a=&carc[(std::size_t)st*ctyp];
+    fl=&cflag[2*(std::size_t)st*ctyp];
+    if((fresh=cseen[st]+1!=cep)){ // not in the last epoch: new series
+      for(j=0;j<ctyp;j++)
+        a[j].m=0;
+      memset(fl,' ',2*ctyp);
+    }
+    cseen[st]=cep;
+
+    const std::vector<int>& m=cmap[sy];
+    nt=m.size();
+    k0=out.size();
+    for(j=0;j<nt;j++){
+      w=(std::size_t)m[j]*ep.cap+i;
+      v=ep.val[w];
+      if(std::isnan(v)||v==0.0)
+        a[j].m=0;
+      else
+        crxput(out,a[j],llround(v*1000.0),ord);
+      out+=' ';
+    }
+    // flags: text differences, all blanks as '&' when initialized
+    for(j=0;j<2*nt;j++){
+      w=(std::size_t)m[j/2]*ep.cap+i;
+      k=j%2?ep.ssi[w]:ep.lli[w];
+      c=k>0&&k<=9?'0'+k:' ';
+      if(fresh)
+        out+=c==' '?'&':c;
+      else
+        out+=c==fl[j]?' ':c==' '?'&':c;
+      fl[j]=c;
+    }
+    while(out.size()>k0&&(out.back()==' '||(fresh&&out.back()=='&')))
+      out.pop_back();
+    out+='\n';
+  }
+  return flush();
+}
+
+bool CrxWriter::close()
+{
+  bool ok=true;
+
+  if(on){
+    if(!hdr&&head.size()) // no epochs
+      header(Time());
+    ok=flush(true);
+#ifdef HAVE_ZLIB
+    if(!fp)
+      ok=gz->close()&&ok;
+    else
+#endif
+    ok=fclose(fp)==0&&ok;
+    fp=0;
+    on=false;
+  }
+  out.clear();
+  return ok;
+}
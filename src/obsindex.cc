@@ -0,0 +1,437 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   obsindex.cc --Observation file time index and blocked gzip archives
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include <algorithm>
+#include <thread>
+
+// Index file layout, all little-endian:
+//
+//   header   32 bytes   magic "KEPLOIX", version, flags, marks, header length
+//   marks    n x 32     t_sec, t_frac, file offset, text offset
+//
+// The last mark closes the epochs: its offsets are the end of the file
+// and of the text, its time the last epoch.
+
+#define OIX_MAGIC   "KEPLOIX"
+#define OIX_VERSION 1
+#define OIX_GZIP    1 // flags: blocked gzip archive
+
+struct OixHdr{
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t nmark;
+  uint64_t head;
+};
+
+struct OixMark{
+  int64_t t_sec;
+  double t_frac;
+  uint64_t off;
+  uint64_t raw;
+};
+
+static_assert(sizeof(OixHdr)==32,"index header must be 32 bytes");
+static_assert(sizeof(OixMark)==32,"index mark must be 32 bytes");
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__==__ORDER_BIG_ENDIAN__)
+  #define OIX_SWAP 1 // file is little-endian, swap on big-endian hosts
+#endif
+
+#ifdef OIX_SWAP
+static void swap(void *p, int n)
+{
+  char *c=(char*)p;
+  for(int i=0;i<n/2;i++)
+    std::swap(c[i],c[n-1-i]);
+}
+
+static void swaphdr(OixHdr& h)
+{
+  swap(&h.version,4); swap(&h.flags,4);
+  swap(&h.nmark,8); swap(&h.head,8);
+}
+
+static void swapmark(OixMark& r)
+{
+  swap(&r.t_sec,8); swap(&r.t_frac,8);
+  swap(&r.off,8); swap(&r.raw,8);
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////
+//  Observation file time index
+
+ObsIndex::ObsIndex()
+  : head(0), gz(false)
+{}
+
+bool ObsIndex::build(const char *filepath, int every)
+{
+  Mem m;
+
+  if(!m.mmap(filepath))
+    return false;
+  return build(std::as_const(m).data(),m.size(),every);
+}
+
+// Marks every n-th epoch record (flags 0, 1 and 6) of a plain text file
+// at its header line. Events are not marked: they stay with the epochs
+// before them, and a reader started at a mark misses the header changes
+// of flag 4 records before it.
+bool ObsIndex::build(const char *buf, std::size_t n, int every)
+{
+  ObsFile obs;
+  ObsEpoch ep;
+  ObsSelect sel;
+  ObsMark mk;
+  uint64_t o;
+  Time last(0.0);
+  int ne=0;
+
+  mark.clear();
+  head=0;
+  gz=false;
+  if(Mem::gzipped(buf,n)||!obs.open(buf,n)||obs.crx>0.0){
+#ifdef DEBUG
+    warn("not a plain RINEX observation file");
+#endif
+    return false;
+  }
+  // only the epoch headers matter: one column decoded, the records of
+  // other systems skipped
+  for(const char *c="GRECJIS";*c;c++)
+    if(obs.columns(*c).size()){
+      sel.sys=*c;
+      break;
+    }
+  for(int j: obs.columns(sel.sys[0]))
+    if(j>=0){
+      sel.code.push_back(obs.code[j]);
+      break;
+    }
+  obs.select(sel);
+  obs.open(buf,n);
+  if(every<1)
+    every=1;
+  head=obs.tell();
+
+  for(;;){
+    o=obs.tell();
+    if(!obs.next(ep))
+      break;
+    if(ep.flag>=2&&ep.flag<=5)
+      continue;
+    if(ne++%every==0){
+      mk.t=ep.t;
+      mk.off=mk.raw=o;
+      mark.push_back(mk);
+    }
+    last=ep.t;
+  }
+  mk.t=last;
+  mk.off=mk.raw=obs.tell();
+  mark.push_back(mk);
+  return true;
+}
+
+bool ObsIndex::save(const char *filepath) const
+{
+  std::vector<OixMark> r(mark.size());
+  OixHdr h;
+  bool ok;
+  FILE *fp;
+
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,OIX_MAGIC,8);
+  h.version=OIX_VERSION;
+  h.flags=gz?OIX_GZIP:0;
+  h.nmark=mark.size();
+  h.head=head;
+  for(std::size_t i=0;i<mark.size();i++){
+    r[i].t_sec=mark[i].t.t_sec;
+    r[i].t_frac=mark[i].t.t_frac;
+    r[i].off=mark[i].off;
+    r[i].raw=mark[i].raw;
+#ifdef OIX_SWAP
+    swapmark(r[i]);
+#endif
+  }
+#ifdef OIX_SWAP
+  swaphdr(h);
+#endif
+
+  if(!(fp=fopen(filepath,"wb"))){
+#ifdef DEBUG
+    warn("cannot create file");
+#endif
+    return false;
+  }
+  ok=fwrite(&h,sizeof(h),1,fp)==1;
+  if(r.size())
+    ok=fwrite(&r[0],sizeof(OixMark),r.size(),fp)==r.size()&&ok;
+  ok=fclose(fp)==0&&ok;
+#ifdef DEBUG
+  if(!ok)
+    warn("cannot write file");
+#endif
+  return ok;
+}
+
+// marks must be in time and offset order, a stale or foreign file is
+// rejected rather than seeked into
+bool ObsIndex::load(const char *filepath)
+{
+  OixHdr h;
+  OixMark r;
+  Mem f;
+  const char *d;
+  std::size_t i;
+
+  mark.clear();
+  head=0;
+  gz=false;
+  if(!f.mmap(filepath,false)||f.size()<sizeof(h))
+    return false;
+  d=std::as_const(f).data(); // read in place, not detached
+  memcpy(&h,d,sizeof(h));
+#ifdef OIX_SWAP
+  swaphdr(h);
+#endif
+  if(memcmp(h.magic,OIX_MAGIC,8)||h.version!=OIX_VERSION||h.nmark<1||
+     h.nmark>(f.size()-sizeof(h))/sizeof(OixMark)||
+     f.size()!=sizeof(h)+h.nmark*sizeof(OixMark)){
+#ifdef DEBUG
+    warn("invalid or incompatible observation index");
+#endif
+    return false;
+  }
+
+  mark.resize(h.nmark);
+  for(i=0;i<h.nmark;i++){
+    memcpy(&r,d+sizeof(h)+i*sizeof(r),sizeof(r));
+#ifdef OIX_SWAP
+    swapmark(r);
+#endif
+    mark[i].t.t_sec=r.t_sec;
+    mark[i].t.t_frac=r.t_frac;
+    mark[i].off=r.off;
+    mark[i].raw=r.raw;
+    if(i&&(mark[i].t<mark[i-1].t||mark[i].off<mark[i-1].off||
+           mark[i].raw<mark[i-1].raw))
+      break;
+  }
+  if(i<h.nmark||mark[0].raw<h.head){
+#ifdef DEBUG
+    warn("observation index out of order");
+#endif
+    mark.clear();
+    return false;
+  }
+  head=h.head;
+  gz=h.flags&OIX_GZIP;
+  return true;
+}
+
+// reading from the mark found reaches every epoch at or after t, also
+// when epochs of the same time straddle two marks
+std::size_t ObsIndex::find(const Time& t) const
+{
+  auto it=std::lower_bound(mark.begin(),mark.end(),t,
+    [](const ObsMark& a, const Time& b){ return a.t<b; });
+  return it==mark.begin()?0:it-mark.begin()-1;
+}
+
+// at most n slices of about the same text length, from mark k[i] up to
+// mark k[i+1], one per worker: k[0] is 0, the last k the closing mark
+void ObsIndex::slices(int n, std::vector<std::size_t>& k) const
+{
+  std::size_t j,last;
+  uint64_t a,len;
+
+  k.clear();
+  if(mark.size()<2)
+    return;
+  last=mark.size()-1;
+  a=mark[0].raw;
+  len=mark[last].raw-a;
+  k.push_back(0);
+  for(int i=1;i<n;i++){
+    auto it=std::lower_bound(mark.begin(),mark.begin()+last,a+len*i/n,
+      [](const ObsMark& m, uint64_t o){ return m.raw<o; });
+    j=it-mark.begin();
+    if(j>k.back()&&j<last)
+      k.push_back(j);
+  }
+  k.push_back(last);
+}
+
+#ifdef HAVE_ZLIB
+//////////////////////////////////////////////////////////////////////
+//  Blocked gzip observation archive
+
+#define OIX_MIN_BLOCKS 4 // members inflated per thread, at least
+
+// copies source lines up to offset off into the writer
+static bool copylines(LineReader& in, GzWriter& gz, std::string& buf, uint64_t off)
+{
+  const char *s;
+  int n;
+
+  buf.clear();
+  while(in.tell()<off&&(s=in.next(&n))){
+    buf.append(s,n);
+    buf+='\n';
+    if(buf.size()>=(1<<16)){
+      if(!gz.write(buf.data(),buf.size()))
+        return false;
+      buf.clear();
+    }
+  }
+  return gz.write(buf.data(),buf.size());
+}
+
+// The source is read twice in step, as epochs by an ObsFile and as
+// lines copied to the archive, so memory stays bounded. Members are cut
+// before epoch records (flags 0, 1 and 6) once a block of source text
+// has gone by; events stay with the epochs before them. Compact RINEX
+// cannot be cut, its differences run across the whole file.
+bool ObsArchive::write(const char *src, const char *filepath, std::size_t block, int level)
+{
+  ObsFile obs;
+  ObsEpoch ep;
+  LineReader in;
+  GzWriter gz;
+  ObsIndex ix;
+  ObsMark mk;
+  std::string buf,path;
+  uint64_t o,o0=0;
+  Time last;
+
+  if(!obs.open(src)||obs.crx>0.0){
+#ifdef DEBUG
+    warn("not a plain RINEX observation file");
+#endif
+    return false;
+  }
+  if(!in.open(src)||!gz.open(filepath,level))
+    return false;
+
+  ix.gz=true;
+
+  for(;;){
+    o=obs.tell();
+    if(!obs.next(ep))
+      break;
+    if(ep.flag>=2&&ep.flag<=5)
+      continue;
+    if(ix.mark.empty()||o-o0>=block){
+      if(!copylines(in,gz,buf,o)||!gz.member())
+        return false;
+      mk.t=ep.t;
+      mk.off=gz.tell();
+      mk.raw=gz.size();
+      if(ix.mark.empty()) // header member, prepended to every window read
+        ix.head=mk.raw;
+      ix.mark.push_back(mk);
+      o0=o;
+    }
+    last=ep.t;
+  }
+  if(!copylines(in,gz,buf,UINT64_MAX)||!gz.close())
+    return false;
+
+  if(ix.mark.empty())
+    ix.head=gz.size();
+  mk.t=ix.mark.empty()?Time(0.0):last;
+  mk.off=gz.tell();
+  mk.raw=gz.size();
+  ix.mark.push_back(mk);
+  path=std::string(filepath)+".idx";
+  return ix.save(path.c_str());
+}
+
+bool ObsArchive::open(const char *filepath)
+{
+  std::string path=std::string(filepath)+".idx";
+
+  if(!idx.load(path.c_str())||!idx.gz||!m.mmap(filepath,false)||
+     m.size()!=idx.mark.back().off){
+#ifdef DEBUG
+    warn("archive and index do not match");
+#endif
+    m.unmap();
+    idx.mark.clear();
+    return false;
+  }
+  return true;
+}
+
+// inflates the members [a,b) as one concatenation
+static void inflate(const char *s, const ObsMark *mk, std::size_t a, std::size_t b, Mem *out)
+{
+  Mem z;
+
+  z.set(s+mk[a].off,mk[b].off-mk[a].off);
+  *out=z.gz_decode();
+}
+
+// Header and the members holding [beg,end], as RINEX text: epochs just
+// outside the window come along with their members, an ObsSelect window
+// on the text trims them.
+bool ObsArchive::read(const Time& beg, const Time& end, Mem& txt, int nthreads) const
+{
+  const std::vector<ObsMark>& mk=idx.mark;
+  std::vector<Mem> part;
+  std::size_t a,b,k,i,nb;
+  Mem hdr;
+
+  if(mk.empty())
+    return false;
+  a=b=0; // no epochs in the window
+  if(mk.size()>1&&beg<=end&&beg<=mk.back().t&&end>=mk[0].t){
+    a=std::min(idx.find(beg),mk.size()-2);
+    for(b=a+1;b<mk.size()-1&&mk[b].t<=end;b++);
+  }
+  nb=b-a;
+
+  hdr.set(m.data(),mk[0].off); // the member before the first mark
+  hdr=hdr.gz_decode();
+  if(hdr.size()!=idx.head)
+    return false;
+
+  if(nthreads<=0)
+    nthreads=std::thread::hardware_concurrency();
+  if((std::size_t)nthreads>nb/OIX_MIN_BLOCKS)
+    nthreads=nb/OIX_MIN_BLOCKS;
+  if(nthreads<1)
+    nthreads=1;
+
+  k=(nb+nthreads-1)/nthreads;
+  part.resize(nthreads);
+  if(nb&&nthreads==1){
+    inflate(m.data(),&mk[0],a,b,&part[0]);
+  } else if(nb){
+    std::vector<std::thread> pool;
+    for(i=0;i*k<nb;i++)
+      pool.emplace_back(inflate,m.data(),&mk[0],a+i*k,std::min(a+(i+1)*k,b),&part[i]);
+    for(auto& t: pool)
+      t.join();
+  }
+
+  txt=std::move(hdr);
+  for(auto& p: part)
+    txt.append(p);
+  if(txt.size()!=idx.head+mk[b].raw-mk[a].raw){
+#ifdef DEBUG
+    warn("archive members do not match the index");
+#endif
+    return false;
+  }
+  return true;
+}
+#endif
@@ -0,0 +1,480 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   orbit.cc --Batched broadcast orbit propagation (structure of arrays)
+//              and Chebyshev compressed orbits
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include "constants.h"
+
+#define KEPLER_ITR 8 // Newton iterations (converges in 4-5 for e<0.1)
+
+//////////////////////////////////////////////////////////////////////
+// SIMD elementary functions (4 lanes of double)
+
+#ifdef SIMD_x86
+
+// polynomials for sin/cos on [-pi/4,pi/4] (Cephes)
+static const double sincof[6] =
+{
+   1.58962301576546568060E-10,-2.50507477628578072866E-8,
+   2.75573136213857245213E-6 ,-1.98412698295895385996E-4,
+   8.33333333332211858878E-3 ,-1.66666666666666307295E-1
+};
+static const double coscof[6] =
+{
+  -1.13585365213876817300E-11, 2.08757008419747316778E-9,
+  -2.75573141792967388112E-7 , 2.48015872888517045348E-5,
+  -1.38888888888730564116E-3 , 4.16666666666665929218E-2
+};
+
+// rational approximation for atan on [0,0.66] (Cephes)
+static const double atanp[5] =
+{
+  -8.750608600031904122785E-1,-1.615753718733365076637E1,
+  -7.500855792314704667340E1 ,-1.228866684490136173410E2,
+  -6.485021904942025371773E1
+};
+static const double atanq[5] =
+{
+   2.485846490142306297962E1 , 1.650270098316988542046E2,
+   4.328810604912902668951E2 , 4.853903996359136964868E2,
+   1.945506571482613964425E2
+};
+
+static inline __m256d v_set(double x)
+{
+  return _mm256_set1_pd(x);
+}
+
+// a*b+c, c-a*b and a*b-c (fused when FMA3 is enabled)
+#ifdef __FMA__
+  #define v_fmadd  _mm256_fmadd_pd
+  #define v_fnmadd _mm256_fnmadd_pd
+  #define v_fmsub  _mm256_fmsub_pd
+#else 
+  #define v_fmadd(a,b,c)  _mm256_add_pd(_mm256_mul_pd(a,b),c)
+  #define v_fnmadd(a,b,c) _mm256_sub_pd(c,_mm256_mul_pd(a,b))
+  #define v_fmsub(a,b,c)  _mm256_sub_pd(_mm256_mul_pd(a,b),c)
+#endif 
+
+static inline __m256d v_abs(__m256d x)
+{
+  return _mm256_andnot_pd(v_set(-0.0),x);
+}
+
+// sin(x) and cos(x), three-part Cody-Waite reduction by pi/2
+// (exact for |x| < 2^20 pi/2, ample for orbital angles)
+static void v_sincos(__m256d x, __m256d *s, __m256d *c)
+{
+  __m256d n,q,r,z,ps,pc,sw,ns,nc;
+
+  n=_mm256_round_pd(_mm256_mul_pd(x,v_set(2.0/PI)),
+    _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+  r=v_fnmadd(n,v_set(1.57079632673412561417e+00),x);
+  r=v_fnmadd(n,v_set(6.07710050630396597660e-11),r);
+  r=v_fnmadd(n,v_set(2.02226624871116645580e-21),r);
+  z=_mm256_mul_pd(r,r);
+
+  ps=v_set(sincof[0]);
+  pc=v_set(coscof[0]);
+  for(int k=1;k<6;k++){
+    ps=v_fmadd(ps,z,v_set(sincof[k]));
+    pc=v_fmadd(pc,z,v_set(coscof[k]));
+  }
+  ps=v_fmadd(_mm256_mul_pd(ps,z),r,r);
+  pc=v_fmadd(_mm256_mul_pd(pc,z),z,v_fnmadd(v_set(0.5),z,v_set(1.0)));
+
+  // quadrant q=n mod 4
+  q=_mm256_sub_pd(n,_mm256_mul_pd(v_set(4.0),
+    _mm256_floor_pd(_mm256_mul_pd(n,v_set(0.25)))));
+  sw=_mm256_cmp_pd(_mm256_sub_pd(q,_mm256_mul_pd(v_set(2.0),
+    _mm256_floor_pd(_mm256_mul_pd(q,v_set(0.5))))),v_set(1.0),_CMP_EQ_OQ);
+  ns=_mm256_and_pd(_mm256_cmp_pd(q,v_set(1.5),_CMP_GT_OQ),v_set(-0.0));
+  nc=_mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(q,v_set(0.5),_CMP_GT_OQ),
+    _mm256_cmp_pd(q,v_set(2.5),_CMP_LT_OQ)),v_set(-0.0));
+
+  *s=_mm256_xor_pd(_mm256_blendv_pd(ps,pc,sw),ns);
+  *c=_mm256_xor_pd(_mm256_blendv_pd(pc,ps,sw),nc);
+}
+
+// atan2(y,x), not defined for x=y=0
+static __m256d v_atan2(__m256d y, __m256d x)
+{
+  __m256d ax,ay,hi,lo,t,big,z,p,q,a;
+
+  ax=v_abs(x);
+  ay=v_abs(y);
+  hi=_mm256_max_pd(ax,ay);
+  lo=_mm256_min_pd(ax,ay);
+  t=_mm256_div_pd(lo,hi); // [0,1]
+
+  // t>0.66: atan(t)=pi/4+atan((t-1)/(t+1))
+  big=_mm256_cmp_pd(t,v_set(0.66),_CMP_GT_OQ);
+  t=_mm256_blendv_pd(t,_mm256_div_pd(_mm256_sub_pd(t,v_set(1.0)),
+    _mm256_add_pd(t,v_set(1.0))),big);
+
+  z=_mm256_mul_pd(t,t);
+  p=v_set(atanp[0]);
+  for(int k=1;k<5;k++)
+    p=v_fmadd(p,z,v_set(atanp[k]));
+  q=_mm256_add_pd(z,v_set(atanq[0]));
+  for(int k=1;k<5;k++)
+    q=v_fmadd(q,z,v_set(atanq[k]));
+  a=v_fmadd(t,_mm256_div_pd(_mm256_mul_pd(z,p),q),t);
+  a=_mm256_add_pd(a,_mm256_and_pd(big,
+    v_set(PI/4.0+0.5*6.123233995736765886130E-17)));
+
+  // octant corrections
+  a=_mm256_blendv_pd(a,_mm256_sub_pd(v_set(PI/2.0),a),
+    _mm256_cmp_pd(ay,ax,_CMP_GT_OQ));
+  a=_mm256_blendv_pd(a,_mm256_sub_pd(v_set(PI),a),x);
+  return _mm256_or_pd(a,_mm256_and_pd(y,v_set(-0.0)));
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Broadcast ephemerides as structure of arrays
+
+// parameter rows
+enum{
+  R_A,R_E,R_SQE,R_N,R_M0,R_OMG,R_I0,R_IDOT,R_OMG0,R_OMGD,
+  R_CRC,R_CRS,R_CUC,R_CUS,R_CIC,R_CIS,R_F0,R_F1,R_F2,R_REL,
+  NROW
+};
+
+NavSoA::NavSoA()
+  : n(0), np(0)
+{}
+
+void NavSoA::set(const Nav *eph, std::size_t num)
+{
+  std::size_t i;
+
+  n=num;
+  np=(n+3)&~std::size_t(3); // padded to a whole SIMD block
+  par.resize(NROW*np);
+  toe.resize(np);
+  toc.resize(np);
+
+  for(i=0;i<np;i++){
+    NavPrep e(eph[i<n?i:n-1]); // pad lanes repeat the last record
+    double *p=&par[i];
+    p[R_A   *np]=e.A;    p[R_E   *np]=e.e;    p[R_SQE *np]=e.sqe;
+    p[R_N   *np]=e.n;    p[R_M0  *np]=e.M0;   p[R_OMG *np]=e.omg;
+    p[R_I0  *np]=e.i0;   p[R_IDOT*np]=e.idot; p[R_OMG0*np]=e.OMG0;
+    p[R_OMGD*np]=e.OMGd; p[R_CRC *np]=e.crc;  p[R_CRS *np]=e.crs;
+    p[R_CUC *np]=e.cuc;  p[R_CUS *np]=e.cus;  p[R_CIC *np]=e.cic;
+    p[R_CIS *np]=e.cis;  p[R_F0  *np]=e.f0;   p[R_F1  *np]=e.f1;
+    p[R_F2  *np]=e.f2;   p[R_REL *np]=e.rel;
+    toe[i]=e.toe;
+    toc[i]=e.toc;
+  }
+}
+
+void NavSoA::set(const std::vector<Nav>& eph)
+{
+  if(eph.empty()){
+    n=np=0;
+    return;
+  }
+  set(&eph[0],eph.size());
+}
+
+// positions of 4 consecutive records starting at i
+#ifdef SIMD_x86
+void NavSoA::nav2ecf4(std::size_t i, const double *tk_, const double *tc_,
+  double *X, double *Y, double *Z, double *clk) const
+{
+  const double *p=&par[i];
+  __m256d A,e,tk,tc,M,E,d,sE,cE,act,u,r,inc,s2,c2,su,cu,si,ci,Q,sQ,cQ,x,y,t;
+  int itr;
+
+#define ROW(k) _mm256_loadu_pd(p+(k)*np)
+  A =ROW(R_A);
+  e =ROW(R_E);
+  tk=_mm256_loadu_pd(tk_);
+  tc=_mm256_loadu_pd(tc_);
+
+  // mean anomaly
+  M=v_fmadd(ROW(R_N),tk,ROW(R_M0));
+
+  // Kepler's equation, fixed number of masked Newton steps
+  E=M;
+  act=_mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  for(itr=0;itr<KEPLER_ITR;itr++){
+    v_sincos(E,&sE,&cE);
+    d=_mm256_div_pd(_mm256_sub_pd(v_fnmadd(e,sE,E),M),
+      v_fnmadd(e,cE,v_set(1.0)));
+    E=_mm256_sub_pd(E,_mm256_and_pd(d,act));
+    act=_mm256_and_pd(act,_mm256_cmp_pd(v_abs(d),v_set(1e-14),_CMP_GT_OQ));
+    if(!_mm256_movemask_pd(act))
+      break;
+  }
+  v_sincos(E,&sE,&cE);
+
+  // argument of latitude, radius, inclination
+  u=_mm256_add_pd(v_atan2(_mm256_mul_pd(ROW(R_SQE),sE),_mm256_sub_pd(cE,e)),ROW(R_OMG));
+  r=_mm256_mul_pd(A,v_fnmadd(e,cE,v_set(1.0)));
+  inc=v_fmadd(ROW(R_IDOT),tk,ROW(R_I0));
+
+  v_sincos(_mm256_add_pd(u,u),&s2,&c2);
+  u  =v_fmadd(ROW(R_CUS),s2,v_fmadd(ROW(R_CUC),c2,u));
+  r  =v_fmadd(ROW(R_CRS),s2,v_fmadd(ROW(R_CRC),c2,r));
+  inc=v_fmadd(ROW(R_CIS),s2,v_fmadd(ROW(R_CIC),c2,inc));
+
+  v_sincos(u,&su,&cu);
+  v_sincos(inc,&si,&ci);
+  x=_mm256_mul_pd(r,cu);
+  y=_mm256_mul_pd(r,su);
+
+  Q=v_fmadd(ROW(R_OMGD),tk,ROW(R_OMG0));
+  v_sincos(Q,&sQ,&cQ);
+
+  t=_mm256_mul_pd(y,ci);
+  _mm256_storeu_pd(X,v_fmsub(x,cQ,_mm256_mul_pd(t,sQ)));
+  _mm256_storeu_pd(Y,v_fmadd(x,sQ,_mm256_mul_pd(t,cQ)));
+  _mm256_storeu_pd(Z,_mm256_mul_pd(y,si));
+
+  // clock with relativity correction
+  if(clk){
+    t=v_fmadd(v_fmadd(ROW(R_F2),tc,ROW(R_F1)),tc,ROW(R_F0));
+    _mm256_storeu_pd(clk,v_fmadd(ROW(R_REL),sE,t));
+  }
+#undef ROW
+}
+#endif
+
+// scalar path, same algebra as NavPrep::nav2ecf
+void NavSoA::nav2ecf1(std::size_t i, double tk, double tc,
+  double *X, double *Y, double *Z, double *clk) const
+{
+  const double *p=&par[i];
+  double A,e,M,E,Ek,sinE,cosE,u,r,inc,sin2u,cos2u,x,y,cosi,Q,sinQ,cosQ;
+  int itr;
+
+#define ROW(k) p[(k)*np]
+  A=ROW(R_A);
+  e=ROW(R_E);
+  M=ROW(R_M0)+ROW(R_N)*tk;
+  for(E=M,Ek=0,itr=0;itr<30&&fabs(E-Ek)>1e-14;itr++){
+    Ek=E; E-=(E-e*sin(E)-M)/(1.0-e*cos(E));
+  }
+  sinE=sin(E);
+  cosE=cos(E);
+  u=atan2(ROW(R_SQE)*sinE,cosE-e)+ROW(R_OMG);
+  r=A*(1.0-e*cosE);
+  inc=ROW(R_I0)+ROW(R_IDOT)*tk;
+  sin2u=sin(2.0*u);
+  cos2u=cos(2.0*u);
+  u+=ROW(R_CUS)*sin2u+ROW(R_CUC)*cos2u;
+  r+=ROW(R_CRS)*sin2u+ROW(R_CRC)*cos2u;
+  inc+=ROW(R_CIS)*sin2u+ROW(R_CIC)*cos2u;
+  x=r*cos(u);
+  y=r*sin(u);
+  cosi=cos(inc);
+  Q=ROW(R_OMG0)+ROW(R_OMGD)*tk;
+  sinQ=sin(Q);
+  cosQ=cos(Q);
+  *X=x*cosQ-y*cosi*sinQ;
+  *Y=x*sinQ+y*cosi*cosQ;
+  *Z=y*sin(inc);
+  if(clk){
+    *clk=ROW(R_F0)+ROW(R_F1)*tc+ROW(R_F2)*tc*tc+ROW(R_REL)*sinE;
+  }
+#undef ROW
+}
+
+// Satellite positions (ECEF, m) and clock biases (s) of all records,
+// record k evaluated at t[k]. Outputs are arrays of size(), clk may be
+// null. Four records per step with AVX2, one at a time otherwise.
+void NavSoA::nav2ecf(const Time *t, double *x, double *y, double *z,
+  double *clk) const
+{
+  std::size_t i,k;
+  double tk[4],tc[4];
+
+  for(i=0;i<n;i+=4){
+    for(k=0;k<4;k++){
+      const Time& tt=t[i+k<n?i+k:n-1];
+      tk[k]=(tt-toe[i+k]).to_double();
+      tc[k]=(tt-toc[i+k]).to_double();
+    }
+#ifdef SIMD_x86
+    if(i+4<=n){
+      nav2ecf4(i,tk,tc,x+i,y+i,z+i,clk?clk+i:0);
+    } else { // partial block
+      double bx[4],by[4],bz[4],bc[4];
+      nav2ecf4(i,tk,tc,bx,by,bz,bc);
+      for(k=0;i+k<n;k++){
+        x[i+k]=bx[k];
+        y[i+k]=by[k];
+        z[i+k]=bz[k];
+        if(clk)
+          clk[i+k]=bc[k];
+      }
+    }
+#else
+    for(k=0;k<4&&i+k<n;k++)
+      nav2ecf1(i+k,tk[k],tc[k],x+i+k,y+i+k,z+i+k,clk?clk+i+k:0);
+#endif
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Chebyshev compressed orbit
+
+#define CHEB_MAXSEG 4096 // segments per fit
+#define CHEB_MAXDEG 20
+
+Cheb::Cheb()
+  : h(0.0), nseg(0), deg(0)
+{
+  err[0]=err[1]=0.0;
+}
+
+// sum c_k T_k(x) for the 4 components at once (Clenshaw recurrence)
+static void clenshaw(const double *c, int deg, double x, double *f)
+{
+#ifdef SIMD_x86
+  __m256d b0,b1,b2,x2;
+  
+  x2=_mm256_set1_pd(2.0*x);
+  b1=b2=_mm256_setzero_pd();
+  for(int k=deg;k>0;k--){
+    b0=_mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(x2,b1),b2),
+      _mm256_loadu_pd(c+4*k));
+    b2=b1;
+    b1=b0;
+  }
+  b0=_mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(x),b1),b2),
+    _mm256_loadu_pd(c));
+  _mm256_storeu_pd(f,b0);
+#else 
+  double b0,b1,b2;
+  
+  for(int j=0;j<4;j++){
+    b1=b2=0.0;
+    for(int k=deg;k>0;k--){
+      b0=2.0*x*b1-b2+c[4*k+j];
+      b2=b1;
+      b1=b0;
+    }
+    f[j]=x*b1-b2+c[j];
+  }
+#endif 
+}
+
+// orbit of a broadcast ephemeris, for fitting
+static void navorb(void *ctx, const Time& t, double *xyzc)
+{
+  ((const NavPrep*)ctx)->nav2ecf(t,xyzc,xyzc+3);
+}
+
+// Fits the broadcast orbit over its validity window (toe +/- the maximum
+// age of the ephemeris store) to within tol meters
+bool Cheb::fit(const Nav& eph, double tol, int deg_)
+{
+  NavPrep prep(eph);
+  double half=EphemerisStore::maxdtoe(eph);
+  return fit(navorb,&prep,eph.toe-half,eph.toe+half,tol,deg_);
+}
+
+// Interpolates f at the Chebyshev nodes of each segment; the number of 
+// segments doubles until the error, checked on a grid 4 times denser 
+// than the nodes plus the size of the two last coefficients (truncation 
+// estimate), is below tol in every segment. Clock is held to tol/c.
+bool Cheb::fit(orbfn f, void *ctx, const Time& t0_, const Time& t1_, 
+  double tol, int deg_)
+{
+  int i,j,k,m,ns;
+  double span,x,e,et,tclk,ref[4],val[4];
+  std::vector<double> fx;
+  bool ok;
+
+  if(deg_<2||deg_>CHEB_MAXDEG||!(t1_>t0_))
+    return false;
+  t0=t0_;
+  deg=deg_;
+  span=(t1_-t0_).to_double();
+  tclk=tol/CLIGHT;
+  m=deg+1;
+  fx.resize(4*m);
+
+  for(ns=1;ns<=CHEB_MAXSEG;ns*=2){
+    nseg=ns;
+    h=span/ns;
+    c.assign(nseg*m*4,0.0);
+    err[0]=err[1]=0.0;
+    ok=true;
+
+    for(i=0;i<nseg&&ok;i++){
+      double *ci=&c[i*m*4];
+      
+      // samples at the nodes x_j=cos(pi*(j+1/2)/m)
+      for(j=0;j<m;j++){
+        x=cos(PI*(j+0.5)/m);
+        f(ctx,t0+h*(i+0.5*(x+1.0)),&fx[4*j]);
+      }
+      for(k=0;k<m;k++){
+        for(j=0;j<m;j++){
+          double w=cos(PI*k*(j+0.5)/m);
+          for(int a=0;a<4;a++)
+            ci[4*k+a]+=fx[4*j+a]*w;
+        }
+        for(int a=0;a<4;a++)
+          ci[4*k+a]*=(k?2.0:1.0)/m;
+      }
+      
+      // verification
+      for(j=0;j<=4*m;j++){
+        x=-1.0+2.0*j/(4*m);
+        f(ctx,t0+h*(i+0.5*(x+1.0)),ref);
+        clenshaw(ci,deg,x,val);
+        e =pythag(val[0]-ref[0],val[1]-ref[1],val[2]-ref[2]);
+        et=fabs(val[3]-ref[3]);
+        err[0]=e >err[0]?e :err[0];
+        err[1]=et>err[1]?et:err[1];
+      }
+      e=fabs(ci[4*deg  ])+fabs(ci[4*deg+1])+fabs(ci[4*deg+2])+
+        fabs(ci[4*deg-4])+fabs(ci[4*deg-3])+fabs(ci[4*deg-2]);
+      et=fabs(ci[4*deg+3])+fabs(ci[4*deg-1]);
+      ok=err[0]+e<tol&&err[1]+et<tclk;
+    }
+    if(ok)
+      return true;
+  }
+#ifdef DEBUG
+  warn("Chebyshev fit did not converge");
+#endif 
+  nseg=0;
+  return false;
+}
+
+// position (m) and clock bias (s) at t, false outside the fitted window
+bool Cheb::eval(const Time& t, double *xyz, double *clock_bias) const
+{
+  double tau,x,f[4];
+  int i;
+
+  if(!nseg)
+    return false;
+  tau=(t-t0).to_double();
+  i=(int)floor(tau/h);
+  if(i==nseg&&tau<=h*nseg) // right edge of the window
+    i--;
+  if(i<0||i>=nseg)
+    return false;
+  x=2.0*(tau-h*i)/h-1.0;
+  clenshaw(&c[i*(deg+1)*4],deg,x,f);
+
+  xyz[0]=f[0];
+  xyz[1]=f[1];
+  xyz[2]=f[2];
+  if(clock_bias)
+    *clock_bias=f[3];
+  return true;
+}
@@ -0,0 +1,369 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   rinex.cc --RINEX navigation file reader (versions 2.10 to 3.05)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include <algorithm>
+#include <thread>
+
+// records decoded per worker, below that threads are not worth it
+#define NAV_MIN_BATCH 256
+
+// header label (columns 61-80)
+static bool label(const char *s, int n, const char *lab)
+{
+  int k=strlen(lab);
+  return n>=60+k&&!strncmp(s+60,lab,k);
+}
+
+//////////////////////////////////////////////////////////////////////
+//  RINEX navigation file
+
+NavFile::NavFile()
+  : ver(0.0), sys(0), leaps(0), nskip(0)
+{
+  for(int i=0;i<8;i++)
+    ion[i]=0.0;
+  for(int i=0;i<4;i++)
+    utc[i]=0.0;
+}
+
+bool NavFile::read(const char *filepath, int nthreads)
+{
+  Mem m;
+
+  if(!m.mmap(filepath))
+    return false;
+#ifdef HAVE_ZLIB
+  if(Mem::gzipped(std::as_const(m).data(),m.size()))
+    m=m.gz_decode();
+#endif
+  return read(std::as_const(m).data(),m.size(),nthreads);
+}
+
+// returns the first line after END OF HEADER (0 on error)
+std::size_t NavFile::header(const Lines& idx)
+{
+  std::size_t i,k;
+  const char *s;
+  int n;
+
+  for(i=0;i<idx.size();i++){
+    s=idx[i];
+    n=idx.len(i);
+
+    if(label(s,n,"RINEX VERSION / TYPE")){
+      ver=strnflt(s,9);
+      if(s[20]!='N'){
+#ifdef DEBUG
+        warn("not a navigation file");
+#endif
+        return 0;
+      }
+      sys=ver<3.0?'G':s[40]; // RINEX 2 'N' files are GPS only
+    }
+    else if(label(s,n,"ION ALPHA")){ // RINEX 2
+      for(k=0;k<4;k++)
+        ion[k]=strnflt(s+2+12*k,12);
+    }
+    else if(label(s,n,"ION BETA")){
+      for(k=0;k<4;k++)
+        ion[k+4]=strnflt(s+2+12*k,12);
+    }
+    else if(label(s,n,"DELTA-UTC: A0,A1,T,W")){
+      utc[0]=strnflt(s+ 3,19);
+      utc[1]=strnflt(s+22,19);
+      utc[2]=strnflt(s+41, 9);
+      utc[3]=strnflt(s+50, 9);
+    }
+    else if(label(s,n,"IONOSPHERIC CORR")){ // RINEX 3
+      if(!strncmp(s,"GPSA",4))
+        for(k=0;k<4;k++)
+          ion[k]=strnflt(s+5+12*k,12);
+      if(!strncmp(s,"GPSB",4))
+        for(k=0;k<4;k++)
+          ion[k+4]=strnflt(s+5+12*k,12);
+    }
+    else if(label(s,n,"TIME SYSTEM CORR")){
+      if(!strncmp(s,"GPUT",4)){
+        utc[0]=strnflt(s+ 5,17);
+        utc[1]=strnflt(s+22,16);
+        utc[2]=strnflt(s+38, 7);
+        utc[3]=strnflt(s+45, 5);
+      }
+    }
+    else if(label(s,n,"LEAP SECONDS")){
+      leaps=(int)strnflt(s,6);
+    }
+    else if(label(s,n,"END OF HEADER")){
+      return ver>0.0?i+1:0;
+    }
+  }
+#ifdef DEBUG
+  warn("missing END OF HEADER");
+#endif
+  return 0;
+}
+
+// lines of the record starting at line s (0: not a record start)
+static int reclines(const char *s, int n, int ver)
+{
+  if(ver<3) // RINEX 2: "PP yy", continuation lines start blank
+    return n>2&&s[1]!=' '&&s[2]==' '?8:0;
+  if(n<3||s[0]<'A'||s[0]>'Z')
+    return 0;
+  switch(s[0]){
+  case 'R': // GLONASS
+  case 'S': // SBAS
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+// systems with Keplerian (GPS-like) broadcast orbits decoded into Nav
+static bool keplerian(const char *s, int ver)
+{
+  return ver<3||s[0]=='G'||s[0]=='E'||s[0]=='J'||s[0]=='I';
+}
+
+static void decode(std::vector<Nav>& eph, const Lines& idx,
+  const std::vector<uint32_t>& rec, std::size_t beg, std::size_t end, int ver)
+{
+  const char *lines[8];
+  int len[8];
+
+  for(std::size_t i=beg;i<end;i++){
+    for(int k=0;k<8;k++){
+      lines[k]=idx[rec[i]+k];
+      len[k]=idx.len(rec[i]+k);
+    }
+    eph[i].rnx2nav(lines,len,ver);
+  }
+}
+
+// Locates all record boundaries in a single pass over the line index,
+// then decodes the records in parallel, each worker filling its own
+// contiguous slice of eph.
+bool NavFile::read(const char *buf, std::size_t n, int nthreads)
+{
+  std::size_t i,k,nl,nrec;
+  std::vector<uint32_t> rec; // first line of each record
+  Lines idx;
+  int v;
+
+  eph.clear();
+  nskip=0;
+
+  idx.index(buf,n);
+  if(!(i=header(idx)))
+    return false;
+  v=(int)ver;
+
+  nl=idx.size();
+  rec.reserve((nl-i)/8+1);
+  while(i<nl){
+    k=reclines(idx[i],idx.len(i),v);
+    if(!k){ // blank or unexpected line
+      i++;
+      continue;
+    }
+    if(i+k>nl){
+#ifdef DEBUG
+      warn("truncated navigation record");
+#endif
+      break;
+    }
+    if(keplerian(idx[i],v))
+      rec.push_back(i);
+    else
+      nskip++;
+    i+=k;
+  }
+
+  nrec=rec.size();
+  eph.resize(nrec);
+
+  if(nthreads<=0)
+    nthreads=std::thread::hardware_concurrency();
+  if((std::size_t)nthreads>nrec/NAV_MIN_BATCH)
+    nthreads=nrec/NAV_MIN_BATCH;
+
+  if(nthreads<=1){
+    decode(eph,idx,rec,0,nrec,v);
+  } else {
+    std::vector<std::thread> pool;
+    k=(nrec+nthreads-1)/nthreads;
+    for(i=0;i<nrec;i+=k)
+      pool.emplace_back(decode,std::ref(eph),std::cref(idx),std::cref(rec),
+        i,std::min(i+k,nrec),v);
+    for(auto& t: pool)
+      t.join();
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  Lazy navigation file view
+
+NavView::NavView()
+  : s(0), n(0)
+{}
+
+bool NavView::open(const char *filepath)
+{
+  if(!m.mmap(filepath))
+    return false;
+#ifdef HAVE_ZLIB
+  if(Mem::gzipped(std::as_const(m).data(),m.size()))
+    m=m.gz_decode();
+#endif
+  return open(std::as_const(m).data(),m.size());
+}
+
+// satellite and toc from the first record line, "PRN yyyy mm dd hh mm ss"
+// (RINEX 2: "PP yy mm dd hh mm ss.s", GPS)
+static void recid(const char *s, int ver, char *prn, Time& toc)
+{
+  int k,cal[6];
+  double sec;
+
+  if(ver<3){
+    prn[0]='G';
+    prn[1]=s[0]==' '?'0':s[0];
+    prn[2]=s[1];
+    cal[0]=(int)strnflt(s+3,2);
+    cal[0]+=cal[0]<80?2000:1900;
+    for(k=1;k<5;k++)
+      cal[k]=(int)strnflt(s+3+3*k,2);
+    sec=strnflt(s+17,5);
+  } else {
+    prn[0]=s[0];
+    prn[1]=s[1]==' '?'0':s[1];
+    prn[2]=s[2];
+    cal[0]=(int)strnflt(s+4,4);
+    for(k=1;k<5;k++)
+      cal[k]=(int)strnflt(s+6+3*k,2);
+    sec=strnflt(s+21,2);
+  }
+  prn[3]='\0';
+  cal[5]=(int)floor(sec);
+  toc.from_cal(cal);
+  toc.t_frac=sec-cal[5];
+}
+
+// One pass over the line index as NavFile::read, but only the first
+// line of each Keplerian record is looked at: no field is converted
+// until a record is selected.
+bool NavView::open(const char *buf, std::size_t n_)
+{
+  std::size_t i,k,nl;
+  Lines idx;
+  Rec r;
+  char prn[4];
+  int v;
+
+  s=buf;
+  n=n_;
+  rec.clear();
+  nav.clear();
+  first.assign(EphemerisStore::NSLOT+1,0);
+
+  idx.index(buf,n);
+  if(!(i=hdr.header(idx)))
+    return false;
+  v=(int)hdr.ver;
+
+  nl=idx.size();
+  hdr.nskip=0;
+  while(i<nl){
+    k=reclines(idx[i],idx.len(i),v);
+    if(!k){
+      i++;
+      continue;
+    }
+    if(i+k>nl){
+#ifdef DEBUG
+      warn("truncated navigation record");
+#endif
+      break;
+    }
+    if(keplerian(idx[i],v)&&idx.len(i)>=23){
+      recid(idx[i],v,prn,r.toc);
+      r.off=idx.offset(i);
+      r.sat=EphemerisStore::satindex(prn);
+      r.nav=-1;
+      if(r.sat>=0)
+        rec.push_back(r);
+    } else
+      hdr.nskip++;
+    i+=k;
+  }
+
+  std::stable_sort(rec.begin(),rec.end(),[](const Rec& a, const Rec& b){
+    return a.sat!=b.sat?a.sat<b.sat:a.toc<b.toc;
+  });
+  for(const Rec& a: rec)
+    first[a.sat+1]++;
+  for(k=1;k<first.size();k++)
+    first[k]+=first[k-1];
+  nav.reserve(rec.size());
+  return true;
+}
+
+// decodes record i on first use
+const Nav *NavView::get(std::size_t i)
+{
+  const char *lines[8],*p,*q,*e=s+n;
+  int len[8];
+
+  if(rec[i].nav>=0)
+    return &nav[rec[i].nav];
+  p=s+rec[i].off;
+  for(int k=0;k<8;k++){
+    q=p<e?(const char*)memchr(p,'\n',e-p):0;
+    if(!q)
+      q=e;
+    lines[k]=p;
+    len[k]=q-p-(q>p&&q[-1]=='\r');
+    p=q<e?q+1:e;
+  }
+  rec[i].nav=nav.size();
+  nav.emplace_back();
+  nav.back().rnx2nav(lines,len,(int)hdr.ver);
+  return &nav.back();
+}
+
+// Healthy ephemeris closest to t within its fit interval, as
+// EphemerisStore::select. Candidates are tried by toc distance, the
+// only time known before decoding (toc is toe for GPS, QZS and
+// Galileo broadcasts). Not thread safe.
+const Nav *NavView::select(const char *prn, const Time& t)
+{
+  std::size_t a,b,lo,hi,j;
+  double da,db;
+  const Nav *e;
+  int k;
+
+  if((k=EphemerisStore::satindex(prn))<0||first.empty())
+    return 0;
+  lo=first[k];
+  hi=first[k+1];
+  a=std::lower_bound(rec.begin()+lo,rec.begin()+hi,t,
+    [](const Rec& r, const Time& t){ return r.toc<t; })-rec.begin();
+  b=a; // next candidates: a upwards, b-1 downwards
+
+  for(;;){
+    da=a<hi?fabs((rec[a].toc-t).to_double()):1e99;
+    db=b>lo?fabs((t-rec[b-1].toc).to_double()):1e99;
+    if(da>86400.0&&db>86400.0)
+      break; // beyond any fit interval
+    j=db<da?--b:a++;
+    e=get(j);
+    if(!e->svh&&fabs((t-e->toe).to_double())<=EphemerisStore::maxdtoe(*e))
+      return e;
+  }
+  return 0;
+}
@@ -0,0 +1,694 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   rtcm.cc --RTCM 3 stream decoder (MSM4/5/7, 1019, 1045)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include "constants.h"
+#include <algorithm>
+#include <array>
+#include <ctime>
+#include <cerrno>
+
+#ifdef HAVE_MMAP
+  #include <unistd.h>
+#endif
+
+#define RTCM_BUFSIZE (1<<16) // file window, holds the largest frame (1029)
+#define RTCM_SLOTS   (6*64)  // system x MSM satellite
+
+#define P2_5  0.03125
+#define P2_10 9.765625000000000E-04
+#define P2_19 1.9073486328125E-06
+#define P2_24 5.960464477539063E-08
+#define P2_29 1.862645149230957E-09
+#define P2_31 4.656612873077393E-10
+#define P2_32 2.328306436538696E-10
+#define P2_33 1.164153218269348E-10
+#define P2_34 5.820766091346741E-11
+#define P2_43 1.136868377216160E-13
+#define P2_46 1.421085471520200E-14
+#define P2_55 2.775557561562891E-17
+#define P2_59 1.734723475976807E-18
+
+#define RANGE_MS (CLIGHT*0.001) // range of 1 ms (m)
+
+// big-endian bit fields (len<=32), the bytes spanned at once
+static inline uint32_t getbitu(const uint8_t *b, int pos, int len)
+{
+  uint64_t v=0;
+  int i,e=(pos+len+7)>>3;
+
+  for(i=pos>>3;i<e;i++)
+    v=v<<8|b[i];
+  v>>=(e<<3)-pos-len;
+  return (uint32_t)(v&((1ull<<len)-1));
+}
+
+static inline int32_t getbits(const uint8_t *b, int pos, int len)
+{
+  uint32_t v=getbitu(b,pos,len);
+  return len<32&&(v>>(len-1))?(int32_t)(v|(~0u<<len)):(int32_t)v;
+}
+
+// CRC-24Q of the frame, one table lookup per byte
+static uint32_t crc24q(const uint8_t *b, int n)
+{
+  static const std::array<uint32_t,256> tab=[]{
+    std::array<uint32_t,256> t{};
+    for(uint32_t i=0;i<256;i++){
+      uint32_t c=i<<16;
+      for(int k=0;k<8;k++)
+        c=c&0x800000?(c<<1)^0x1864CFB:c<<1;
+      t[i]=c&0xFFFFFF;
+    }
+    return t;
+  }();
+  uint32_t c=0;
+
+  for(int i=0;i<n;i++)
+    c=((c<<8)^tab[(c>>16)^b[i]])&0xFFFFFF;
+  return c;
+}
+
+// RINEX band and attribute of MSM signal ids 1-32, by system in
+// message order (GPS, GLONASS, Galileo, SBAS, QZSS, BeiDou)
+static const char *const msmsig[6][32]={
+  {0,"1C","1P","1W",0,0,0,"2C","2P","2W",0,0,0,0,"2S","2L","2X",
+   0,0,0,0,"5I","5Q","5X",0,0,0,0,0,"1S","1L","1X"},
+  {0,"1C","1P",0,0,0,0,"2C","2P",0,0,0,0,0,0,0,0,
+   0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+  {0,"1C","1A","1B","1X","1Z",0,"6C","6A","6B","6X","6Z",0,"7I","7Q","7X",0,
+   "8I","8Q","8X",0,"5I","5Q","5X",0,0,0,0,0,0,0,0},
+  {0,"1C",0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+   0,0,0,0,"5I","5Q","5X",0,0,0,0,0,0,0,0},
+  {0,"1C",0,0,0,0,0,0,"6S","6L","6X",0,0,0,"2S","2L","2X",
+   0,0,0,0,"5I","5Q","5X",0,0,0,0,0,"1S","1L","1X"},
+  {0,"2I","2Q","2X",0,0,0,"6I","6Q","6X",0,0,0,"7I","7Q","7X",0,
+   0,0,0,0,"5D","5P","5X","7D",0,0,0,0,"1D","1P","1X"}};
+
+// carrier frequency (Hz) of a band, 0: unknown (GLONASS channel)
+static double freq(int sys, char band, int fcn)
+{
+  switch(band){
+    case '1':
+      if(sys==1)
+        return fcn<0?0.0:1.602E9+(fcn-7)*0.5625E6;
+      return 1.57542E9;
+    case '2':
+      if(sys==1)
+        return fcn<0?0.0:1.246E9+(fcn-7)*0.4375E6;
+      return sys==5?1.561098E9:1.22760E9;
+    case '5': return 1.17645E9;
+    case '6': return sys==5?1.26852E9:1.27875E9;
+    case '7': return 1.20714E9;
+    case '8': return 1.191795E9;
+  }
+  return 0.0;
+}
+
+static void adjweek(Time& t, const Time& t0)
+{
+  double tt=(t-t0).to_double();
+  if(tt<-302400.0)
+    t.t_sec+=604800;
+  if(tt> 302400.0)
+    t.t_sec-=604800;
+}
+
+// Grows the epoch buffers keeping the rows of a partial epoch: columns
+// are strided by the capacity, so only a new capacity moves them (and
+// allocates, while the stream still brings more satellites)
+static void widen(ObsEpoch& ep, int ncol, int nsat)
+{
+  int c0=ep.ncol,n=ep.n;
+
+  if(nsat>ep.cap&&n){
+    ObsEpoch t(ep);
+    ep.resize(ncol,nsat);
+    for(int c=0;c<c0;c++){
+      std::copy_n(&t.val[(std::size_t)c*t.cap],n,&ep.val[(std::size_t)c*ep.cap]);
+      std::copy_n(&t.lli[(std::size_t)c*t.cap],n,&ep.lli[(std::size_t)c*ep.cap]);
+      std::copy_n(&t.ssi[(std::size_t)c*t.cap],n,&ep.ssi[(std::size_t)c*ep.cap]);
+    }
+  }
+  else
+    ep.resize(ncol,nsat);
+  for(int c=c0;c<ncol;c++){
+    std::fill_n(&ep.val[(std::size_t)c*ep.cap],n,NAN);
+    memset(&ep.lli[(std::size_t)c*ep.cap],0,n);
+    memset(&ep.ssi[(std::size_t)c*ep.cap],0,n);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+//  Ephemeris messages, read through field tables into par[] (as the
+//  RINEX records are)
+
+struct RtcmField{
+  int len;            // bits
+  bool sgn;           // two's complement
+  double scale;
+};
+
+static const RtcmField f1019[]={ // GPS LNAV
+  {6,0,1},{10,0,1},{4,0,1},{2,0,1},     // prn, week, URA index, L2 code
+  {14,1,P2_43*PI},{8,0,1},{16,0,16},    // idot, iode, toc
+  {8,1,P2_55},{16,1,P2_43},{22,1,P2_31},// af2, af1, af0
+  {10,0,1},{16,1,P2_5},{16,1,P2_43*PI}, // iodc, crs, deln
+  {32,1,P2_31*PI},{16,1,P2_29},         // M0, cuc
+  {32,0,P2_33},{16,1,P2_29},            // e, cus
+  {32,0,P2_19},{16,0,16},{16,1,P2_29},  // sqrtA, toes, cic
+  {32,1,P2_31*PI},{16,1,P2_29},         // OMG0, cis
+  {32,1,P2_31*PI},{16,1,P2_5},          // i0, crc
+  {32,1,P2_31*PI},{24,1,P2_43*PI},      // omg, OMGd
+  {8,1,P2_31},{6,0,1},{1,0,1},{1,0,1}}; // tgd, health, L2P flag, fit flag
+
+static const RtcmField f1045[]={ // Galileo F/NAV
+  {6,0,1},{12,0,1},{10,0,1},{8,0,1},    // prn, week, IODnav, SISA
+  {14,1,P2_43*PI},{14,0,60},            // idot, toc
+  {6,1,P2_59},{21,1,P2_46},{31,1,P2_34},// af2, af1, af0
+  {16,1,P2_5},{16,1,P2_43*PI},          // crs, deln
+  {32,1,P2_31*PI},{16,1,P2_29},         // M0, cuc
+  {32,0,P2_33},{16,1,P2_29},            // e, cus
+  {32,0,P2_19},{14,0,60},{16,1,P2_29},  // sqrtA, toes, cic
+  {32,1,P2_31*PI},{16,1,P2_29},         // OMG0, cis
+  {32,1,P2_31*PI},{16,1,P2_5},          // i0, crc
+  {32,1,P2_31*PI},{24,1,P2_43*PI},      // omg, OMGd
+  {10,1,P2_32},{2,0,1},{1,0,1}};        // BGD E5a/E1, E5a health, validity
+
+// fields from bit pos, the bit after the last (0: message too short)
+static int fields(const uint8_t *p, int n, int pos, const RtcmField *f, int nf,
+  double *par)
+{
+  int k,end=pos;
+
+  for(k=0;k<nf;k++)
+    end+=f[k].len;
+  if(end>8*n)
+    return 0;
+  for(k=0;k<nf;k++,f++){
+    par[k]=(f->sgn?(double)getbits(p,pos,f->len):(double)getbitu(p,pos,f->len))*f->scale;
+    pos+=f->len;
+  }
+  return pos;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  RTCM 3 stream reader
+
+RtcmReader::RtcmReader()
+  : tref(0.0), leaps(18), staid(0), nbad(0), fp(0), src(0),
+    beg(0), end(0), cur(0), eof(true)
+{
+  reset();
+}
+
+RtcmReader::~RtcmReader()
+{
+  close();
+}
+
+void RtcmReader::reset()
+{
+  code.clear();
+  staid=0;
+  nbad=0;
+  for(auto& c: col)
+    for(int& k: c)
+      k=-1;
+  for(int& k: fcn)
+    k=-1;
+  lock.clear();
+  row.assign(RTCM_SLOTS,-1);
+  used.clear();
+  used.reserve(RTCM_SLOTS);
+  iod.assign(RTCM_SLOTS,-1);
+  pend=false;
+}
+
+// A pipe is read as its data comes (read() returns what is there), so
+// each message is decoded as soon as its last byte arrives
+bool RtcmReader::open(const char *filepath)
+{
+  close();
+  reset();
+  if(!(fp=fopen(filepath,"rb"))){
+#ifdef DEBUG
+    warn("cannot open file");
+#endif
+    return false;
+  }
+  buf.resize(RTCM_BUFSIZE);
+  eof=false;
+  return true;
+}
+
+void RtcmReader::open(const char *s, std::size_t n)
+{
+  close();
+  reset();
+  src=s;
+  beg=0;
+  end=n;
+  eof=true;
+}
+
+void RtcmReader::close()
+{
+  if(fp)
+    fclose(fp);
+  fp=0;
+  src=0;
+  beg=end=cur=0;
+  eof=true;
+}
+
+// keeps the unscanned bytes, reads more after them
+void RtcmReader::fill()
+{
+  long k;
+
+  if(!fp){
+    eof=true;
+    return;
+  }
+  if(beg){
+    memmove(buf.data(),buf.data()+beg,end-beg);
+    end-=beg;
+    beg=0;
+  }
+#ifdef HAVE_MMAP
+  do
+    k=read(fileno(fp),buf.data()+end,buf.size()-end);
+  while(k<0&&errno==EINTR);
+#else
+  k=fread(buf.data()+end,1,buf.size()-end,fp);
+#endif
+  if(k>0)
+    end+=k;
+  else
+    eof=true;
+}
+
+// Frames are returned in place: the pointer (at the preamble) is valid
+// until the next call. A frame whose CRC fails is dropped one byte at a
+// time, a preamble inside it may start a frame.
+const uint8_t *RtcmReader::frame(int *len)
+{
+  const uint8_t *p,*q;
+  std::size_t k;
+  int n;
+
+  for(;;){
+    p=(const uint8_t*)(src?src:buf.data());
+    q=(const uint8_t*)memchr(p+beg,0xD3,end-beg);
+    if(!q){
+      beg=end;
+      if(eof)
+        return 0;
+      fill();
+      continue;
+    }
+    k=q-p;
+    if(end-k>=2&&(q[1]&0xFC)){ // reserved bits set
+      beg=k+1;
+      continue;
+    }
+    if(end-k<3||end-k<6+(std::size_t)((q[1]&3)<<8|q[2])){ // not all in the window
+      if(!eof){
+        beg=k;
+        fill();
+        continue;
+      }
+      beg=end-k<3?end:k+1; // truncated by the end of the data
+      continue;
+    }
+    n=(q[1]&3)<<8|q[2];
+    if(crc24q(q,n+3)!=getbitu(q,8*(n+3),24)){
+      nbad++;
+      beg=k+1;
+      continue;
+    }
+    cur=k;
+    beg=k+6+n;
+    *len=n;
+    return q;
+  }
+}
+
+// MSM epochs of one time are merged into ep until the multiple message
+// bit is clear; an epoch left open by a lost message is returned when
+// the next one starts (its first message is read again)
+int RtcmReader::next(ObsEpoch& ep, Nav& eph)
+{
+  const uint8_t *p;
+  int n,type,r;
+
+  while((p=frame(&n))){
+    p+=3;
+    if(n<2)
+      continue;
+    type=getbitu(p,0,12);
+    if(type>=1071&&type<=1127&&(type%10==4||type%10==5||type%10==7)){
+      if((r=msm(p,n,ep))<0){
+        beg=cur;
+        done();
+        return RTCM_OBS;
+      }
+      if(r==2)
+        return RTCM_OBS;
+    }
+    else if(type==1019&&eph1019(p,n,eph))
+      return RTCM_NAV;
+    else if(type==1045&&eph1045(p,n,eph))
+      return RTCM_NAV;
+  }
+  if(pend){
+    done();
+    return RTCM_OBS;
+  }
+  return 0;
+}
+
+// epoch of an MSM header in GPS time, next to tref
+Time RtcmReader::gpst(int sys, const uint8_t *p)
+{
+  double tow;
+  int dow;
+  Time t;
+
+  if(!tref.t_sec)
+    tref=Time((double)time(0))+(double)leaps;
+  if(sys==1){ // GLONASS: day of week, time of day in UTC(SU)
+    dow=getbitu(p,24,3);
+    tow=getbitu(p,27,27)*1e-3-10800.0+leaps;
+    if(dow==7) // unknown: the day of tref
+      dow=(int)(tref.gps_tow()/86400.0);
+    tow+=dow*86400.0;
+  }
+  else{
+    tow=getbitu(p,24,30)*1e-3;
+    if(sys==5)
+      tow+=14.0; // BDT
+  }
+  if(tow<0.0)
+    tow+=604800.0;
+  if(tow>=604800.0)
+    tow-=604800.0;
+  t.from_gps(tref.gps_week(),tow);
+  adjweek(t,tref);
+  if(sys==1){ // day of tref for an unknown day of week
+    double dt=(t-tref).to_double();
+    if(dt<-43200.0)
+      t+=86400.0;
+    if(dt> 43200.0)
+      t-=86400.0;
+  }
+  return t;
+}
+
+// first of the C, L, D and S columns of a signal, added when first seen;
+// columns are shared by the systems with the same code, as in ObsFile
+int RtcmReader::sigcol(int sys, int sig)
+{
+  const char *s;
+  std::string c;
+  std::size_t j;
+
+  if(col[sys][sig]>=0)
+    return col[sys][sig];
+  if(!(s=msmsig[sys][sig]))
+    return -1;
+  c=std::string("C")+s;
+  for(j=0;j<code.size()&&code[j]!=c;j++);
+  if(j==code.size()){
+    for(const char *o="CLDS";*o;o++)
+      code.push_back(std::string(1,*o)+s);
+    lock.resize(code.size()/4*RTCM_SLOTS,0);
+  }
+  return col[sys][sig]=j;
+}
+
+void RtcmReader::done()
+{
+  for(int s: used)
+    row[s]=-1;
+  used.clear();
+  pend=false;
+}
+
+// MSM4, MSM5 and MSM7: satellite data (rough range and rate), then signal
+// data of each cell of the satellite x signal mask. Returns 1 (merged),
+// 2 (last of the epoch), 0 (not decoded), -1 (ep holds another epoch).
+int RtcmReader::msm(const uint8_t *p, int n, ObsEpoch& ep)
+{
+  static const char sysc[]="GRESJC";
+  int type,sys,kind,i,k,m,c,g,nsat,nsig,ncell,sync,sl,r;
+  int sat[64],sig[32],cs[64],cg[64],ext[64],lk[64],hc[64];
+  double rng[64],rate[64],pr[64],cp[64],rr[64],cn[64],f,lam;
+  std::size_t j;
+  Time t;
+
+  type=getbitu(p,0,12);
+  sys=(type-1071)/10;
+  kind=type%10;
+  if(n<22)
+    return 0;
+  i=73;
+  for(k=nsat=0;k<64;k++)
+    if(getbitu(p,i+k,1))
+      sat[nsat++]=k;
+  i+=64;
+  for(k=nsig=0;k<32;k++)
+    if(getbitu(p,i+k,1))
+      sig[nsig++]=k;
+  i+=32;
+  if(nsat*nsig>64||i+nsat*nsig>8*n)
+    return 0;
+  for(k=ncell=0;k<nsat*nsig;k++)
+    if(getbitu(p,i+k,1)){
+      cs[ncell]=k/nsig;
+      cg[ncell++]=k%nsig;
+    }
+  i+=nsat*nsig;
+  if(i+nsat*(kind==4?18:36)+ncell*(kind==4?48:kind==5?63:80)>8*n)
+    return 0;
+
+  t=gpst(sys,p);
+  if(pend&&t.to_double()!=ep.t.to_double())
+    return -1;
+  staid=getbitu(p,12,12);
+  sync=getbitu(p,54,1);
+  for(k=0;k<nsig;k++) // new signals first: columns are fixed below
+    sigcol(sys,sig[k]);
+  if(!pend){
+    ep.t=t;
+    ep.flag=0;
+    ep.clk=0.0;
+    ep.n=0;
+    pend=true;
+    tref=t;
+  }
+  widen(ep,code.size(),ep.n+nsat);
+
+  for(k=0;k<nsat;k++,i+=8) // rough range (integer ms)
+    rng[k]=getbitu(p,i,8);
+  for(k=0;k<nsat;k++)
+    ext[k]=-1;
+  if(kind!=4)
+    for(k=0;k<nsat;k++,i+=4) // extended info (GLONASS channel)
+      ext[k]=getbitu(p,i,4);
+  for(k=0;k<nsat;k++,i+=10){
+    rng[k]=rng[k]==255?NAN:(rng[k]+getbitu(p,i,10)*P2_10)*RANGE_MS;
+    rate[k]=NAN;
+  }
+  if(kind!=4)
+    for(k=0;k<nsat;k++,i+=14)
+      rate[k]=(r=getbits(p,i,14))==-8192?NAN:r;
+
+  if(kind==7){
+    for(m=0;m<ncell;m++,i+=20)
+      pr[m]=(r=getbits(p,i,20))==-524288?NAN:r*P2_29*RANGE_MS;
+    for(m=0;m<ncell;m++,i+=24)
+      cp[m]=(r=getbits(p,i,24))==-8388608?NAN:r*P2_31*RANGE_MS;
+    for(m=0;m<ncell;m++,i+=10)
+      lk[m]=getbitu(p,i,10);
+  }
+  else{
+    for(m=0;m<ncell;m++,i+=15)
+      pr[m]=(r=getbits(p,i,15))==-16384?NAN:r*P2_24*RANGE_MS;
+    for(m=0;m<ncell;m++,i+=22)
+      cp[m]=(r=getbits(p,i,22))==-2097152?NAN:r*P2_29*RANGE_MS;
+    for(m=0;m<ncell;m++,i+=4)
+      lk[m]=getbitu(p,i,4);
+  }
+  for(m=0;m<ncell;m++,i++)
+    hc[m]=getbitu(p,i,1);
+  if(kind==7)
+    for(m=0;m<ncell;m++,i+=10)
+      cn[m]=getbitu(p,i,10)*0.0625;
+  else
+    for(m=0;m<ncell;m++,i+=6)
+      cn[m]=getbitu(p,i,6);
+  for(m=0;m<ncell;m++)
+    rr[m]=NAN;
+  if(kind!=4)
+    for(m=0;m<ncell;m++,i+=15)
+      rr[m]=(r=getbits(p,i,15))==-16384?NAN:r*1e-4;
+
+  for(k=0;k<nsat;k++) // rows of the satellites
+    if(sys==1&&ext[k]>=0&&ext[k]<=13&&sat[k]<64)
+      fcn[sat[k]]=ext[k];
+
+  for(m=0;m<ncell;m++){
+    k=cs[m];
+    if(std::isnan(rng[k])||(c=col[sys][sig[cg[m]]])<0)
+      continue;
+    sl=sys*64+sat[k];
+    if((r=row[sl])<0){
+      int id=sat[k]+1+(sys==3?19:0);
+      r=row[sl]=ep.n++;
+      used.push_back(sl);
+      ep.sat[4*r]=sysc[sys];
+      ep.sat[4*r+1]='0'+id/10;
+      ep.sat[4*r+2]='0'+id%10;
+      ep.sat[4*r+3]='\0';
+      for(int o=0;o<ep.ncol;o++){
+        ep.val[(std::size_t)o*ep.cap+r]=NAN;
+        ep.lli[(std::size_t)o*ep.cap+r]=0;
+        ep.ssi[(std::size_t)o*ep.cap+r]=0;
+      }
+    }
+    f=freq(sys,msmsig[sys][sig[cg[m]]][0],sys==1?fcn[sat[k]]:0);
+    lam=f>0.0?CLIGHT/f:0.0;
+    j=(std::size_t)c*ep.cap+r;
+    ep.val[j]=rng[k]+pr[m];
+    if(lam>0.0){
+      ep.val[j+ep.cap]=(rng[k]+cp[m])/lam;
+      ep.val[j+2*ep.cap]=-(rate[k]+rr[m])/lam;
+    }
+    ep.val[j+3*ep.cap]=cn[m];
+
+    g=c/4*RTCM_SLOTS+sl;
+    ep.lli[j+ep.cap]=(lk[m]<lock[g]?1:0)|(hc[m]?2:0);
+    lock[g]=lk[m];
+    for(int o=0;o<4;o++)
+      ep.ssi[j+o*ep.cap]=cn[m]>0.0?std::min(std::max((int)cn[m]/6,1),9):0;
+  }
+  if(sync)
+    return 1;
+  done();
+  return 2;
+}
+
+// 1019: GPS ephemeris, the 10-bit week next to tref
+bool RtcmReader::eph1019(const uint8_t *p, int n, Nav& e)
+{
+  double par[30];
+  int prn,key;
+
+  if(!fields(p,n,12,f1019,30,par)||(prn=(int)par[0])<1)
+    return false;
+  if(!tref.t_sec)
+    tref=Time((double)time(0))+(double)leaps;
+  e.week=(int)par[1];
+  e.week+=(tref.gps_week()-e.week+512)/1024*1024;
+  e.sva =(int)par[2];
+  e.code=(int)par[3];
+  e.idot=par[4];
+  e.iode=(int)par[5];
+  e.f2=par[7];
+  e.f1=par[8];
+  e.f0=par[9];
+  e.iodc=(int)par[10];
+  e.crs =par[11];
+  e.deln=par[12];
+  e.M0  =par[13];
+  e.cuc =par[14];
+  e.e   =par[15];
+  e.cus =par[16];
+  e.A   =par[17]*par[17];
+  e.toes=par[18];
+  e.cic =par[19];
+  e.OMG0=par[20];
+  e.cis =par[21];
+  e.i0  =par[22];
+  e.crc =par[23];
+  e.omg =par[24];
+  e.OMGd=par[25];
+  e.tgd[0]=par[26];
+  e.tgd[1]=e.tgd[2]=e.tgd[3]=0.0;
+  e.svh =(int)par[27];
+  e.flag=(int)par[28];
+  e.fit =par[29]?0.0:4.0; // 0: 4 hours
+  e.Adot=e.ndot=0.0;
+  e.prn[0]='G';
+  e.prn[1]='0'+prn/10;
+  e.prn[2]='0'+prn%10;
+  e.prn[3]='\0';
+  e.toe.from_gps(e.week,e.toes);
+  e.toc.from_gps(e.week,par[6]);
+  adjweek(e.toc,e.toe);
+  e.ttr=tref;
+
+  key=e.iodc<<16|(int)(e.toes/16.0);
+  if(key==iod[prn-1])
+    return false; // repeated broadcast
+  iod[prn-1]=key;
+  return true;
+}
+
+// 1045: Galileo F/NAV ephemeris
+bool RtcmReader::eph1045(const uint8_t *p, int n, Nav& e)
+{
+  double par[27];
+  int prn,key;
+
+  if(!fields(p,n,12,f1045,27,par)||(prn=(int)par[0])<1)
+    return false;
+  e.week=(int)par[1]+1024; // GST week, GPS numbering
+  e.iode=e.iodc=(int)par[2];
+  e.sva =(int)par[3];
+  e.idot=par[4];
+  e.f2=par[6];
+  e.f1=par[7];
+  e.f0=par[8];
+  e.crs =par[9];
+  e.deln=par[10];
+  e.M0  =par[11];
+  e.cuc =par[12];
+  e.e   =par[13];
+  e.cus =par[14];
+  e.A   =par[15]*par[15];
+  e.toes=par[16];
+  e.cic =par[17];
+  e.OMG0=par[18];
+  e.cis =par[19];
+  e.i0  =par[20];
+  e.crc =par[21];
+  e.omg =par[22];
+  e.OMGd=par[23];
+  e.tgd[0]=par[24];
+  e.tgd[1]=e.tgd[2]=e.tgd[3]=0.0;
+  e.svh =(int)par[25]<<4|(int)par[26]<<3;
+  e.code=1<<1|1<<8; // F/NAV E5a-I, af0-af2 for E5a,E1
+  e.flag=0;
+  e.fit =0.0;
+  e.Adot=e.ndot=0.0;
+  e.prn[0]='E';
+  e.prn[1]='0'+prn/10;
+  e.prn[2]='0'+prn%10;
+  e.prn[3]='\0';
+  e.toe.from_gps(e.week,e.toes);
+  e.toc.from_gps(e.week,par[5]);
+  adjweek(e.toc,e.toe);
+  e.ttr=tref.t_sec?tref:e.toe;
+
+  key=e.iode<<16|(int)(e.toes/60.0);
+  if(key==iod[128+prn-1])
+    return false;
+  iod[128+prn-1]=key;
+  return true;
+}
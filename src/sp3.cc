@@ -0,0 +1,439 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   sp3.cc --SP3 precise orbit file reader (versions a, c and d)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include <thread>
+
+// epoch blocks decoded per worker, below that threads are not worth it
+#define SP3_MIN_BATCH 32
+
+#define SP3_BADCLK 999999.0 // clock values >= this are missing
+#define SP3_MAXGAP 4        // widest gap (epochs) bridged by interpolation
+
+// satellite id "G01", "G 1" or "  1" (SP3-a, GPS) into "G01"
+static void satid(const char *s, char *prn)
+{
+  prn[0]=s[0]==' '?'G':s[0];
+  prn[1]=s[1]==' '?'0':s[1];
+  prn[2]=s[2];
+  prn[3]='\0';
+}
+
+//////////////////////////////////////////////////////////////////////
+//  SP3 precise orbit file
+
+Sp3File::Sp3File()
+  : ver(0), pv(0), dt(0.0)
+{
+  tsys[0]=crd[0]=agency[0]='\0';
+}
+
+bool Sp3File::read(const char *filepath, int nthreads)
+{
+  Mem m;
+
+  if(!m.mmap(filepath))
+    return false;
+#ifdef HAVE_ZLIB
+  if(Mem::gzipped(std::as_const(m).data(),m.size()))
+    m=m.gz_decode();
+#endif
+  return read(std::as_const(m).data(),m.size(),nthreads);
+}
+
+int Sp3File::find(const char *prn) const
+{
+  int k=EphemerisStore::satindex(prn);
+  return k<0||slot.empty()?-1:slot[k];
+}
+
+// returns the first line of the body (0 on error)
+std::size_t Sp3File::header(const Lines& idx)
+{
+  std::size_t i,nsat=0,nacc=0;
+  const char *s;
+  char prn[4];
+  int n,k;
+
+  for(i=0;i<idx.size();i++){
+    s=idx[i];
+    n=idx.len(i);
+    if(n<2)
+      continue;
+
+    if(s[0]=='*'){
+      break;
+    }
+    else if(s[0]=='#'&&s[1]!='#'){
+      if(n<60){
+#ifdef DEBUG
+        warn("invalid SP3 first line");
+#endif
+        return 0;
+      }
+      ver=s[1];
+      pv=s[2];
+      t0.from_rnx(s+3);
+      memcpy(crd,s+46,5); crd[5]='\0';
+      memcpy(agency,s+56,4); agency[4]='\0';
+    }
+    else if(s[0]=='#'&&s[1]=='#'){
+      dt=n>=38?strnflt(s+24,14):0.0;
+    }
+    else if(s[0]=='+'&&s[1]==' '){
+      if(!nsat)
+        nsat=(std::size_t)strnflt(s+2,4);
+      for(k=0;k<17&&9+3*k+3<=n&&sat.size()<nsat;k++){
+        satid(s+9+3*k,prn);
+        sat.emplace_back();
+        memcpy(sat.back().prn,prn,4);
+        sat.back().acc=0;
+      }
+    }
+    else if(s[0]=='+'&&s[1]=='+'){
+      for(k=0;k<17&&9+3*k+3<=n&&nacc<sat.size();k++)
+        sat[nacc++].acc=(int)strnflt(s+9+3*k,3);
+    }
+    else if(s[0]=='%'&&s[1]=='c'&&!tsys[0]){
+      if(n>=12){
+        memcpy(tsys,s+9,3);
+        tsys[3]='\0';
+      }
+    }
+  }
+  if(!ver||!sat.size()||i==idx.size()){
+#ifdef DEBUG
+    warn("invalid SP3 header");
+#endif
+    return 0;
+  }
+  if(ver=='a') // no %c line, GPS time
+    strcpy(tsys,"GPS");
+  return i;
+}
+
+// P/V: 4 fields F14.6 from column 5, EP/EV: I4 I4 I4 I7 from column 5
+static void record(const char *s, int n, double *v)
+{
+  for(int k=0;k<4;k++)
+    v[k]=4+14*k+14<=n?strnflt(s+4+14*k,14):0.0;
+}
+
+static void sdev(const char *s, int n, double *v)
+{
+  static const int off[4]={4,9,14,19}, len[4]={4,4,4,7};
+
+  for(int k=0;k<4;k++)
+    v[k]=off[k]+len[k]<=n?strnflt(s+off[k],len[k]):0.0;
+}
+
+void Sp3File::decode(const Lines& idx, const std::vector<uint32_t>& ep,
+  std::size_t beg, std::size_t end, std::size_t nl)
+{
+  std::size_t i,j,last;
+  const char *s;
+  char prn[4];
+  double v[4];
+  Sat *p;
+  int n,k;
+
+  for(i=beg;i<end;i++){
+    t[i].from_rnx(idx[ep[i]]+3);
+    last=i+1<ep.size()?ep[i+1]:nl;
+    p=0;
+    for(j=ep[i]+1;j<last;j++){
+      s=idx[j];
+      n=idx.len(j);
+      if(n<4)
+        continue;
+      if(s[0]=='P'||s[0]=='V'){
+        satid(s+1,prn);
+        k=EphemerisStore::satindex(prn);
+        p=k<0||slot[k]<0?0:&sat[slot[k]];
+        if(!p)
+          continue;
+        record(s,n,v);
+        if(s[0]=='P'){
+          // 0.000000 position: bad or absent, 999999.999999 clock: absent
+          bool bad=v[0]==0.0&&v[1]==0.0&&v[2]==0.0;
+          p->x[i]=bad?NAN:v[0]*1e3;
+          p->y[i]=bad?NAN:v[1]*1e3;
+          p->z[i]=bad?NAN:v[2]*1e3;
+          p->clk[i]=fabs(v[3])>=SP3_BADCLK?NAN:v[3]*1e-6;
+        } else if(p->vx.size()){
+          bool bad=v[0]==0.0&&v[1]==0.0&&v[2]==0.0;
+          p->vx[i]=bad?NAN:v[0]*1e-1;
+          p->vy[i]=bad?NAN:v[1]*1e-1;
+          p->vz[i]=bad?NAN:v[2]*1e-1;
+          p->clkr[i]=fabs(v[3])>=SP3_BADCLK?NAN:v[3]*1e-10;
+        }
+      }
+      else if(s[0]=='E'&&p&&(s[1]=='P'||s[1]=='V')){
+        std::vector<double>& sd=s[1]=='P'?p->sdp:p->sdv;
+        double sc=s[1]=='P'?1e-3:1e-7; // mm, 1e-4 mm/s
+        double sct=s[1]=='P'?1e-12:1e-16; // ps, 1e-4 ps/s
+        if(!sd.size())
+          continue;
+        sdev(s,n,v);
+        sd[4*i+0]=v[0]*sc;
+        sd[4*i+1]=v[1]*sc;
+        sd[4*i+2]=v[2]*sc;
+        sd[4*i+3]=v[3]*sct;
+      }
+      else if(s[0]=='E'&&s[1]=='O'&&s[2]=='F'){
+        break;
+      }
+    }
+  }
+}
+
+// Collects the epoch header lines in a single pass over the line index,
+// sizes every per-satellite column for all epochs (NaN: no record), then
+// decodes the epoch blocks in parallel. Workers own disjoint epoch
+// ranges, i.e. disjoint elements of every column.
+bool Sp3File::read(const char *buf, std::size_t n, int nthreads)
+{
+  std::vector<uint32_t> ep; // epoch header lines
+  std::size_t i,k,nl,nep;
+  bool hasv=false,hasep=false,hasev=false;
+  const char *s;
+  Lines idx;
+
+  sat.clear();
+  t.clear();
+  ver=pv=0;
+  tsys[0]=crd[0]=agency[0]='\0';
+
+  idx.index(buf,n);
+  if(!(i=header(idx)))
+    return false;
+
+  slot.assign(EphemerisStore::NSLOT,-1);
+  for(k=0;k<sat.size();k++){
+    int j=EphemerisStore::satindex(sat[k].prn);
+    if(j>=0)
+      slot[j]=k;
+  }
+
+  nl=idx.size();
+  for(;i<nl;i++){
+    s=idx[i];
+    switch(s[0]){
+    case '*': ep.push_back(i); break;
+    case 'V': hasv=true; break;
+    case 'E':
+      if(s[1]=='P') hasep=true;
+      if(s[1]=='V') hasev=true;
+      if(s[1]=='O'){ nl=i; } // EOF
+      break;
+    }
+  }
+
+  nep=ep.size();
+  t.resize(nep);
+  for(auto& p: sat){
+    p.x.assign(nep,NAN); p.y.assign(nep,NAN);
+    p.z.assign(nep,NAN); p.clk.assign(nep,NAN);
+    if(hasv){
+      p.vx.assign(nep,NAN); p.vy.assign(nep,NAN);
+      p.vz.assign(nep,NAN); p.clkr.assign(nep,NAN);
+    }
+    if(hasep)
+      p.sdp.assign(4*nep,NAN);
+    if(hasev)
+      p.sdv.assign(4*nep,NAN);
+  }
+
+  if(nthreads<=0)
+    nthreads=std::thread::hardware_concurrency();
+  if((std::size_t)nthreads>nep/SP3_MIN_BATCH)
+    nthreads=nep/SP3_MIN_BATCH;
+
+  if(nthreads<=1){
+    decode(idx,ep,0,nep,nl);
+  } else {
+    std::vector<std::thread> pool;
+    k=(nep+nthreads-1)/nthreads;
+    for(i=0;i<nep;i+=k)
+      pool.emplace_back(&Sp3File::decode,this,std::cref(idx),std::cref(ep),
+        i,std::min(i+k,nep),nl);
+    for(auto& w: pool)
+      w.join();
+  }
+  return nep>0;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  SP3 interpolation 
+//
+// Barycentric Lagrange over the uniform SP3 grid: the weights of the
+// equispaced nodes are fixed (binomial, alternating sign), so set() only
+// turns them into the order coefficients of the query time, shared by
+// every satellite of the epoch. A satellite with a missing value inside
+// the window falls back to its nearest valid epochs with weights of the
+// general (non-uniform) formula. Clocks are interpolated linearly between
+// the two bracketing epochs: higher orders only amplify clock noise.
+
+Sp3Interp::Sp3Interp(const Sp3File& sp3_, int order)
+  : sp3(&sp3_), ord(order), u(0.0), h(0.0), i0(-1)
+{
+  if(ord<2||ord>SP3_MAXORD){
+#ifdef DEBUG
+    warn("interpolation order out of range");
+#endif
+    ord=ord<2?2:SP3_MAXORD;
+  }
+  // w_j = (-1)^j binomial(ord-1,j)
+  wb[0]=1.0;
+  for(int j=1;j<ord;j++)
+    wb[j]=-wb[j-1]*(ord-j)/j;
+}
+
+bool Sp3Interp::set(const Time& t)
+{
+  const std::vector<Time>& ep=sp3->t;
+  int n=ep.size(),j,k;
+  double s,sum;
+
+  i0=-1;
+  if(n<ord)
+    return false;
+  h=sp3->dt>0.0?sp3->dt:
+    (ep[1].t_sec-ep[0].t_sec)+(ep[1].t_frac-ep[0].t_frac);
+  u=((t.t_sec-ep[0].t_sec)+(t.t_frac-ep[0].t_frac))/h;
+  if(u<-1e-9||u>n-1+1e-9) // no extrapolation
+    return false;
+
+  k=(int)floor(u);
+  i0=k-(ord/2-1);
+  if(i0<0) // arc edges: shift the window inside the arc
+    i0=0;
+  if(i0>n-ord)
+    i0=n-ord;
+
+  s=u-i0;
+  for(j=0;j<ord;j++){
+    if(fabs(s-j)<1e-9){ // on a node
+      for(k=0;k<ord;k++)
+        c[k]=k==j?1.0:0.0;
+      return true;
+    }
+  }
+  for(sum=0.0,j=0;j<ord;j++)
+    sum+=c[j]=wb[j]/(s-j);
+  for(j=0;j<ord;j++)
+    c[j]/=sum;
+  return true;
+}
+
+// position from the nearest ord valid epochs around u (non-uniform nodes)
+bool Sp3Interp::sparse(const Sp3File::Sat& p, double *xyz) const
+{
+  int idx[SP3_MAXORD],n=sp3->t.size(),m=0,lo,hi,jl,jh,j,k;
+  double w[SP3_MAXORD],sum=0.0,d;
+
+  lo=(int)floor(u);
+  hi=lo+1;
+  jl=std::max(lo-2*ord,0);
+  jh=std::min(hi+2*ord,n-1);
+  while(m<ord&&(lo>=jl||hi<=jh)){
+    if(lo>=jl&&(u-lo<=hi-u||hi>jh)){
+      if(!std::isnan(p.x[lo]))
+        idx[m++]=lo;
+      lo--;
+    } else {
+      if(!std::isnan(p.x[hi]))
+        idx[m++]=hi;
+      hi++;
+    }
+  }
+  if(m<ord)
+    return false;
+
+  for(j=0,lo=-1,hi=n;j<ord;j++){ // bracketing samples
+    if(fabs(u-idx[j])<1e-9){
+      xyz[0]=p.x[idx[j]]; xyz[1]=p.y[idx[j]]; xyz[2]=p.z[idx[j]];
+      return true;
+    }
+    if(idx[j]<u)
+      lo=std::max(lo,idx[j]);
+    else
+      hi=std::min(hi,idx[j]);
+  }
+  if(lo<0||hi>=n||hi-lo>SP3_MAXGAP) // would extrapolate or bridge a gap
+    return false;
+
+  for(j=0;j<ord;j++){
+    for(d=1.0,k=0;k<ord;k++)
+      if(k!=j)
+        d*=idx[j]-idx[k];
+    sum+=w[j]=1.0/(d*(u-idx[j]));
+  }
+  xyz[0]=xyz[1]=xyz[2]=0.0;
+  for(j=0;j<ord;j++){
+    xyz[0]+=w[j]/sum*p.x[idx[j]];
+    xyz[1]+=w[j]/sum*p.y[idx[j]];
+    xyz[2]+=w[j]/sum*p.z[idx[j]];
+  }
+  return true;
+}
+
+// satellite k at the time of the last set(), clock NaN if not available
+bool Sp3Interp::eval(int k, double *xyz, double *clk) const
+{
+  const Sp3File::Sat& p=sp3->sat[k];
+  const double *x,*y,*z;
+  double sx=0.0,sy=0.0,sz=0.0,f;
+  int j,n=sp3->t.size();
+
+  *clk=NAN;
+  if(i0<0)
+    return false;
+
+  j=(int)floor(u);
+  f=u-j;
+  if(j>=n-1){ // last epoch
+    j=n-2;
+    f=1.0;
+  }
+  *clk=f<1e-9?p.clk[j]:(f>1.0-1e-9?p.clk[j+1]:
+    (1.0-f)*p.clk[j]+f*p.clk[j+1]);
+
+  x=&p.x[i0]; y=&p.y[i0]; z=&p.z[i0];
+  for(j=0;j<ord;j++){
+    sx+=c[j]*x[j];
+    sy+=c[j]*y[j];
+    sz+=c[j]*z[j];
+  }
+  if(!std::isnan(sx+sy+sz)){
+    xyz[0]=sx; xyz[1]=sy; xyz[2]=sz;
+    return true;
+  }
+  return sparse(p,xyz);
+}
+
+// all satellites, xyz[3*k], clk[k] (NaN: not available), returns valid count
+int Sp3Interp::eval(double *xyz, double *clk) const
+{
+  int k,nv=0;
+
+  for(k=0;k<(int)sp3->sat.size();k++){
+    if(eval(k,xyz+3*k,clk+k)){
+      nv++;
+    } else {
+      xyz[3*k]=xyz[3*k+1]=xyz[3*k+2]=NAN;
+    }
+  }
+  return nv;
+}
+
+bool Sp3Interp::eval(const char *prn, const Time& t, double *xyz, double *clk)
+{
+  int k=sp3->find(prn);
+
+  *clk=NAN;
+  return k>=0&&set(t)&&eval(k,xyz,clk);
+}
@@ -0,0 +1,209 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   spp.cc --Standard point positioning (single frequency code)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include "constants.h"
+
+#define SPP_MINPOS 1e3    // a priori position known (m from the center)
+#define SPP_CONV   1e-4   // position update at convergence (m)
+#define SPP_HUMI   0.7    // relative humidity of the troposphere model
+
+// L1/E1 pseudoranges by preference, of G, E and J
+static const char *const prio[3][9]={
+  {"C1C","C1W","C1P","C1X","C1L","C1S","C1","P1",0},
+  {"C1C","C1X","C1B","C1",0},
+  {"C1C","C1X","C1L","C1S","C1",0}};
+
+static const char spp_sys[]="GEJ";
+
+//////////////////////////////////////////////////////////////////////
+//  Standard point positioning
+
+Spp::Spp(int maxsat)
+  : elmask(15.0*D2R), sigma(0.3), maxiter(10), iono(true), trop(true),
+    cap(0), ncode(-1)
+{
+  sol=SppSol();
+  sol.t=Time(0.0);
+  reserve(maxsat);
+}
+
+// workspace for maxsat satellites (and the rows tying unused clocks)
+void Spp::reserve(int maxsat)
+{
+  if(maxsat<=cap)
+    return;
+  cap=maxsat;
+  xs.resize(3*cap);
+  pr.resize(cap);
+  clk.resize(cap);
+  H.resize((std::size_t)(cap+SPP_NCLK)*SPP_NX);
+  v.resize(cap+SPP_NCLK);
+  w.resize(cap+SPP_NCLK);
+}
+
+// columns are only appended by the readers, a new count remaps them
+void Spp::mapcodes(const std::vector<std::string>& code)
+{
+  int s,k,j,m;
+
+  for(s=0;s<3;s++){
+    for(k=m=0;prio[s][k];k++)
+      for(j=0;j<(int)code.size();j++)
+        if(code[j]==prio[s][k]){
+          pcol[s][m++]=j;
+          break;
+        }
+    pcol[s][m]=-1;
+  }
+  ncode=code.size();
+}
+
+// Satellites with a pseudorange and a broadcast ephemeris, packed from
+// row 0: position and clock at transmission (t-P/c-dts), pseudorange
+// corrected for the satellite clock and group delay of L1/E1
+int Spp::satpos(const ObsEpoch& ep, EphemerisStore& nav)
+{
+  const Nav *e;
+  const char *q;
+  double p,dt,tgd;
+  int i,k,s,ns;
+  Time tt;
+
+  if(ep.n>cap)
+    reserve(ep.n);
+  for(i=ns=0;i<ep.n;i++){
+    if(!ep.prn(i)[0]||!(q=strchr(spp_sys,ep.prn(i)[0])))
+      continue;
+    s=q-spp_sys;
+    p=NAN;
+    for(k=0;pcol[s][k]>=0&&std::isnan(p);k++)
+      p=ep.obs(pcol[s][k],i);
+    if(!(p>0.0)||!(e=nav.select(ep.prn(i),ep.t)))
+      continue;
+    tt=ep.t-p/CLIGHT;
+    e->nav2ecf(tt,&xs[3*ns],&dt);
+    tt-=dt;
+    e->nav2ecf(tt,&xs[3*ns],&dt);
+    if(s==1) // BGD of the clock pair: E5b/E1 (I/NAV) or E5a/E1 (F/NAV)
+      tgd=e->code>>9&1?e->tgd[1]:e->tgd[0];
+    else
+      tgd=e->tgd[0];
+    pr[ns]=p+CLIGHT*(dt-tgd);
+    clk[ns]=s==1?1:0;
+    ns++;
+  }
+  return ns;
+}
+
+// Residuals and design rows at x of the satellites above the mask (mask,
+// ionosphere and troposphere once the position is known); rows tying
+// the clocks without satellites to 0 follow. Returns the satellites.
+int Spp::resid(const double *x, int ns, const Time& t, int *nrow)
+{
+  double geo[3],los[3],azel[2],r,el,se,dion,dtrp,*h;
+  int i,k,m,nc[SPP_NCLK]={0};
+  bool known=x[0]*x[0]+x[1]*x[1]+x[2]*x[2]>SPP_MINPOS*SPP_MINPOS;
+
+  if(known){
+    ell.ecf2geo(x,geo);
+    geo[0]*=D2R;
+    geo[1]*=D2R;
+  }
+  for(i=m=0;i<ns;i++){
+    r=geomdist(&xs[3*i],x,los);
+    dion=dtrp=0.0;
+    el=PI2;
+    if(known){
+      if((el=satazel(geo,los,azel))<elmask)
+        continue;
+      if(iono)
+        dion=klob.ionmod(t,geo,azel);
+      if(trop&&geo[2]>-1e3&&geo[2]<1e4)
+        dtrp=tropmod(geo,azel,SPP_HUMI);
+    }
+    h=&H[(std::size_t)m*SPP_NX];
+    h[0]=-los[0];
+    h[1]=-los[1];
+    h[2]=-los[2];
+    for(k=0;k<SPP_NCLK;k++)
+      h[3+k]=k==clk[i]?1.0:0.0;
+    v[m]=pr[i]-(r+x[3+clk[i]]+dion+dtrp);
+    se=sin(el);
+    w[m]=1.0/(sigma*sigma*(1.0+1.0/(se*se))+0.25*dion*dion);
+    nc[clk[i]]++;
+    m++;
+  }
+  *nrow=m;
+  for(k=0;k<SPP_NCLK;k++)
+    if(!nc[k]){
+      h=&H[(std::size_t)(*nrow)*SPP_NX];
+      for(i=0;i<SPP_NX;i++)
+        h[i]=i==3+k?1.0:0.0;
+      v[*nrow]=-x[3+k];
+      w[*nrow]=1.0;
+      (*nrow)++;
+    }
+  return m;
+}
+
+// Iterated from the last solution (or the center of the earth), until
+// the position update is below 0.1 mm. The solution needs as many
+// satellites as parameters with satellites (3 + clocks).
+bool Spp::solve(const ObsEpoch& ep, const std::vector<std::string>& code,
+  EphemerisStore& nav)
+{
+  double x[SPP_NX]={0},dx[SPP_NX],Q0[SPP_NX*SPP_NX],s;
+  int k,ns,m,nrow,it;
+
+  if((int)code.size()!=ncode)
+    mapcodes(code);
+  if(sol.ok){
+    for(k=0;k<3;k++)
+      x[k]=sol.pos[k];
+    for(k=0;k<SPP_NCLK;k++)
+      x[3+k]=sol.clk[k];
+  }
+  sol.t=ep.t;
+  sol.ok=false;
+  sol.nsat=sol.niter=0;
+  if((ns=satpos(ep,nav))<4)
+    return false;
+
+  for(it=0;it<maxiter;it++){
+    m=resid(x,ns,ep.t,&nrow);
+    if(m<3+SPP_NCLK-(nrow-m)||!lsq(&H[0],&v[0],&w[0],nrow,SPP_NX,dx,sol.Q))
+      return false;
+    for(k=0;k<SPP_NX;k++)
+      x[k]+=dx[k];
+    if(dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2]<SPP_CONV*SPP_CONV)
+      break;
+  }
+  sol.niter=it<maxiter?it+1:maxiter;
+  if(it==maxiter){
+#ifdef DEBUG
+    warn("no convergence");
+#endif
+    return false;
+  }
+
+  // post-fit residuals, PDOP of the unweighted geometry
+  m=resid(x,ns,ep.t,&nrow);
+  if(m<3+SPP_NCLK-(nrow-m)||!lsq(&H[0],&v[0],0,nrow,SPP_NX,dx,Q0))
+    return false;
+  for(k=0,s=0.0;k<m;k++)
+    s+=v[k]*v[k];
+  sol.rms=sqrt(s/m);
+  sol.pdop=sqrt(Q0[0]+Q0[SPP_NX+1]+Q0[2*SPP_NX+2]);
+  for(k=0;k<3;k++)
+    sol.pos[k]=x[k];
+  for(k=0;k<SPP_NCLK;k++)
+    sol.clk[k]=x[3+k];
+  ell.ecf2geo(sol.pos,sol.geo);
+  sol.nsat=m;
+  sol.ok=true;
+  return true;
+}
@@ -0,0 +1,582 @@
+// ---------------------------------------------------------------------------
+//   bench.cc --Microbenchmarks (make bench), not part of the test suite
+// ---------------------------------------------------------------------------
+
+#include "../kepler.h"
+#include "../constants.h"
+#include <chrono>
+#include <thread>
+
+typedef std::chrono::steady_clock bclock;
+
+static double elapsed_ns(bclock::time_point t0, long n)
+{
+  return std::chrono::duration<double,std::nano>(bclock::now()-t0).count()/n;
+}
+
+// previous Nav::rnx2nav field path: copy, fix exponent, strtod
+static double fixflt_strtod(const char *s)
+{
+  char buf[20]={0};
+  strncpy(buf,s,19);
+  for(char *p=buf;*p;p++)
+    *p=(*p=='D'||*p=='d')?'E':*p;
+  return strtod(buf,0);
+}
+
+static void bench_strnflt()
+{
+  const int n=1<<16, reps=20;
+  std::vector<char> txt(n*19+1);
+  double sum0=0.0,sum1=0.0;
+  char buf[24];
+  
+  srand(1);
+  for(int i=0;i<n;i++){
+    snprintf(buf,sizeof(buf),"%19.12E",
+      (rand()/(double)RAND_MAX-0.5)*pow(10.0,rand()%20-10));
+    buf[15]='D';
+    memcpy(&txt[i*19],buf,19);
+  }
+  
+  bclock::time_point t0=bclock::now();
+  for(int r=0;r<reps;r++)
+    for(int i=0;i<n;i++)
+      sum0+=fixflt_strtod(&txt[i*19]);
+  double t_old=elapsed_ns(t0,(long)n*reps);
+  
+  t0=bclock::now();
+  for(int r=0;r<reps;r++)
+    for(int i=0;i<n;i++)
+      sum1+=strnflt(&txt[i*19],19);
+  double t_new=elapsed_ns(t0,(long)n*reps);
+  
+  std::cout<<std::fixed<<std::setprecision(1);
+  std::cout<<"[strnflt] D19.12 field: fixflt+strtod "<<t_old<<" ns, ";
+  std::cout<<"strnflt "<<t_new<<" ns"<<(sum0==sum1?"":" (MISMATCH)")<<std::endl;
+}
+
+static void bench_navsoa()
+{
+  const int nsat=128, reps=2000;
+  NavFile f;
+  std::vector<Nav> eph;
+  std::vector<Time> t(nsat);
+  std::vector<double> x(nsat),y(nsat),z(nsat),clk(nsat);
+  double xyz[3],dts,sum0=0.0,sum1=0.0;
+  NavSoA soa;
+  
+  f.read("./data/rinex304.nav");
+  for(int i=0;i<nsat;i++){
+    eph.push_back(f.eph[i%f.eph.size()]);
+    t[i]=eph[i].toe+(i*37.0-1800.0);
+  }
+  soa.set(eph);
+  
+  bclock::time_point t0=bclock::now();
+  for(int r=0;r<reps;r++)
+    for(int i=0;i<nsat;i++){
+      eph[i].nav2ecf(t[i],xyz,&dts);
+      sum0+=xyz[0];
+    }
+  double t_old=elapsed_ns(t0,(long)nsat*reps);
+  
+  std::vector<NavPrep> prep(eph.begin(),eph.end());
+  double sum2=0.0;
+  t0=bclock::now();
+  for(int r=0;r<reps;r++)
+    for(int i=0;i<nsat;i++){
+      prep[i].nav2ecf(t[i],xyz,&dts);
+      sum2+=xyz[0];
+    }
+  double t_prep=elapsed_ns(t0,(long)nsat*reps);
+  
+  t0=bclock::now();
+  for(int r=0;r<reps;r++){
+    soa.nav2ecf(&t[0],&x[0],&y[0],&z[0],&clk[0]);
+    for(int i=0;i<nsat;i++)
+      sum1+=x[i];
+  }
+  double t_new=elapsed_ns(t0,(long)nsat*reps);
+  
+  std::cout<<std::fixed<<std::setprecision(1);
+  std::cout<<"[NavSoA] satellite position: Nav::nav2ecf "<<t_old<<" ns, ";
+  std::cout<<"NavPrep::nav2ecf "<<t_prep<<" ns ("<<sizeof(NavPrep)<<" of ";
+  std::cout<<sizeof(Nav)<<" bytes), NavSoA::nav2ecf "<<t_new<<" ns";
+  std::cout<<(fabs(sum0-sum1)<1.0&&fabs(sum0-sum2)<1.0?"":" (MISMATCH)")<<std::endl;
+}
+
+// fit of each record of the test file, error over its whole window
+static void bench_cheb()
+{
+  const int reps=50;
+  NavFile f;
+  double xyz[3],dts,sum0=0.0,sum1=0.0;
+  
+  f.read("./data/rinex304.nav");
+  for(const auto& eph: f.eph){
+    Cheb cheb;
+    double half=eph.prn[0]=='E'?14400.0:7200.0,e=0.0,ec=0.0;
+    
+    bclock::time_point t0=bclock::now();
+    cheb.fit(eph,1e-4);
+    double t_fit=elapsed_ns(t0,1)*1e-3;
+    
+    for(double dt=-half;dt<=half;dt+=1.0){
+      double a[3],b[3],da,db;
+      eph.nav2ecf(eph.toe+dt,a,&da);
+      cheb.eval(eph.toe+dt,b,&db);
+      e =std::max(e,pythag(a[0]-b[0],a[1]-b[1],a[2]-b[2]));
+      ec=std::max(ec,fabs(da-db));
+    }
+    
+    t0=bclock::now();
+    for(int r=0;r<reps;r++)
+      for(double dt=-half;dt<=half;dt+=10.0){
+        eph.nav2ecf(eph.toe+dt,xyz,&dts);
+        sum0+=xyz[0];
+      }
+    double t_nav=elapsed_ns(t0,(long)reps*(int)(2*half/10+1));
+    
+    t0=bclock::now();
+    for(int r=0;r<reps;r++)
+      for(double dt=-half;dt<=half;dt+=10.0){
+        cheb.eval(eph.toe+dt,xyz,&dts);
+        sum1+=xyz[0];
+      }
+    double t_cheb=elapsed_ns(t0,(long)reps*(int)(2*half/10+1));
+    
+    std::cout<<std::setprecision(1);
+    std::cout<<"[Cheb] "<<eph.prn<<" +-"<<half/3600<<" h, "<<cheb.segments();
+    std::cout<<" segments, fit "<<t_fit<<" us, max error "<<std::setprecision(3);
+    std::cout<<e*1e6<<" um "<<ec*1e15<<" fs; Nav::nav2ecf "<<std::setprecision(1);
+    std::cout<<t_nav<<" ns, Cheb::eval "<<t_cheb<<" ns";
+    std::cout<<(fabs(sum0-sum1)<1.0?"":" (MISMATCH)")<<std::endl;
+  }
+}
+
+static void bench_navcache()
+{
+  const char *tmp="./navcache.tmp";
+  const int reps=50;
+  std::string txt;
+  NavFile f;
+  NavCache c;
+  std::vector<Nav> eph;
+  Mem m;
+  
+  m.load("./data/rinex304.nav");
+  txt.assign(m.data(),m.size());
+  for(int i=0;i<12;i++) // 8192 records
+    txt.append(txt.substr(txt.find("G01 2024")));
+  
+  bclock::time_point t0=bclock::now();
+  for(int r=0;r<reps;r++)
+    f.read(txt.data(),txt.size(),1);
+  double t_rnx=elapsed_ns(t0,reps)*1e-3;
+  
+  NavCache::save(tmp,f.eph);
+  t0=bclock::now();
+  for(int r=0;r<reps;r++){
+    c.load(tmp);
+    c.get(eph);
+  }
+  double t_bin=elapsed_ns(t0,reps)*1e-3;
+  remove(tmp);
+  
+  std::cout<<std::fixed<<std::setprecision(1);
+  std::cout<<"[NavCache] "<<f.eph.size()<<" records: NavFile::read "<<t_rnx;
+  std::cout<<" us, NavCache::load+get "<<t_bin<<" us";
+  std::cout<<(eph.size()==f.eph.size()?"":" (MISMATCH)")<<std::endl;
+  
+  { // lazy view: index, then two satellites selected
+    NavView v;
+    Time t;
+    const Nav *a=0;
+    
+    t.from_rnx("2024 07 15 22 30 00");
+    t0=bclock::now();
+    for(int r=0;r<reps;r++){
+      v.open(txt.data(),txt.size());
+      a=v.select("G01",t);
+      v.select("E02",t);
+    }
+    double t_view=elapsed_ns(t0,reps)*1e-3;
+    std::cout<<"[NavView] "<<v.size()<<" records: open+select "<<t_view;
+    std::cout<<" us, "<<v.decoded()<<" decoded"<<(a?"":" (MISSING)")<<std::endl;
+  }
+}
+
+static void bench_sp3()
+{
+  const int reps=20;
+  Sp3File sp3;
+  Mem m;
+  
+  m.load("./data/2024_197_sp3.txt");
+  bclock::time_point t0=bclock::now();
+  for(int r=0;r<reps;r++)
+    sp3.read(m.data(),m.size(),1);
+  double t1=elapsed_ns(t0,reps)*1e-6;
+  t0=bclock::now();
+  for(int r=0;r<reps;r++)
+    sp3.read(m.data(),m.size());
+  double tn=elapsed_ns(t0,reps)*1e-6;
+  
+  std::cout<<std::fixed<<std::setprecision(1);
+  std::cout<<"[Sp3File] "<<sp3.size()<<" epochs x "<<sp3.sat.size()<<" sats (";
+  std::cout<<m.size()/1024<<" KiB): 1 thread "<<t1<<" ms, ";
+  std::cout<<std::thread::hardware_concurrency()<<" threads "<<tn<<" ms"<<std::endl;
+}
+
+static void bench_sp3interp()
+{
+  const int nep=2000;
+  Sp3File sp3;
+  std::vector<double> xyz,clk;
+  double sum=0.0;
+  int nv=0;
+  
+  sp3.read("./data/2024_197_sp3.txt");
+  Sp3Interp itp(sp3,10);
+  xyz.resize(3*sp3.sat.size());
+  clk.resize(sp3.sat.size());
+  
+  bclock::time_point t0=bclock::now();
+  for(int i=0;i<nep;i++){ // 30 s steps
+    itp.set(sp3.t[0]+i*30.0+0.123);
+    nv+=itp.eval(&xyz[0],&clk[0]);
+    sum+=xyz[0];
+  }
+  double t1=elapsed_ns(t0,nv);
+  
+  std::cout<<std::fixed<<std::setprecision(1);
+  std::cout<<"[Sp3Interp] order 10, weights shared by "<<sp3.sat.size();
+  std::cout<<" sats: "<<t1<<" ns per satellite"<<(sum!=0.0?"":" (?)")<<std::endl;
+}
+
+static double bench_obsparse(const std::string& txt, const ObsSelect *sel, long *nv)
+{
+  ObsFile obs;
+  ObsEpoch ep;
+  
+  if(sel)
+    obs.select(*sel);
+  obs.open(txt.data(),txt.size());
+  bclock::time_point t0=bclock::now();
+  for(*nv=0;obs.next(ep);)
+    *nv+=(long)ep.n*ep.ncol;
+  return elapsed_ns(t0,1)*1e-6;
+}
+
+static void bench_obs()
+{
+  Mem m;
+  ObsSelect sel;
+  std::string txt,rec;
+  std::size_t k;
+  char buf[64];
+  long nv;
+  int i,ne;
+  double t;
+  
+  m.load("./data/rinex304.obs");
+  txt.assign(m.data(),m.size());
+  k=txt.find("> 2024");
+  rec=txt.substr(txt.find('\n',k)+1,txt.find("> 2024",k+1)-txt.find('\n',k)-1);
+  txt.resize(k);
+  for(ne=0;txt.size()<(32<<20);ne++){ // one epoch record every 30 s
+    snprintf(buf,sizeof(buf),"> 2024 07 %02d %02d %02d %2d.0000000  0  8\n",
+      15+ne/2880,ne/120%24,ne/2%60,30*(ne%2));
+    txt+=buf;
+    txt+=rec;
+  }
+  
+  std::cout<<std::fixed<<std::setprecision(1);
+  t=bench_obsparse(txt,0,&nv);
+  std::cout<<"[ObsFile] RINEX 3, "<<ne<<" epochs, all fields: "<<t<<" ms ("<<nv<<" values)"<<std::endl;
+  sel.sys="GE";
+  sel.code={"C1C","L1C"};
+  t=bench_obsparse(txt,&sel,&nv);
+  std::cout<<"[ObsFile] GPS+Galileo C1C L1C: "<<t<<" ms ("<<nv<<" values)"<<std::endl;
+  sel.window=true; // third quarter of the file
+  sel.beg.from_rnx("2024 07 15 00 00  0.0000000");
+  sel.beg+=15.0*ne;
+  sel.end=sel.beg+7.5*ne;
+  t=bench_obsparse(txt,&sel,&nv);
+  std::cout<<"[ObsFile] same, 1/4 of the epochs: "<<t<<" ms ("<<nv<<" values)"<<std::endl;
+
+  { // time index: seek to the window, and slices read in parallel
+    ObsIndex ix;
+    ObsFile obs;
+    ObsEpoch ep;
+    std::vector<std::size_t> k;
+    std::vector<std::thread> pool;
+    std::vector<long> ns;
+    
+    bclock::time_point t0=bclock::now();
+    ix.build(txt.data(),txt.size());
+    t=elapsed_ns(t0,1)*1e-6;
+    std::cout<<"[ObsIndex] built, "<<ix.mark.size()<<" marks: "<<t<<" ms"<<std::endl;
+    obs.select(sel);
+    obs.open(txt.data(),txt.size());
+    t0=bclock::now();
+    obs.seek(ix,sel.beg);
+    for(nv=0;obs.next(ep);)
+      nv+=(long)ep.n*ep.ncol;
+    t=elapsed_ns(t0,1)*1e-6;
+    std::cout<<"[ObsIndex] same 1/4, seeked: "<<t<<" ms ("<<nv<<" values)"<<std::endl;
+    
+    ix.slices(std::thread::hardware_concurrency(),k);
+    ns.assign(k.size(),0);
+    t0=bclock::now();
+    for(i=0;i+1<(int)k.size();i++)
+      pool.emplace_back([&,i](){
+        ObsFile o;
+        ObsEpoch e;
+        o.open(txt.data(),txt.size());
+        o.seek(ix.mark[k[i]].raw);
+        while(o.tell()<ix.mark[k[i+1]].raw&&o.next(e))
+          ns[i]+=(long)e.n*e.ncol;
+      });
+    for(auto& th: pool)
+      th.join();
+    t=elapsed_ns(t0,1)*1e-6;
+    for(nv=0,i=0;i<(int)ns.size();i++)
+      nv+=ns[i];
+    std::cout<<"[ObsIndex] all fields, "<<k.size()-1<<" slices: "<<t<<" ms ("<<nv<<" values)"<<std::endl;
+  }
+
+  { // same epochs as Compact RINEX
+    ObsFile obs;
+    ObsEpoch ep;
+    CrxWriter w;
+    Mem crx;
+    std::string ctxt;
+    
+    obs.open(txt.data(),txt.size());
+    bclock::time_point t0=bclock::now();
+    w.open("./crx.tmp",obs,3);
+    while(obs.next(ep))
+      w.write(ep);
+    w.close();
+    t=elapsed_ns(t0,1)*1e-6;
+    crx.load("./crx.tmp");
+    ctxt.assign(crx.data(),crx.size());
+    remove("./crx.tmp");
+    std::cout<<"[CrxWriter] RINEX 3 read and written as CRINEX 3.0 ("<<(ctxt.size()>>20)<<" MiB): "<<t<<" ms"<<std::endl;
+    t=bench_obsparse(ctxt,0,&nv);
+    std::cout<<"[ObsFile] CRINEX 3.0, all fields: "<<t<<" ms ("<<nv<<" values)"<<std::endl;
+  }
+#ifdef HAVE_ZLIB
+
+  { // one hour out of a blocked gzip archive against inflating it all
+    ObsArchive arc;
+    Mem z,w;
+    FILE *fp;
+    
+    fp=fopen("./obs.tmp","wb");
+    fwrite(txt.data(),1,txt.size(),fp);
+    fclose(fp);
+    bclock::time_point t0=bclock::now();
+    ObsArchive::write("./obs.tmp","./arc.tmp.gz");
+    t=elapsed_ns(t0,1)*1e-6;
+    arc.open("./arc.tmp.gz");
+    std::cout<<"[ObsArchive] written, "<<arc.index().mark.size()-1<<" members: "<<t<<" ms"<<std::endl;
+    z.load("./arc.tmp.gz");
+    t0=bclock::now();
+    w=z.gz_decode();
+    t=elapsed_ns(t0,1)*1e-6;
+    std::cout<<"[ObsArchive] inflate all ("<<(w.size()>>20)<<" MiB): "<<t<<" ms"<<std::endl;
+    t0=bclock::now();
+    arc.read(sel.beg,sel.beg+3600.0,w);
+    t=elapsed_ns(t0,1)*1e-6;
+    std::cout<<"[ObsArchive] one hour window ("<<(w.size()>>10)<<" KiB): "<<t<<" ms"<<std::endl;
+    remove("./obs.tmp");
+    remove("./arc.tmp.gz");
+    remove("./arc.tmp.gz.idx");
+  }
+#endif
+}
+
+// synthetic RXM-RAWX log: one hour at 1 Hz, 32 satellites x 2 signals
+static void bench_ubx()
+{
+  std::string log,p;
+  UbxReader u;
+  ObsEpoch ep;
+  Nav eph;
+  uint8_t a,b;
+  long ne=0,nv=0;
+  
+  for(int k=0;k<3600;k++){
+    double tow=k,v;
+    uint16_t wk=2323;
+    p.assign(16+32*64,'\0');
+    memcpy(&p[0],&tow,8);
+    memcpy(&p[8],&wk,2);
+    p[11]=64;
+    for(int j=0;j<64;j++){
+      char *m=&p[16+32*j];
+      v=2e7+1e3*j+k;      memcpy(m,&v,8);
+      v=1e8+5e3*j+5.2*k;  memcpy(m+8,&v,8);
+      m[20]=j<32?0:2;
+      m[21]=j%32+1;
+      m[22]=j&1?(j<32?3:5):0;
+      m[26]=40;
+      m[30]=7;
+    }
+    log+=std::string("\xB5\x62\x02\x15",4);
+    log+=(char)(p.size()&0xff);
+    log+=(char)(p.size()>>8);
+    log+=p;
+    a=b=0;
+    for(std::size_t i=log.size()-p.size()-4;i<log.size();i++){
+      a+=(uint8_t)log[i];
+      b+=a;
+    }
+    log+=(char)a;
+    log+=(char)b;
+  }
+  
+  bclock::time_point t0=bclock::now();
+  u.open(log.data(),log.size());
+  while(u.next(ep,eph)==UBX_RAWX){
+    ne++;
+    nv+=ep.n;
+  }
+  double t=elapsed_ns(t0,1)*1e-6;
+  std::cout<<"[UbxReader] RAWX "<<ne<<" epochs, "<<nv<<" satellites ("<<(log.size()>>20);
+  std::cout<<" MiB): "<<t<<" ms, "<<log.size()/t*1e-3<<" MB/s"<<std::endl;
+}
+
+// synthetic RTCM 3 stream: one hour at 1 Hz, MSM7 of 12 GPS and 10
+// Galileo satellites x 2 signals
+static void bench_rtcm()
+{
+  std::string log;
+  RtcmReader u;
+  ObsEpoch ep;
+  Nav eph;
+  long ne=0,nv=0;
+  
+  for(int k=0;k<3600;k++)
+    for(int s=0;s<2;s++){
+      uint8_t b[1024]={0};
+      int n=0,nsat=s?10:12,ncell=2*nsat;
+      auto put=[&](int len, uint64_t v){
+        for(int i=n+len-1;i>=n;i--,v>>=1)
+          if(v&1)
+            b[i>>3]|=1<<(7-(i&7));
+        n+=len;
+      };
+      put(12,s?1097:1077); put(12,1); put(30,k*1000); put(1,!s); put(18,0);
+      put(64,((1ull<<nsat)-1)<<(64-nsat)); put(32,s?0x40000400:0x40010000);
+      put(ncell,(1ull<<ncell)-1);
+      for(int j=0;j<nsat;j++) put(8,70+j);
+      for(int j=0;j<nsat;j++) put(4,15);
+      for(int j=0;j<nsat;j++) put(10,300+j);
+      for(int j=0;j<nsat;j++) put(14,j*50);
+      for(int j=0;j<ncell;j++) put(20,1000*j+k);
+      for(int j=0;j<ncell;j++) put(24,2000*j+k);
+      for(int j=0;j<ncell;j++) put(10,k);
+      for(int j=0;j<ncell;j++) put(1,0);
+      for(int j=0;j<ncell;j++) put(10,700);
+      for(int j=0;j<ncell;j++) put(15,j);
+      
+      std::string f(3,'\0');
+      uint32_t c=0;
+      f[0]=(char)0xD3;
+      f[1]=(char)((n+7)/8>>8);
+      f[2]=(char)((n+7)/8&0xff);
+      f.append((const char*)b,(n+7)/8);
+      for(std::size_t i=0;i<f.size();i++){
+        c^=(uint32_t)(uint8_t)f[i]<<16;
+        for(int q=0;q<8;q++)
+          c=c&0x800000?(c<<1)^0x1864CFB:c<<1;
+      }
+      f+=(char)(c>>16);
+      f+=(char)(c>>8);
+      f+=(char)c;
+      log+=f;
+    }
+  
+  u.tref.from_gps(2323,0.0);
+  bclock::time_point t0=bclock::now();
+  u.open(log.data(),log.size());
+  while(u.next(ep,eph)==RTCM_OBS){
+    ne++;
+    nv+=ep.n;
+  }
+  double t=elapsed_ns(t0,1)*1e-6;
+  std::cout<<"[RtcmReader] MSM7 "<<ne<<" epochs, "<<nv<<" satellites ("<<(log.size()>>10);
+  std::cout<<" KiB): "<<t<<" ms, "<<t*1e3/ne<<" us/epoch"<<std::endl;
+}
+
+// warm started solutions of a 24 satellite GPS constellation (spread
+// from G01), observations precomputed
+static void bench_spp()
+{
+  const double ref[3]={-23.5505,-46.6333,760.0};
+  const int ne=1000;
+  NavFile f;
+  EphemerisStore nav;
+  Spheroid ell;
+  Spp spp;
+  std::vector<ObsEpoch> ep(ne);
+  std::vector<std::string> code={"C1C"};
+  double rec[3],xs[3],los[3],dts,sum=0.0;
+  char prn[8];
+  long nv=0;
+  
+  f.read("./data/rinex304.nav");
+  for(int k=0;k<24;k++){
+    Nav a=f.eph[0];
+    a.OMG0+=(k/4)*PI/3.0;
+    a.M0+=(k%4)*PI/2.0+(k/4)*0.3;
+    snprintf(prn,sizeof(prn),"G%02d",k+1);
+    memcpy(a.prn,prn,4);
+    nav.add(a);
+  }
+  ell.geo2ecf(ref,rec);
+  for(int j=0;j<ne;j++){
+    Time t=f.eph[0].toe+(double)j;
+    ep[j].t=t;
+    ep[j].resize(1,24);
+    ep[j].clear(24);
+    ep[j].n=24;
+    for(int k=0;k<24;k++){
+      snprintf(prn,sizeof(prn),"G%02d",k+1);
+      const Nav *e=nav.select(prn,t);
+      e->nav2ecf(t-0.075,xs,&dts);
+      memcpy(&ep[j].sat[4*k],prn,4);
+      ep[j].val[k]=geomdist(xs,rec,los)-CLIGHT*dts;
+    }
+  }
+  
+  spp.solve(ep[0],code,nav);
+  bclock::time_point t0=bclock::now();
+  for(int j=0;j<ne;j++){
+    spp.solve(ep[j],code,nav);
+    nv+=spp.sol.nsat;
+    sum+=spp.sol.niter;
+  }
+  double t=elapsed_ns(t0,ne);
+  std::cout<<"[Spp] "<<(double)nv/ne<<" satellites, "<<sum/ne<<" iterations: ";
+  std::cout<<t*1e-3<<" us/epoch"<<std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  bench_strnflt();
+  bench_navsoa();
+  bench_cheb();
+  bench_navcache();
+  bench_sp3();
+  bench_sp3interp();
+  bench_obs();
+  bench_ubx();
+  bench_rtcm();
+  bench_spp();
+  return 0;
+}
@@ -1,5 +1,33 @@
 
 #include "test.h"
+#include <new>
+
+// operator new counts only while a test switches it on, otherwise it is
+// the plain malloc of the library
+static thread_local bool counting=false;
+static thread_local long nalloc=0;
+
+void count_allocs(bool on)
+{
+  counting=on;
+  if(on)
+    nalloc=0;
+}
+
+long allocs(){ return nalloc; }
+
+void *operator new(std::size_t n)
+{
+  void *p;
+  if(counting)
+    nalloc++;
+  if(!(p=malloc(n?n:1)))
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept{ free(p); }
+void operator delete(void *p, std::size_t) noexcept{ free(p); }
 
 void fail_(const char *from, const char *msg)
 {
@@ -33,5 +61,37 @@ int main(int argc, char **argv)
   test_atmosphere();
   std::cout<<"all tests run successfully"<<std::endl;
   
+  std::cout<<"[RINEX] ";
+  test_rinex();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
+  std::cout<<"[ORBIT] ";
+  test_orbit();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
+  std::cout<<"[SP3] ";
+  test_sp3();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
+  std::cout<<"[CLOCK] ";
+  test_clock();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
+  std::cout<<"[OBS] ";
+  test_obs();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
+  std::cout<<"[UBX] ";
+  test_ubx();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
+  std::cout<<"[RTCM] ";
+  test_rtcm();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
+  std::cout<<"[SPP] ";
+  test_spp();
+  std::cout<<"all tests run successfully"<<std::endl;
+  
   return 0;
 }
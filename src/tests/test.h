@@ -7,11 +7,23 @@
 void fail_(const char *from, const char *msg);
 #define fail(x) fail_(__PRETTY_FUNCTION__, x)
 
+// heap allocations of the current thread while counting is on
+void count_allocs(bool on);
+long allocs();
+
 void test_core();
 void test_time();
 void test_spheroid();
 void test_math();
 void test_ephemeris();
 void test_atmosphere();
+void test_rinex();
+void test_orbit();
+void test_sp3();
+void test_clock();
+void test_obs();
+void test_ubx();
+void test_rtcm();
+void test_spp();
 
 #endif 
@@ -0,0 +1,108 @@
+#include "test.h"
+
+static void test_clkfile()
+{
+  const double a=2.418283010000e-04, b=1.0e-11; // G01: a+b*(t-t0)
+  
+  { // RINEX clock 3.00, satellites only
+    ClkFile clk;
+    double dts;
+    int k;
+    
+    if(!clk.read("./data/clk300.clk"))
+      fail("could not read clock file");
+    if(fabs(clk.ver-3.0)>1e-9||strcmp(clk.tsys,"GPS")||clk.leaps!=18)
+      fail("wrong clock file header");
+    if(clk.dt!=30.0||clk.nep!=20||clk.sat.size()!=4||clk.rcv.size()!=0)
+      fail("wrong clock grid");
+    if(clk.t0.to_double()!=Time().from_rnx("2024 07 15 00 00  0.000000").to_double())
+      fail("wrong first clock epoch");
+    if((k=clk.find("E11"))<0||strcmp(clk.sat[k].name,"E11")||clk.find("G03")>=0)
+      fail("wrong clock satellites");
+    
+    if(!clk.satclk("G01",clk.t0+90.0,&dts)||fabs(dts-(a+b*90.0))>1e-18)
+      fail("wrong clock on a grid epoch");
+    if(!clk.satclk("G01",clk.t0+101.5,&dts)||fabs(dts-(a+b*101.5))>1e-18)
+      fail("wrong clock interpolation");
+    if(!clk.satclk("G02",clk.t0+225.0,&dts)|| // epochs 7 and 8 missing
+       fabs(dts-(-3.989207750000e-04-2.0e-12*225.0))>1e-18)
+      fail("wrong clock interpolation across missing epochs");
+    if(!clk.satclk("R05",clk.t0+30.0,&dts)||fabs(dts-5.3e-05)>1e-18)
+      fail("wrong clock on a coarser grid");
+    if(!clk.satclk("E11",clk.t0+150.0,&dts)||
+       fabs(dts-(-6.121458000000e-04+3.0e-12*150.0))>1e-18)
+      fail("wrong clock record with continuation line");
+    if(clk.satclk("G01",clk.t0-1.0,&dts)||clk.satclk("G01",clk.t0+571.0,&dts))
+      fail("clock extrapolated outside the file");
+    if(clk.satclk("R05",clk.t0+569.0,&dts))
+      fail("clock extrapolated past the last sample");
+  }
+  
+  { // RINEX clock 3.04 (9-character names) with receiver clocks
+    ClkFile c0,c4;
+    double d0,d4;
+    
+    c0.read("./data/clk300.clk",true);
+    if(!c4.read("./data/clk304.clk",true))
+      fail("could not read clock file");
+    if(c4.nep!=20||c4.sat.size()!=4||c4.rcv.size()!=2||c0.rcv.size()!=2||
+       strcmp(c4.rcv[1].name,"NRC100CAN")||strcmp(c0.rcv[1].name,"NRC1"))
+      fail("wrong receiver clocks");
+    if(!c4.rcvclk("ALGO00CAN",c4.t0+45.0,&d4)||!c0.rcvclk("ALGO",c0.t0+45.0,&d0)||
+       d0!=d4||fabs(d4-(1.234567890123E-08+1.0e-10*45.0))>1e-20)
+      fail("wrong receiver clock");
+    for(std::size_t k=0;k<c4.sat.size();k++)
+      if(memcmp(&c0.sat[k].bias[0],&c4.sat[k].bias[0],20*sizeof(double)))
+        fail("RINEX clock 3.00 and 3.04 differ");
+  }
+  
+  { // a record out of time order is skipped
+    Mem m;
+    ClkFile clk;
+    std::string txt;
+    double dts;
+    
+    m.load("./data/clk300.clk");
+    txt.assign(m.data(),m.size());
+    txt+="AS G01  2024 07 15 00 01  0.000000  2    9.000000000000E-04  1.000000000000E-11\n";
+    if(!clk.read(txt.data(),txt.size())||clk.nep!=20||clk.dt!=30.0||
+       !clk.satclk("G01",clk.t0+60.0,&dts)||fabs(dts-(a+b*60.0))>1e-18)
+      fail("clock record out of order not skipped");
+  }
+  
+  { // parallel decoding gives the same grid
+    Mem m;
+    ClkFile a,b;
+    std::string txt,body,rec;
+    std::size_t p;
+    
+    m.load("./data/clk300.clk");
+    txt.assign(m.data(),m.size());
+    p=txt.find("END OF HEADER\n")+14;
+    body=txt.substr(p);
+    txt.resize(p);
+    for(int h=0;h<24;h++) // one day, 28800 records
+      for(int i=0;i<6;i++){
+        rec=body;
+        for(std::size_t q=0;(q=rec.find("2024 07 15 00 ",q))!=std::string::npos;q+=14){
+          char hm[16];
+          snprintf(hm,sizeof(hm),"%02d %02d",h,i*10+(rec[q+14]-'0')*10+rec[q+15]-'0');
+          rec.replace(q+11,5,hm);
+        }
+        txt+=rec;
+      }
+    
+    a.read(txt.data(),txt.size(),false,1);
+    b.read(txt.data(),txt.size(),false,4);
+    if(a.nep!=2880||b.nep!=2880)
+      fail("wrong clock grid");
+    for(std::size_t k=0;k<a.sat.size();k++)
+      if(memcmp(&a.sat[k].bias[0],&b.sat[k].bias[0],2880*sizeof(double)))
+        fail("parallel clock decoding differs");
+  }
+}
+
+void test_clock()
+{
+  test_clkfile();
+}
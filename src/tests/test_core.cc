@@ -1,5 +1,7 @@
-
 #include "test.h"
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 void test_core()
 {  
@@ -10,4 +12,207 @@ void test_core()
     if(f.size()!=44)
       fail("different file size");
   }
+  
+  {
+    Mem f,g;
+    char buf[8];
+    f.load("./data/dummy.txt");
+    
+    if(!g.mmap("./data/dummy.txt"))
+      fail("could not map file");
+    if(g.size()!=f.size())
+      fail("different mapped file size");
+    if(memcmp(f.data(),g.data(),f.size()))
+      fail("different mapped file contents");
+    
+    g.seek(0);
+    if(g.read(buf,8)!=8||memcmp(buf,"libkeple",8))
+      fail("wrong read from mapped file");
+    
+    Mem h(g); // copy of a mapping owns its data
+    if(h.mapped()||h.size()!=g.size()||h.tell()!=8)
+      fail("wrong copy of mapped file");
+    
+    g.seek(0).write("L",1);
+    if(g.mapped()||g.data()[0]!='L'||f.data()[0]!='l')
+      fail("write to mapped file should detach the mapping");
+  }
+  
+  { // writable access detaches a mapping, read access does not
+    Mem g;
+    
+    if(!g.mmap("./data/dummy.txt")||std::as_const(g).data()[0]!='l'||!g.mapped())
+      fail("could not map file");
+    g.data()[0]='L';
+    if(g.mapped()||std::as_const(g).data()[0]!='L')
+      fail("writable access should detach the mapping");
+    if(g.mmap("./data/nonexistent.txt")||g.size())
+      fail("missing file mapped");
+  }
+  
+  {
+    // mixed EOL (Win32:'\r\n'; Unix:'\n'; and old MacOS:'\r'), long 
+    // enough to cross several 32-byte blocks, CR+LF split over a block
+    const char txt[]=
+"first line of the text buffer\r\n"
+"second\r"
+"third line, a bit longer than the others are\n"
+"\n"
+"fifth line: CR+LF split across a block edge\r\n"
+"sixth line has no end of line";
+    const int ref_len[6]={29,6,44,0,43,29};
+    std::size_t i,k,n=strlen(txt);
+    uint32_t offs[4];
+    Lines idx;
+    
+    if(idx.index(txt,n)!=6)
+      fail("wrong number of lines");
+    for(i=0;i<6;i++)
+      if(idx.len(i)!=ref_len[i])
+        fail("wrong line length");
+    if(strncmp(idx[2],"third",5)||strncmp(idx[5],"sixth",5))
+      fail("wrong line start");
+    if(count_lines(txt)!=6)
+      fail("wrong line count");
+    
+    // caller-owned storage, resumed until the buffer is exhausted
+    k=index_lines(txt,n,offs,4);
+    if(k!=3||offs[3]!=idx.offset(3))
+      fail("wrong partial line index");
+    k=index_lines(txt,n,offs,4,offs[3]);
+    if(k!=3||offs[0]!=idx.offset(3)||offs[2]!=idx.offset(5)||offs[3]!=n)
+      fail("wrong resumed line index");
+  }
+  
+#ifdef HAVE_MMAP
+  { // buffer over 4 GiB (untouched pages of a private mapping read as 0)
+    const std::size_t n=((std::size_t)1<<32)+8192;
+    char *s=(char*)mmap(0,n,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+    uint32_t offs[4];
+    Lines idx;
+    
+    if(s!=MAP_FAILED){
+      s[10]='\n';
+      s[n-4096]='\n';
+      s[n-2]='\n';
+      if(idx.index(s,n)!=4||idx.offset(2)!=n-4095||idx.offset(3)!=n-1||
+         idx.len(1)!=(int)(n-4096-11)||idx[3]!=s+n-1)
+        fail("wrong line index over 4 GiB");
+      if(index_lines(s,n,offs,4)!=0)
+        fail("32-bit line offsets over 4 GiB");
+      munmap(s,n);
+    }
+  }
+#endif
+  
+  {
+    // FORTRAN fixed-width fields must match strtod bit by bit
+    const char *fld[]={
+      "  .810000000000e+02", " 7.109375000000D+01", "-2.734409949984E+00",
+      " -.133793031564d-01", "    0.000000000000D0", "-0.0000000000000000",
+      "  1.234567890123-05", "+1.000000000000E+00", "12345678901234567890",
+      "0.12345678901234567", " 1.7976931348623D308", "4.9406564584124D-324",
+      "  1.000000000000D400", "-1.000000000000E+400", "  1.000000000000D-400",
+      "-2.225073858507E-310"
+    };
+    const char *ref[]={
+      "  .810000000000e+02", " 7.109375000000E+01", "-2.734409949984E+00",
+      " -.133793031564E-01", "    0.000000000000E0", "-0.0000000000000000",
+      "  1.234567890123E-05", "+1.000000000000E+00", "12345678901234567890",
+      "0.12345678901234567", " 1.7976931348623E308", "4.9406564584124E-324",
+      "  1.000000000000E400", "-1.000000000000E+400", "  1.000000000000E-400",
+      "-2.225073858507E-310"
+    };
+    bool blank;
+    double a,b;
+    char buf[32];
+    
+    for(int i=0;i<16;i++){ // out of range as strtod: +-HUGE_VAL, 0, denormal
+      a=strnflt(fld[i],strlen(fld[i]));
+      b=strtod(ref[i],0);
+      if(memcmp(&a,&b,sizeof(double)))
+        fail("float field differs from strtod");
+    }
+    if(strnflt("                   ",19,&blank)!=0.0||!blank)
+      fail("blank float field not detected");
+    if(strnflt("   1.5\n 2.0",19,&blank)!=1.5||blank)
+      fail("float field should stop at end of line");
+    
+    srand(1);
+    for(int i=0;i<100000;i++){
+      b=(rand()/(double)RAND_MAX-0.5)*pow(10.0,rand()%40-20);
+      snprintf(buf,sizeof(buf),i&1?"%19.12E":"%25.17E",b);
+      b=strtod(buf,0);
+      buf[15+(i&1?0:6)]=i&2?'D':'d';
+      a=strnflt(buf,strlen(buf));
+      if(memcmp(&a,&b,sizeof(double)))
+        fail("float field differs from strtod");
+    }
+  }
+  
+  { // gzip: blocks, concatenated members, streamed lines
+    Mem a,b,c,z;
+    std::string txt,cat;
+    const char *s,*t;
+    int i,n,m;
+    
+    for(i=0;i<40000;i++)
+      txt+="line "+std::to_string(i*7919%100003)+(i%3?" some text\n":"\r\n");
+    a.set(txt.data(),txt.size());
+    z=a.gz_encode();
+    if(!Mem::gzipped(z.data(),z.size())||z.size()>=a.size()/2)
+      fail("wrong gzip block");
+    b=z.gz_decode();
+    if(b.size()!=a.size()||memcmp(a.data(),b.data(),a.size()))
+      fail("gzip block does not decode to the original");
+    c.load("./data/dummy.txt");
+    z.append(c.gz_encode());
+    b=z.gz_decode();
+    cat=txt+std::string(c.data(),c.size());
+    if(b.size()!=cat.size()||memcmp(b.data(),cat.data(),cat.size()))
+      fail("concatenated gzip members do not decode");
+    z.seek(100).write("garbage!",8);
+    if(z.gz_decode().size())
+      fail("corrupt gzip data decoded");
+    
+    // members cut mid-line, the reader window crosses them
+    GzWriter w;
+    if(!w.open("./gz.tmp",1))
+      fail("could not create gzip file");
+    for(i=0;i<(int)cat.size();i+=50001){
+      w.write(&cat[i],std::min<std::size_t>(50001,cat.size()-i));
+      if(i%3)
+        w.member();
+    }
+    if(!w.close()||w.size()!=cat.size())
+      fail("could not write gzip file");
+    
+    LineReader p,q,r;
+    z.load("./gz.tmp");
+    p.open(cat.data(),cat.size());
+    q.open("./gz.tmp");
+    r.open(z.data(),z.size());
+    while((s=p.next(&n))){
+      if(!(t=q.next(&m))||m!=n||memcmp(s,t,n))
+        fail("gzip file line differs");
+      if(!(t=r.next(&m))||m!=n||memcmp(s,t,n)||r.tell()!=p.tell())
+        fail("gzip block line differs");
+    }
+    if(q.next(&m)||r.next(&m)||q.tell()!=cat.size())
+      fail("wrong number of gzip lines");
+    if(q.seek(0)||q.bad()||r.bad())
+      fail("seek into gzip input");
+    
+    // a truncated member ends the lines with an error
+    FILE *fp=fopen("./gz.tmp","wb");
+    fwrite(z.data(),1,z.size()-100,fp);
+    fclose(fp);
+    q.open("./gz.tmp");
+    r.open(z.data(),z.size()-100);
+    while(q.next(&m));
+    while(r.next(&m));
+    if(!q.bad()||!r.bad()||q.tell()>=cat.size())
+      fail("truncated gzip input not detected");
+    remove("./gz.tmp");
+  }
 }
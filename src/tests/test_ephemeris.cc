@@ -117,4 +117,134 @@ void test_ephemeris()
   }
 #endif 
 
+  
+  { // ephemeris store
+    const char rinex[]= 
+"G12 2012 07 15 10 00 00 8.002668619160D-05 2.046363078990D-12 0.000000000000D+00\n"
+"     2.500000000000D+01-1.110000000000D+02 3.935878230840D-09 5.493558895060D-02\n"
+"    -5.858018994330D-06 4.072350449860D-03 7.569789886470D-06 5.153764709470D+03\n"
+"     3.600000000000D+04 7.264316082000D-08 2.108504061720D+00 2.421438694000D-08\n"
+"     9.803942387720D-01 2.425625000000D+02 1.125559178460D-01-7.852827101770D-09\n"
+"    -1.825076021740D-10 1.000000000000D+00 1.697000000000D+03 0.000000000000D+00\n"
+"     2.000000000000D+00 0.000000000000D+00-1.210719347000D-08 2.500000000000D+01\n"
+"     3.399000000000D+04 4.000000000000D+00";
+    Nav eph(rinex);
+    EphemerisStore store;
+    std::vector<Nav> v;
+    Time t0=eph.toe;
+    
+    // 12 records 2 hours apart (inserted backwards), record 5 unhealthy 
+    for(int k=11;k>=0;k--){
+      Nav e(eph);
+      e.toe+=k*7200.0;
+      e.iode=k;
+      e.svh=k==5;
+      v.push_back(e);
+    }
+    v.push_back(v[3]); // repeated broadcast
+    store.add(v);
+    
+    if(store.select("G13",t0)||store.select("X01",t0))
+      fail("no ephemeris expected");
+    for(int k=0;k<24*60;k++){ // monotonic queries every minute
+      Time t=t0+k*60.0;
+      const Nav *e=store.select("G12",t);
+      int best=(k+60)/120;
+      if(best==5)
+        best=(k<5*120?4:6); // nearest healthy 
+      if(best>11)
+        best=11;
+      if(!e||e->iode!=best)
+        fail("wrong ephemeris selected");
+    }
+    if(store.size()!=12)
+      fail("repeated broadcast should be removed");
+    if(store.select("G12",t0+(11*7200.0+7201.0))) 
+      fail("ephemeris selected outside the fit interval");
+    if(!store.select("G12",t0-7000.0)||store.select("G12",t0)->iode!=0)
+      fail("wrong ephemeris for backward query");
+    if(!store.select("G12",7,t0)||store.select("G12",7,t0)->iode!=7)
+      fail("wrong ephemeris selected by IODE");
+    
+    // SBAS IDs are PRN-100 in RINEX and SP3
+    Nav s(eph);
+    memcpy(s.prn,"S23",4);
+    store.add(s);
+    if(EphemerisStore::satindex("S23")<0||EphemerisStore::satindex("S58")<0||
+       EphemerisStore::satindex("S23")==EphemerisStore::satindex("S24")||
+       !store.select("S23",t0)||store.select("S22",t0))
+      fail("SBAS satellite not indexed");
+    
+    // QZSS fit interval is a flag: 2 h when clear, 4 h when set
+    Nav q(eph);
+    memcpy(q.prn,"J01",4);
+    q.fit=0.0;
+    store.add(q);
+    if(!store.select("J01",t0+3500.0)||store.select("J01",t0+3700.0))
+      fail("wrong QZSS fit interval");
+    memcpy(q.prn,"J02",4);
+    q.fit=1.0;
+    store.add(q);
+    if(!store.select("J02",t0+5400.0)||store.select("J02",t0+7300.0))
+      fail("wrong QZSS extended fit interval");
+  }
+  
+  { // Galileo: BGD E5a/E1 and E5b/E1 in place of TGD and IODC
+    NavFile f;
+    const Nav *g=0;
+    
+    f.read("./data/rinex304.nav");
+    for(const auto& e: f.eph)
+      if(!strcmp(e.prn,"E02"))
+        g=&e;
+    if(!g||g->iode!=63||g->iodc!=g->iode||g->code!=517||
+       g->tgd[0]!=-8.614733815193E-09||g->tgd[1]!=-9.778887033463E-09)
+      fail("wrong Galileo group delays");
+    if(Nav(g->nav2rnx().c_str()).tgd[1]!=g->tgd[1]||
+       g->nav2rnx().find("-8.614733815193E-09-9.778887033463E-09")==std::string::npos)
+      fail("wrong Galileo group delays written");
+  }
+  
+  { // prepared ephemeris
+    NavFile f;
+    f.read("./data/rinex304.nav");
+    
+    for(const auto& eph: f.eph){
+      NavPrep prep(eph);
+      for(int k=-7200;k<=7200;k+=30){
+        Time t=eph.toe+(double)k;
+        double a[3],b[3],da,db;
+        eph.nav2ecf(t,a,&da);
+        prep.nav2ecf(t,b,&db);
+        if(fabs(a[0]-b[0])>1e-6||fabs(a[1]-b[1])>1e-6||fabs(a[2]-b[2])>1e-6)
+          fail("prepared ephemeris position differs");
+        if(fabs(da-db)>1e-18||eph.eph2clk(t)!=prep.eph2clk(t))
+          fail("prepared ephemeris clock differs");
+      }
+    }
+  }
+  
+  { // analytic velocity and clock drift against central differences
+    NavFile f;
+    f.read("./data/rinex304.nav");
+    
+    for(const auto& eph: f.eph){
+      for(int k=-7200;k<=7200;k+=600){
+        Time t=eph.toe+(double)k;
+        double p[3],v[3],dts,ddts,a[3],b[3],da,db;
+        const double h=0.05;
+        eph.nav2ecf(t,p,v,&dts,&ddts);
+        eph.nav2ecf(t-h,a,&da);
+        eph.nav2ecf(t+h,b,&db);
+        for(int j=0;j<3;j++)
+          if(fabs(v[j]-(b[j]-a[j])/(2.0*h))>1e-5)
+            fail("wrong analytic satellite velocity");
+        if(fabs(ddts-(db-da)/(2.0*h))>1e-14)
+          fail("wrong analytic satellite clock drift");
+        eph.nav2ecf(t,a,&da);
+        if(memcmp(a,p,sizeof(a))||da!=dts)
+          fail("position differs with velocity requested");
+      }
+    }
+  }
 }
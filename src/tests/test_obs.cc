@@ -0,0 +1,857 @@
+#include "test.h"
+#include <thread>
+
+static void test_obs2()
+{
+  { // RINEX 2.11 mixed example from the format specification
+    ObsFile obs;
+    ObsEpoch ep;
+    int cp1,cl1,cl2,cl5,i;
+    
+    if(!obs.open("./data/rinex211.obs"))
+      fail("could not open RINEX 2.11 obs file");
+    if(fabs(obs.ver-2.11)>1e-9||obs.sys!='M'||strcmp(obs.marker,"A 9080")||
+       obs.code.size()!=5||obs.interval!=18.0||obs.pos[2]!=4589095.0||
+       obs.del[0]!=0.9030||strcmp(obs.tsys,"GPS"))
+      fail("wrong RINEX 2.11 obs header");
+    cp1=obs.column("P1"); cl1=obs.column("L1"); 
+    cl2=obs.column("L2"); cl5=obs.column("L5");
+    if(cp1!=0||cl5!=4||obs.column("C1")!=-1)
+      fail("wrong observable columns");
+    
+    if(!obs.next(ep)||ep.flag!=0||ep.n!=4||ep.ncol!=5)
+      fail("wrong first epoch");
+    if(ep.t.to_double()!=Time().from_rnx("2005 03 24 13 10 36.0000000").to_double()||
+       ep.clk!=-.123456789)
+      fail("wrong epoch time or clock");
+    if(strcmp(ep.prn(0),"G12")||strcmp(ep.prn(3),"E11"))
+      fail("wrong epoch satellites");
+    if(ep.obs(cp1,0)!=23629347.915||ep.obs(cl1,0)!=.300||ep.ssi[cl1*ep.cap]!=8||
+       ep.obs(cl2,0)!=-.353||!std::isnan(ep.obs(cl5,0)))
+      fail("wrong observation record");
+    if(!std::isnan(ep.obs(cp1,3))||ep.obs(cl1,3)!=.324||ep.obs(cl5,3)!=.178||
+       ep.ssi[cl5*ep.cap+3]!=7)
+      fail("wrong observation record with blanks");
+    
+    if(!obs.next(ep)||ep.flag!=4||ep.n!=0) // header lines follow
+      fail("wrong event epoch");
+    if(!obs.next(ep)||ep.flag!=0||ep.n!=6||strcmp(ep.prn(4),"R22")||
+       ep.obs(cl1,4)!=23456.789||ep.obs(cl5,5)!=48861.586)
+      fail("wrong epoch after event");
+    if(!obs.next(ep)||ep.flag!=2||ep.n!=0) // start moving antenna
+      fail("wrong event epoch");
+    if(!obs.next(ep)||ep.n!=4||ep.t.to_double()!=
+       Time().from_rnx("2005 03 24 13 11 48.0000000").to_double())
+      fail("wrong epoch");
+    if(!obs.next(ep)||ep.flag!=3||strcmp(obs.marker,"A 9080")) // new site
+      fail("wrong new site event");
+    obs.next(ep);
+    if(!obs.next(ep)||ep.flag!=5||ep.t.t_frac<0.2345677||ep.t.t_frac>0.2345679)
+      fail("wrong external event");
+    obs.next(ep); // comment
+    if(!obs.next(ep)||(i=ep.find("G12"))!=1||ep.obs(cl1,i)!=-212616.150||
+       ep.lli[cl1*ep.cap]!=1||ep.ssi[cl1*ep.cap]!=6||ep.lli[cl2*ep.cap]!=5)
+      fail("wrong LLI/SSI");
+    obs.next(ep); // comment
+    if(!obs.next(ep)||ep.flag!=6||ep.n!=2||ep.obs(cl1,0)!=123456789.0||
+       ep.obs(cl2,1)!=-0.5)
+      fail("wrong cycle slip records");
+    obs.next(ep);
+    for(i=0;obs.next(ep);i++);
+    if(i!=2)
+      fail("wrong number of epochs");
+  }
+  
+  { // continuation lines: 10 observables, 14 satellites
+    const char *types[]={"C1","L1","L2","P1","P2","D1","D2","S1","S2","C5"};
+    ObsFile obs;
+    ObsEpoch ep;
+    std::string txt;
+    char buf[128];
+    int k,j;
+    
+    txt="     2.11           OBSERVATION DATA    G (GPS)             RINEX VERSION / TYPE\n";
+    txt+="    10    C1    L1    L2    P1    P2    D1    D2    S1    S2# / TYPES OF OBSERV\n";
+    txt+="          C5                                                # / TYPES OF OBSERV\n";
+    txt+="                                                            END OF HEADER\n";
+    txt+=" 24  7 15  0  0  0.0000000  0 14";
+    for(k=1;k<=12;k++){ // blank system: header's
+      snprintf(buf,sizeof(buf)," %2d",k);
+      txt+=buf;
+    }
+    txt+=" 0.000000123\n";
+    txt+=std::string(32,' ')+" 13G14\n";
+    for(k=0;k<14;k++){
+      for(j=0;j<10;j++){
+        snprintf(buf,sizeof(buf),"%14.3f%1d%1d",1000.0*(k+1)+j,j%3,j%9+1);
+        txt+=buf;
+        if(j==4||j==9)
+          txt+="\n";
+      }
+    }
+    
+    if(!obs.open(txt.data(),txt.size())||obs.code.size()!=10||
+       obs.column("C5")!=9||obs.column("S2")!=8)
+      fail("wrong continued TYPES OF OBSERV");
+    if(!obs.next(ep)||ep.n!=14||strcmp(ep.prn(0),"G01")||strcmp(ep.prn(12),"G13")||
+       strcmp(ep.prn(13),"G14")||ep.clk!=0.000000123)
+      fail("wrong continued satellite list");
+    for(k=0;k<14;k++)
+      for(j=0;j<10;j++)
+        if(ep.obs(obs.column(types[j]),k)!=1000.0*(k+1)+j||
+           ep.lli[j*ep.cap+k]!=j%3||ep.ssi[j*ep.cap+k]!=j%9+1)
+          fail("wrong continued observation record");
+    if(obs.next(ep))
+      fail("wrong number of epochs");
+  }
+  
+  { // streaming from a file: the buffer window slides, epochs match memory
+    Mem m;
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    std::string txt,body;
+    FILE *fp;
+    int ne=0;
+    
+    m.load("./data/rinex211.obs");
+    txt.assign(m.data(),m.size());
+    body=txt.substr(txt.find(" 05  3 24 13 10 36"));
+    while(txt.size()<(1<<18)) // several 64 KiB windows
+      txt+=body;
+    fp=fopen("./obs.tmp","wb");
+    fwrite(txt.data(),1,txt.size(),fp);
+    fclose(fp);
+    
+    a.open(txt.data(),txt.size());
+    if(!b.open("./obs.tmp"))
+      fail("could not open obs file");
+    while(a.next(ea)){
+      if(!b.next(eb)||ea.n!=eb.n||ea.flag!=eb.flag||
+         ea.t.to_double()!=eb.t.to_double())
+        fail("streamed epoch differs");
+      for(int c=0;c<ea.ncol;c++)
+        for(int i=0;i<ea.n;i++)
+          if(memcmp(&ea.val[c*ea.cap+i],&eb.val[c*eb.cap+i],sizeof(double)))
+            fail("streamed observation differs");
+      ne++;
+    }
+    if(b.next(eb)||ne<1000)
+      fail("wrong number of streamed epochs");
+    remove("./obs.tmp");
+  }
+}
+
+// values written by the generator of the 3.04 and 4.01 test files
+static double obs3val(const char *prn, int j, int e)
+{
+  double sys[]={0.875,0.625,2.25,0.375}; // G E R C
+  return 20000000.0+1000.0*atoi(prn+1)+100.0*j+e+
+         sys[strchr("GERC",prn[0])-"GERC"];
+}
+
+static void test_obs3()
+{
+  const char *gps[]={"C1C","L1C","D1C","S1C","C2W","L2W","D2W","S2W","C5Q",
+                     "L5Q","D5Q","S5Q","C2L","L2L"};
+  const char *gal[]={"C1C","L1C","D1C","S1C","C5Q","L5Q","D5Q","S5Q"};
+  const char *bds[]={"C2I","L2I","D2I","S2I"};
+  int cal[6]={2024,7,15,0,0,0};
+  
+  for(const char *file: {"./data/rinex304.obs","./data/rinex401.obs"}){
+    ObsFile obs;
+    ObsEpoch ep;
+    const double *p0=0;
+    const char *prn,**types;
+    int e,i,j,c,nt,nev;
+    double t0=Time().from_cal(cal).to_double();
+    
+    if(!obs.open(file))
+      fail("could not open RINEX 3/4 obs file");
+    if(obs.ver<3.0||obs.sys!='M'||strcmp(obs.marker,"ALGO")||
+       obs.interval!=30.0||obs.pos[0]!=918129.416||strcmp(obs.tsys,"GPS"))
+      fail("wrong RINEX 3/4 obs header");
+    // union of the system lists: the GPS list is continued on a second line
+    if(obs.code.size()!=18||obs.column("L2L")!=13||obs.column("C2I")!=14||
+       obs.column("S2I")!=17)
+      fail("wrong RINEX 3/4 observable columns");
+    
+    for(e=nev=0;obs.next(ep);){
+      if(ep.flag==4){ // header lines inside the data
+        if(ep.n!=0||e!=4)
+          fail("wrong RINEX 3/4 event");
+        nev++;
+        continue;
+      }
+      if(ep.flag!=0||ep.n!=7||strcmp(ep.prn(0),"G01")||
+         strcmp(ep.prn(6),"C06")||ep.find("S23")>=0) // no S types: skipped
+        fail("wrong RINEX 3/4 epoch satellites");
+      if(ep.t.to_double()!=t0+30.0*e||fabs(ep.clk-1.23456789e-7*(e+1))>1e-11)
+        fail("wrong RINEX 3/4 epoch time or clock");
+      
+      for(i=0;i<ep.n;i++){
+        prn=ep.prn(i);
+        switch(prn[0]){
+          case 'G': types=gps; nt=14; break;
+          case 'E': types=gal; nt=6;  break; // records cut after 6 fields
+          case 'C': types=bds; nt=4;  break;
+          default:  types=gal; nt=4;  break; // GLONASS: first 4 as Galileo
+        }
+        for(j=0;j<nt;j++){
+          c=obs.column(types[j]);
+          if(!strcmp(prn,"G05")&&j==7){
+            if(!std::isnan(ep.obs(c,i)))
+              fail("blank RINEX 3/4 field not missing");
+            continue;
+          }
+          if(fabs(ep.obs(c,i)-obs3val(prn,j,e))>1e-6||ep.ssi[c*ep.cap+i]!=j%9+1||
+             ep.lli[c*ep.cap+i]!=(!strcmp(prn,"G03")&&j==1&&e==3))
+            fail("wrong RINEX 3/4 observation");
+        }
+        if(prn[0]=='E'&&!std::isnan(ep.obs(obs.column("S5Q"),i)))
+          fail("cut RINEX 3/4 record not missing");
+        if(prn[0]=='R'&&!std::isnan(ep.obs(obs.column("C2W"),i)))
+          fail("observable of another system not missing");
+      }
+      
+      // the epoch buffers are reused, nothing allocated after the first
+      if(e&&ep.val.data()!=p0)
+        fail("RINEX 3/4 epoch buffers reallocated");
+      p0=ep.val.data();
+      e++;
+    }
+    if(e!=10||nev!=1)
+      fail("wrong number of RINEX 3/4 epochs");
+  }
+}
+
+// selected columns and epochs match the full parse
+static void test_obssel()
+{
+  int cal[6]={2024,7,15,0,0,0};
+  Time t0;
+  
+  t0.from_cal(cal);
+  { // RINEX 3.04: GPS and Galileo, three codes, epochs 2 to 5
+    ObsFile obs;
+    ObsEpoch ep;
+    ObsSelect sel;
+    int e,i,cl1,cs5,nev=0;
+    
+    sel.sys="GE";
+    sel.code={"C1C","L1","S5"};
+    sel.window=true;
+    sel.beg=t0+60.0;
+    sel.end=t0+150.0;
+    obs.select(sel);
+    if(!obs.open("./data/rinex304.obs"))
+      fail("could not open RINEX 3.04 obs file");
+    cl1=obs.column("L1C");
+    cs5=obs.column("S5Q");
+    if(obs.code.size()!=3||obs.column("C1C")!=0||cl1!=1||cs5!=2)
+      fail("wrong selected columns");
+    for(e=2;obs.next(ep);){
+      if(ep.flag==4){
+        nev++;
+        continue;
+      }
+      if(ep.t.to_double()!=(t0+30.0*e).to_double()||ep.n!=5||
+         strcmp(ep.prn(4),"E11"))
+        fail("wrong selected epoch");
+      for(i=0;i<ep.n;i++){
+        if(fabs(ep.obs(cl1,i)-obs3val(ep.prn(i),1,e))>1e-6)
+          fail("wrong selected observation");
+        if(ep.prn(i)[0]=='G'&&fabs(ep.obs(cs5,i)-obs3val(ep.prn(i),11,e))>1e-6)
+          fail("wrong selected GPS observation");
+        if(ep.prn(i)[0]=='E'&&!std::isnan(ep.obs(cs5,i)))
+          fail("cut record not missing");
+      }
+      e++;
+    }
+    if(e!=6||nev!=1)
+      fail("wrong number of selected epochs");
+  }
+  
+  { // RINEX 2.11: GPS L1 and P2 only, same values as without selection
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    ObsSelect sel;
+    int cal1[6]={2005,3,24,13,10,54},i,k,ne=0;
+    
+    sel.sys="G";
+    sel.code={"L1","P2"};
+    sel.window=true;
+    sel.beg.from_cal(cal1);
+    sel.end=sel.beg+54.0; // 13:11:48
+    b.select(sel);
+    if(!a.open("./data/rinex211.obs")||!b.open("./data/rinex211.obs"))
+      fail("could not open RINEX 2.11 obs file");
+    if(b.code.size()!=2||b.column("L1")!=0||b.column("P1")!=-1)
+      fail("wrong selected RINEX 2 columns");
+    while(b.next(eb)){
+      if(eb.flag>=2&&eb.flag<=5)
+        continue;
+      do{
+        if(!a.next(ea))
+          fail("selected epoch not in the file");
+      } while(ea.t.to_double()!=eb.t.to_double()||ea.flag!=eb.flag);
+      for(i=k=0;i<ea.n;i++){
+        if(ea.prn(i)[0]!='G')
+          continue;
+        if(strcmp(ea.prn(i),eb.prn(k))||
+           ea.obs(a.column("L1"),i)!=eb.obs(0,k)||
+           memcmp(&ea.val[a.column("P2")*ea.cap+i],&eb.val[eb.cap+k],sizeof(double))||
+           ea.lli[a.column("L1")*ea.cap+i]!=eb.lli[k])
+          fail("selected RINEX 2 record differs");
+        k++;
+      }
+      if(k!=eb.n)
+        fail("wrong selected RINEX 2 satellites");
+      ne++;
+    }
+    if(ne!=2)
+      fail("wrong number of selected RINEX 2 epochs");
+  }
+}
+
+// epochs of a and b hold the same records (columns of b named in a)
+static bool sameepoch(const ObsFile& a, const ObsEpoch& ea,
+  const ObsFile& b, const ObsEpoch& eb)
+{
+  int c,d,i;
+  std::size_t ka,kb;
+  
+  if(ea.n!=eb.n||ea.flag!=eb.flag||ea.t.to_double()!=eb.t.to_double()||
+     fabs(ea.clk-eb.clk)>1e-15)
+    return false;
+  for(i=0;i<ea.n;i++){
+    if(strcmp(ea.prn(i),eb.prn(i)))
+      return false;
+    for(d=0;d<eb.ncol;d++){
+      c=a.column(b.code[d].c_str());
+      ka=(std::size_t)c*ea.cap+i;
+      kb=(std::size_t)d*eb.cap+i;
+      if(std::isnan(ea.val[ka])!=std::isnan(eb.val[kb])||
+         fabs(ea.val[ka]-eb.val[kb])>1e-6||
+         ea.lli[ka]!=eb.lli[kb]||ea.ssi[ka]!=eb.ssi[kb])
+        return false;
+    }
+  }
+  return true;
+}
+
+// Compact RINEX files encoded from the plain ones
+static void test_crx()
+{
+  const char *files[][2]={{"./data/rinex211.obs","./data/rinex211.crx"},
+                          {"./data/rinex304.obs","./data/rinex304.crx"}};
+  
+  for(auto& f: files){
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    int ne=0;
+    
+    if(!a.open(f[0])||!b.open(f[1]))
+      fail("could not open CRINEX file");
+    if(b.crx!=(a.ver<3.0?1.0:3.0)||b.ver!=a.ver||b.code!=a.code||
+       strcmp(b.marker,a.marker))
+      fail("wrong CRINEX header");
+    while(a.next(ea)){
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("CRINEX epoch differs from RINEX");
+      ne++;
+    }
+    if(b.next(eb)||ne<10)
+      fail("wrong number of CRINEX epochs");
+  }
+  
+  { // a satellite without a state index is dropped and counted
+    Mem m,c;
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    std::string txt,crx;
+    std::size_t p;
+    int ne=0;
+    
+    m.load("./data/rinex304.obs");
+    c.load("./data/rinex304.crx");
+    txt.assign(m.data(),m.size());
+    crx.assign(c.data(),c.size());
+    while((p=txt.find("E11"))!=std::string::npos)
+      txt.replace(p,3,"E70");
+    while((p=crx.find("E11"))!=std::string::npos)
+      crx.replace(p,3,"E70");
+    if(!a.open(txt.data(),txt.size())||!b.open(crx.data(),crx.size()))
+      fail("could not open CRINEX file");
+    while(a.next(ea)){
+      if(!b.next(eb)||(ea.flag==0&&(eb.n!=ea.n-1||ea.find("E70")<0||eb.find("E70")>=0)))
+        fail("CRINEX satellite without a state index not dropped");
+      ne+=ea.flag==0;
+    }
+    if(b.nskip!=(std::size_t)ne||a.nskip!=0)
+      fail("dropped CRINEX satellites not counted");
+  }
+  
+  { // selection: series of skipped systems and codes are not followed
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    ObsSelect sel;
+    int cal[6]={2024,7,15,0,1,0},ne=0;
+    
+    sel.sys="GC";
+    sel.code={"L","S2"};
+    sel.window=true;
+    sel.beg.from_cal(cal);
+    sel.end=sel.beg+120.0;
+    a.select(sel);
+    b.select(sel);
+    if(!a.open("./data/rinex304.obs")||!b.open("./data/rinex304.crx")||
+       b.code.size()!=7)
+      fail("could not open selected CRINEX file");
+    while(a.next(ea)){
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("selected CRINEX epoch differs from RINEX");
+      ne+=ea.flag==0;
+    }
+    if(b.next(eb)||ne!=5)
+      fail("wrong number of selected CRINEX epochs");
+  }
+  
+  { // streamed from a file larger than the reader window
+    Mem m;
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    std::string txt,body;
+    FILE *fp;
+    int ne=0;
+    
+    m.load("./data/rinex304.crx");
+    txt.assign(m.data(),m.size());
+    body=txt.substr(txt.find("> 2024"));
+    while(txt.size()<(1<<18))
+      txt+=body;
+    fp=fopen("./crx.tmp","wb");
+    fwrite(txt.data(),1,txt.size(),fp);
+    fclose(fp);
+    
+    a.open(txt.data(),txt.size());
+    if(!b.open("./crx.tmp"))
+      fail("could not open CRINEX file");
+    while(a.next(ea)){
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("streamed CRINEX epoch differs");
+      ne++;
+    }
+    if(b.next(eb)||ne<500)
+      fail("wrong number of streamed CRINEX epochs");
+    remove("./crx.tmp");
+  }
+}
+
+// CRINEX 3.0 written from decoded epochs reads back the same
+static void test_crxwriter()
+{
+  for(int ord: {1,3,CRX_MAXORD}){
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    CrxWriter w;
+    int ne=0;
+    
+    if(!a.open("./data/rinex304.obs")||!w.open("./crx.tmp",a,ord))
+      fail("could not create CRINEX file");
+    while(a.next(ea))
+      if(!w.write(ea))
+        fail("could not write CRINEX epoch");
+    if(!w.close())
+      fail("could not close CRINEX file");
+    
+    a.open("./data/rinex304.obs");
+    if(!b.open("./crx.tmp")||b.crx!=3.0||b.code!=a.code||strcmp(b.marker,"ALGO")||
+       b.interval!=30.0||b.pos[1]!=a.pos[1]||strcmp(b.tsys,"GPS"))
+      fail("wrong CRINEX header written");
+    while(a.next(ea)){
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("CRINEX epoch written differs");
+      ne++;
+    }
+    if(b.next(eb)||ne!=11)
+      fail("wrong number of CRINEX epochs written");
+  }
+  
+  { // selected columns only; RINEX 2 codes cannot be written
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    ObsSelect sel;
+    CrxWriter w;
+    
+    sel.sys="ER";
+    sel.code={"C1C","L1C"};
+    a.select(sel);
+    if(!a.open("./data/rinex304.obs")||!w.open("./crx.tmp",a))
+      fail("could not create CRINEX file");
+    while(a.next(ea))
+      w.write(ea);
+    w.close();
+    a.open("./data/rinex304.obs");
+    if(!b.open("./crx.tmp")||b.code.size()!=2||b.columns('G').size())
+      fail("wrong selected CRINEX header written");
+    while(a.next(ea))
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb)||(ea.flag==0&&eb.n!=3))
+        fail("selected CRINEX epoch written differs");
+    
+    a.select(ObsSelect());
+    if(!a.open("./data/rinex211.obs")||w.open("./crx.tmp",a))
+      fail("RINEX 2 codes written as CRINEX 3.0");
+    remove("./crx.tmp");
+  }
+  
+  { // SBAS satellites (IDs of PRN-100) are written and read back
+    Mem m;
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    CrxWriter w;
+    std::string txt;
+    int ne=0;
+    
+    m.load("./data/rinex304.obs");
+    txt.assign(m.data(),m.size());
+    txt.insert(txt.find("    30.000"),
+      "S    1 C1C                                                  SYS / # / OBS TYPES\n");
+    if(!a.open(txt.data(),txt.size())||!w.open("./crx.tmp",a))
+      fail("could not create CRINEX file with SBAS");
+    while(a.next(ea))
+      w.write(ea);
+    w.close();
+    a.open(txt.data(),txt.size());
+    if(!b.open("./crx.tmp"))
+      fail("could not open CRINEX file with SBAS");
+    while(a.next(ea)){
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("CRINEX epoch with SBAS differs");
+      if(ea.flag==0&&(eb.n!=8||eb.find("S23")<0))
+        fail("SBAS satellite dropped from CRINEX");
+      ne++;
+    }
+    if(b.next(eb)||ne!=11)
+      fail("wrong number of CRINEX epochs with SBAS");
+    remove("./crx.tmp");
+  }
+}
+
+// RINEX 3 text of ne epochs every 30 s from 2024-07-15 00:00, the
+// records of the first epoch of rinex304.obs
+static std::string obs3text(int ne)
+{
+  Mem m;
+  std::string txt,rec;
+  std::size_t k;
+  char buf[64];
+  
+  m.load("./data/rinex304.obs");
+  txt.assign(m.data(),m.size());
+  k=txt.find("> 2024");
+  rec=txt.substr(txt.find('\n',k)+1,txt.find("> 2024",k+1)-txt.find('\n',k)-1);
+  txt.resize(k);
+  for(int e=0;e<ne;e++){
+    snprintf(buf,sizeof(buf),"> 2024 07 %02d %02d %02d %2d.0000000  0  8\n",
+      15+e/2880,e/120%24,e/2%60,30*(e%2));
+    txt+=buf;
+    txt+=rec;
+  }
+  return txt;
+}
+
+// reading from the index mark before a window start gives the same
+// epochs as reading the whole file; slices cover every epoch once
+static void test_obsindex()
+{
+  int cal[6]={2024,7,15,0,0,0};
+  std::string txt=obs3text(600);
+  Time t0;
+  FILE *fp;
+  
+  t0.from_cal(cal);
+  fp=fopen("./obs.tmp","wb");
+  fwrite(txt.data(),1,txt.size(),fp);
+  fclose(fp);
+  
+  { // every 50th epoch, saved and loaded back
+    ObsIndex ix,iy;
+    
+    if(!ix.build("./obs.tmp",50)||ix.mark.size()!=13||ix.gz||
+       ix.mark[1].t.to_double()!=(t0+1500.0).to_double()||
+       ix.mark[12].raw!=txt.size()||txt.compare(ix.mark[3].raw,6,"> 2024"))
+      fail("wrong observation index");
+    if(!ix.save("./obs.tmp.idx")||!iy.load("./obs.tmp.idx")||iy.head!=ix.head||
+       iy.mark.size()!=13||iy.mark[5].raw!=ix.mark[5].raw||
+       iy.mark[12].t.to_double()!=(t0+30.0*599).to_double())
+      fail("observation index not saved");
+    if(ix.find(t0-1.0)!=0||ix.find(t0+1500.0)!=0||ix.find(t0+1530.0)!=1||
+       ix.find(t0+1e6)!=12)
+      fail("wrong observation index mark found");
+    
+    fp=fopen("./obs.tmp.idx","r+b"); // mark count wrapping to the file size
+    fseek(fp,16+7,SEEK_SET);
+    fputc(0x08,fp); // 13+2^59 marks
+    fclose(fp);
+    if(iy.load("./obs.tmp.idx")||iy.mark.size())
+      fail("observation index with a wrapped mark count accepted");
+    ix.save("./obs.tmp.idx");
+#ifdef __linux__
+    if(ix.save("/dev/full"))
+      fail("observation index written to a full disk");
+#endif
+    
+    fp=fopen("./obs.tmp.idx","r+b"); // marks out of order
+    fseek(fp,32+32+7,SEEK_SET);
+    fputc(0x80,fp);
+    fclose(fp);
+    if(iy.load("./obs.tmp.idx")||iy.mark.size())
+      fail("corrupt observation index accepted");
+    remove("./obs.tmp.idx");
+  }
+  
+  for(double beg: {-60.0,0.0,4000.0,4515.0,17970.0}){ // window start
+    ObsIndex ix;
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    ObsSelect sel;
+    int ne=0;
+    
+    sel.window=true;
+    sel.beg=t0+beg;
+    sel.end=t0+beg+3600.0;
+    a.select(sel);
+    b.select(sel);
+    ix.build(txt.data(),txt.size(),7);
+    if(!a.open("./obs.tmp")||!b.open("./obs.tmp")||!b.seek(ix,sel.beg)||
+       b.tell()!=ix.mark[ix.find(sel.beg)].raw)
+      fail("could not seek observation file");
+    while(a.next(ea)){
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("seeked observation epoch differs");
+      ne++;
+    }
+    if(b.next(eb)||ne!=(beg<0.0?119:beg==0.0?121:beg==17970.0?1:120))
+      fail("wrong number of seeked observation epochs");
+  }
+  
+  { // an index of another version of the file is not seeked into
+    ObsIndex ix;
+    ObsFile b;
+    
+    ix.build(txt.data(),txt.rfind("> 2024"),7);
+    if(!b.open("./obs.tmp")||b.seek(ix,t0+4000.0))
+      fail("observation file seeked with a stale index");
+    b.open(txt.data(),txt.size());
+    ix.build(txt.data(),txt.size(),7);
+    if(!b.seek(ix,t0+4000.0))
+      fail("could not seek observation text");
+  }
+  
+  { // 4 workers on slices of the file
+    ObsIndex ix;
+    ObsFile a;
+    ObsEpoch ep;
+    std::vector<std::size_t> k;
+    std::vector<int> ne(4,0);
+    std::vector<std::thread> pool;
+    int n=0;
+    
+    ix.build("./obs.tmp",10);
+    ix.slices(4,k);
+    if(k.size()!=5||k[0]!=0||k[4]!=ix.mark.size()-1||k[2]<25||k[2]>35)
+      fail("wrong observation index slices");
+    for(std::size_t i=0;i+1<k.size();i++)
+      pool.emplace_back([&,i](){
+        ObsFile obs;
+        ObsEpoch e;
+        if(!obs.open("./obs.tmp")||!obs.seek(ix.mark[k[i]].raw))
+          return;
+        while(obs.tell()<ix.mark[k[i+1]].raw&&obs.next(e))
+          ne[i]++;
+      });
+    for(auto& t: pool)
+      t.join();
+    a.open("./obs.tmp");
+    while(a.next(ep))
+      n++;
+    if(ne[0]+ne[1]+ne[2]+ne[3]!=n||n!=600||!ne[0]||!ne[3])
+      fail("observation slices do not cover the file");
+  }
+  
+  { // RINEX 2 with events: every mark is at its epoch header; Compact
+    // RINEX cannot be seeked into
+    ObsIndex ix;
+    ObsFile a;
+    ObsEpoch ep;
+    
+    if(!ix.build("./data/rinex211.obs",1)||ix.mark.size()<8||!a.open("./data/rinex211.obs"))
+      fail("could not index RINEX 2 file");
+    for(std::size_t i=0;i+1<ix.mark.size();i++)
+      if(!a.seek(ix.mark[i].raw)||!a.next(ep)||(ep.flag>=2&&ep.flag<=5)||
+         ep.t.to_double()!=ix.mark[i].t.to_double())
+        fail("wrong RINEX 2 index mark");
+    if(ix.build("./data/rinex304.crx")||!a.open("./data/rinex304.crx")||a.seek(0))
+      fail("Compact RINEX indexed");
+  }
+  remove("./obs.tmp");
+}
+
+#ifdef HAVE_ZLIB
+// gzip-compressed RINEX and CRINEX read like the plain files
+static void test_obsgz()
+{
+  { // RINEX 3 file and memory block
+    ObsFile a,b,c;
+    ObsEpoch ea,eb,ec;
+    Mem m,z;
+    FILE *fp;
+    int ne=0;
+    
+    m.load("./data/rinex304.obs");
+    z=m.gz_encode();
+    fp=fopen("./obs.tmp.gz","wb");
+    fwrite(z.data(),1,z.size(),fp);
+    fclose(fp);
+    
+    a.open("./data/rinex304.obs");
+    if(!b.open("./obs.tmp.gz")||!c.open(z.data(),z.size())||b.code!=a.code)
+      fail("could not open gzip RINEX file");
+    while(a.next(ea)){
+      if(!b.next(eb)||!c.next(ec)||!sameepoch(a,ea,b,eb)||!sameepoch(a,ea,c,ec))
+        fail("gzip RINEX epoch differs");
+      ne++;
+    }
+    if(b.next(eb)||c.next(ec)||ne!=11)
+      fail("wrong number of gzip RINEX epochs");
+    remove("./obs.tmp.gz");
+  }
+  
+  { // CRINEX written straight to .gz
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    CrxWriter w;
+    Mem m;
+    
+    if(!a.open("./data/rinex304.obs")||!w.open("./crx.tmp.gz",a))
+      fail("could not create gzip CRINEX file");
+    while(a.next(ea))
+      w.write(ea);
+    if(!w.close())
+      fail("could not close gzip CRINEX file");
+    m.load("./crx.tmp.gz");
+    if(!Mem::gzipped(m.data(),m.size()))
+      fail("gzip CRINEX file not written");
+    a.open("./data/rinex304.obs");
+    if(!b.open("./crx.tmp.gz")||b.crx!=3.0)
+      fail("could not open gzip CRINEX file");
+    while(a.next(ea))
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("gzip CRINEX epoch differs");
+    if(b.next(eb))
+      fail("wrong number of gzip CRINEX epochs");
+    remove("./crx.tmp.gz");
+  }
+}
+
+// windows read from a blocked gzip archive hold the same epochs as the
+// plain file read with the same window
+static void test_obsarchive()
+{
+  int cal[6]={2024,7,15,0,0,0};
+  Time t0;
+  
+  t0.from_cal(cal);
+  { // RINEX 3, 600 epochs in 16 KiB blocks
+    Mem w1,w3;
+    ObsArchive arc;
+    std::string txt=obs3text(600);
+    FILE *fp;
+    
+    fp=fopen("./obs.tmp","wb");
+    fwrite(txt.data(),1,txt.size(),fp);
+    fclose(fp);
+    
+    if(!ObsArchive::write("./obs.tmp","./arc.tmp.gz",1<<14,6)||!arc.open("./arc.tmp.gz"))
+      fail("could not create observation archive");
+    if(arc.index().mark.size()<20||!arc.index().gz||arc.index().mark.back().t.to_double()!=(t0+30.0*599).to_double())
+      fail("wrong observation archive index");
+    
+    for(int w=0;w<4;w++){
+      Time beg=t0+(w==0?-100.0:w==1?3000.0:w==2?0.0:18000.0);
+      Time end=t0+(w==0?-10.0:w==1?3630.0:w==2?17970.0:20000.0);
+      ObsFile a,b;
+      ObsEpoch ea,eb;
+      ObsSelect sel;
+      int ne=0;
+      
+      if(!arc.read(beg,end,w1,1)||!arc.read(beg,end,w3,3)||w1.size()!=w3.size()||
+         memcmp(w1.data(),w3.data(),w1.size()))
+        fail("could not read observation archive window");
+      if(w==1&&w1.size()>txt.size()/4)
+        fail("archive window inflated more than its members");
+      sel.window=true;
+      sel.beg=beg;
+      sel.end=end;
+      a.select(sel);
+      b.select(sel);
+      if(!a.open("./obs.tmp")||!b.open(w1.data(),w1.size()))
+        fail("could not open observation archive window");
+      while(a.next(ea)){
+        if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+          fail("observation archive epoch differs");
+        ne++;
+      }
+      if(b.next(eb)||ne!=(w==0?0:w==1?22:w==2?600:0))
+        fail("wrong number of observation archive epochs");
+    }
+    
+    fp=fopen("./arc.tmp.gz","ab"); // stale index
+    fputc(0,fp);
+    fclose(fp);
+    if(arc.open("./arc.tmp.gz"))
+      fail("stale observation archive index accepted");
+    remove("./obs.tmp");
+  }
+  
+  { // RINEX 2 with events, one member per epoch; CRINEX cannot be cut
+    Mem txt;
+    ObsArchive arc;
+    ObsFile a,b;
+    ObsEpoch ea,eb;
+    int ne=0;
+    
+    if(!ObsArchive::write("./data/rinex211.obs","./arc.tmp.gz",1)||
+       !arc.open("./arc.tmp.gz")||!arc.read(t0-1e9,t0,txt))
+      fail("could not create RINEX 2 observation archive");
+    a.open("./data/rinex211.obs");
+    if(!b.open(txt.data(),txt.size()))
+      fail("could not open RINEX 2 observation archive");
+    while(a.next(ea)){
+      if(!b.next(eb)||!sameepoch(a,ea,b,eb))
+        fail("RINEX 2 observation archive epoch differs");
+      ne++;
+    }
+    if(b.next(eb)||arc.index().mark.size()<(std::size_t)ne/2)
+      fail("wrong RINEX 2 observation archive");
+    if(ObsArchive::write("./data/rinex304.crx","./arc.tmp.gz"))
+      fail("CRINEX observation archive written");
+    remove("./arc.tmp.gz");
+    remove("./arc.tmp.gz.idx");
+  }
+}
+#endif
+
+void test_obs()
+{
+  test_obs2();
+  test_obs3();
+  test_obssel();
+  test_crx();
+  test_crxwriter();
+  test_obsindex();
+#ifdef HAVE_ZLIB
+  test_obsgz();
+  test_obsarchive();
+#endif
+}
@@ -0,0 +1,75 @@
+#include "test.h"
+
+#define CLIGHT_ 299792458.0
+
+static void test_navsoa()
+{
+  NavFile a,b;
+  std::vector<Nav> eph;
+  
+  a.read("./data/rinex211.nav");
+  b.read("./data/rinex304.nav");
+  eph=a.eph;
+  eph.insert(eph.end(),b.eph.begin(),b.eph.end());
+  eph.insert(eph.end(),a.eph.begin(),a.eph.end()); // 6 records, 1 partial block
+  
+  NavSoA soa;
+  soa.set(eph);
+  if(soa.size()!=eph.size())
+    fail("wrong number of records");
+  
+  std::size_t n=eph.size();
+  std::vector<Time> t(n);
+  std::vector<double> x(n),y(n),z(n),clk(n);
+  
+  for(int k=-120;k<=120;k++){ // every minute over +-2 hours of toe
+    for(std::size_t i=0;i<n;i++)
+      t[i]=eph[i].toe+(k*60.0+i*7.3);
+    soa.nav2ecf(&t[0],&x[0],&y[0],&z[0],&clk[0]);
+    
+    for(std::size_t i=0;i<n;i++){
+      double ref[3],dts;
+      eph[i].nav2ecf(t[i],ref,&dts);
+      if(fabs(x[i]-ref[0])>1e-6||fabs(y[i]-ref[1])>1e-6||fabs(z[i]-ref[2])>1e-6)
+        fail("batched satellite position differs from Nav::nav2ecf");
+      if(fabs(clk[i]-dts)>1e-16)
+        fail("batched satellite clock differs from Nav::nav2ecf");
+    }
+  }
+}
+
+static void test_cheb()
+{
+  NavFile f;
+  f.read("./data/rinex304.nav");
+  
+  for(const auto& eph: f.eph){
+    Cheb cheb;
+    double half=eph.prn[0]=='E'?14400.0:7200.0;
+    
+    if(!cheb.fit(eph,1e-4))
+      fail("Chebyshev fit failed");
+    if(cheb.maxerr()>1e-4)
+      fail("Chebyshev fit above tolerance");
+    
+    // every second of the validity window
+    for(double dt=-half;dt<=half;dt+=1.0){
+      Time t=eph.toe+dt;
+      double a[3],b[3],da,db;
+      eph.nav2ecf(t,a,&da);
+      if(!cheb.eval(t,b,&db))
+        fail("Chebyshev orbit should cover the validity window");
+      if(pythag(a[0]-b[0],a[1]-b[1],a[2]-b[2])>1e-4||fabs(da-db)>1e-4/CLIGHT_)
+        fail("Chebyshev orbit differs from Nav::nav2ecf");
+    }
+    double xyz[3];
+    if(cheb.eval(eph.toe+(half+1.0),xyz,0)||cheb.eval(eph.toe-(half+1.0),xyz,0))
+      fail("Chebyshev orbit evaluated outside the fitted window");
+  }
+}
+
+void test_orbit()
+{
+  test_navsoa();
+  test_cheb();
+}
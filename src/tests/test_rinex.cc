@@ -0,0 +1,240 @@
+#include "test.h"
+
+static void test_navfile()
+{
+  { // RINEX 2.11 example from the format specification 
+    NavFile nav;
+    
+    if(!nav.read("./data/rinex211.nav"))
+      fail("could not read RINEX 2.11 nav file");
+    if(fabs(nav.ver-2.11)>1e-9||nav.sys!='G'||nav.leaps!=13)
+      fail("wrong RINEX 2.11 nav header");
+    if(nav.ion[0]!=0.1676e-07||nav.ion[7]!=-0.1966e+06)
+      fail("wrong ION ALPHA/BETA");
+    if(nav.utc[0]!=0.133179128170e-06||nav.utc[2]!=552960||nav.utc[3]!=1025)
+      fail("wrong DELTA-UTC");
+    if(nav.eph.size()!=2)
+      fail("wrong number of nav records");
+    
+    const Nav& e=nav.eph[1];
+    if(strcmp(e.prn,"G13")||e.iode!=133||e.week!=1025)
+      fail("wrong nav record");
+    if(fabs(e.toc.to_double()-Time().from_rnx("1999 09 02 19 00 00").to_double())>1e-3)
+      fail("wrong RINEX 2 Time of Clock");
+    if(fabs(nav.eph[0].toc.t_frac)>1e-9||e.fit!=0.0||sqrt(e.A)!=0.515328476143e+04)
+      fail("wrong nav record");
+  }
+  
+  { // RINEX 3.04 mixed: GLONASS records are skipped
+    NavFile nav;
+    
+    if(!nav.read("./data/rinex304.nav"))
+      fail("could not read RINEX 3.04 nav file");
+    if(nav.sys!='M'||nav.leaps!=18||nav.nskip!=1||nav.eph.size()!=2)
+      fail("wrong RINEX 3.04 nav file");
+    if(nav.ion[4]!=9.0112E+04||nav.utc[1]!=-9.769962617E-15||nav.utc[3]!=2323)
+      fail("wrong RINEX 3 header corrections");
+    if(strcmp(nav.eph[0].prn,"G01")||strcmp(nav.eph[1].prn,"E02"))
+      fail("wrong nav record PRN");
+    if(nav.eph[0].nav2rnx().compare(0,80,
+"G01 2024 07 15 22 00 00 2.417615614831E-04-7.162270776462E-12 0.000000000000E+00"))
+      fail("wrong nav record");
+  }
+  
+  { // parallel decoding gives the same records
+    Mem m;
+    NavFile a,b;
+    std::string txt;
+    
+    m.load("./data/rinex304.nav");
+    txt.assign(m.data(),m.size());
+    for(int i=0;i<11;i++) // 4096 records
+      txt.append(txt.substr(txt.find("G01 2024")));
+    
+    a.read(txt.data(),txt.size(),1);
+    b.read(txt.data(),txt.size(),4);
+    if(a.eph.size()!=4096||b.eph.size()!=4096||b.nskip!=2048)
+      fail("wrong number of nav records");
+    for(std::size_t i=0;i<a.eph.size();i++)
+      if(a.eph[i].nav2rnx()!=b.eph[i].nav2rnx()||
+         a.eph[i].toe.to_double()!=b.eph[i].toe.to_double())
+        fail("parallel nav decoding differs");
+  }
+}
+
+// bitwise equality of every parameter (NaN-safe, -0.0 aware)
+static bool same(const Nav& a, const Nav& b)
+{
+#define EQ(x) !memcmp(&a.x,&b.x,sizeof(a.x))
+  return EQ(prn)&&EQ(iode)&&EQ(iodc)&&EQ(sva)&&EQ(svh)&&EQ(week)&&EQ(code)&&
+    EQ(flag)&&EQ(toe.t_sec)&&EQ(toe.t_frac)&&EQ(toc.t_sec)&&EQ(toc.t_frac)&&
+    EQ(ttr.t_sec)&&EQ(ttr.t_frac)&&EQ(A)&&EQ(e)&&EQ(i0)&&EQ(OMG0)&&EQ(omg)&&
+    EQ(M0)&&EQ(deln)&&EQ(OMGd)&&EQ(idot)&&EQ(crc)&&EQ(crs)&&EQ(cuc)&&EQ(cus)&&
+    EQ(cic)&&EQ(cis)&&EQ(toes)&&EQ(fit)&&EQ(f0)&&EQ(f1)&&EQ(f2)&&EQ(tgd)&&
+    EQ(Adot)&&EQ(ndot);
+#undef EQ
+}
+
+static void test_navcache()
+{
+  const char *tmp="./navcache.tmp";
+  
+  { // round trip: records come back sorted by satellite and bit-identical
+    NavFile a,b;
+    NavCache c;
+    std::vector<Nav> eph;
+    std::size_t i,k,n;
+    
+    a.read("./data/rinex304.nav");
+    b.read("./data/rinex211.nav");
+    eph=a.eph;
+    eph.insert(eph.end(),b.eph.begin(),b.eph.end()); // G01 E02 G06 G13
+    
+    if(!NavCache::save(tmp,eph)||!c.load(tmp))
+      fail("could not write/load ephemeris cache");
+    if(c.size()!=4||c.satellites()!=4)
+      fail("wrong cache size");
+    
+    const char *order[]={"G01","G06","G13","E02"};
+    for(i=0;i<4;i++){
+      Nav x;
+      c.get(i,x);
+      if(strcmp(x.prn,order[i]))
+        fail("wrong cache record order");
+      for(k=0;k<eph.size();k++)
+        if(!strcmp(eph[k].prn,x.prn))
+          break;
+      if(!same(x,eph[k])||x.nav2rnx()!=eph[k].nav2rnx())
+        fail("cache record differs from source");
+    }
+    
+    k=c.find("E02",&n);
+    if(k!=3||n!=1)
+      fail("wrong cache index");
+    c.find("G02",&n);
+    if(n!=0)
+      fail("wrong cache index");
+    
+    // header sizes and offsets are little-endian on any host
+    Mem f;
+    const uint8_t *h;
+    f.load(tmp);
+    h=(const uint8_t*)f.data();
+    if(h[8]!=2||h[12]!=(288&0xff)||h[13]!=(288>>8)||h[16]!=4||h[20]!=4||
+       h[24]!=64||h[31]!=0||h[32]!=64+4*16||h[39]!=0)
+      fail("wrong cache header layout");
+    
+    // a damaged index or misaligned blocks are rejected, not read
+    std::string bin(f.data(),f.size());
+    FILE *fp;
+    for(int k=0;k<3;k++){
+      std::string b=bin;
+      if(k==0)
+        b[64+4+3]=1;  // first record of G01 past the end
+      else if(k==1)
+        b[64+8]=5;    // G01 count
+      else
+        b[32]+=4;     // recoff
+      fp=fopen(tmp,"wb");
+      fwrite(b.data(),1,b.size(),fp);
+      fclose(fp);
+      if(c.load(tmp)||c.size())
+        fail("damaged ephemeris cache loaded");
+    }
+#ifdef __linux__
+    if(NavCache::save("/dev/full",eph))
+      fail("ephemeris cache written to a full disk");
+#endif
+  }
+  
+  { // many records per satellite stay contiguous and in toe order
+    NavFile a;
+    NavCache c;
+    std::vector<Nav> eph,out;
+    std::size_t k,n;
+    
+    a.read("./data/rinex211.nav");
+    for(int i=0;i<24;i++){
+      for(auto x: a.eph){
+        x.toe=x.toe+(double)(23-i)*7200.0;
+        eph.push_back(x);
+      }
+    }
+    NavCache::save(tmp,eph);
+    c.load(tmp);
+    c.get(out);
+    k=c.find("G13",&n);
+    if(out.size()!=48||k!=24||n!=24)
+      fail("wrong cache index");
+    for(std::size_t i=1;i<out.size();i++)
+      if(!strcmp(out[i].prn,out[i-1].prn)&&!(out[i-1].toe<out[i].toe))
+        fail("cache records not sorted by toe");
+  }
+  
+  { // not a cache file
+    NavCache c;
+    if(c.load("./data/rinex211.nav")||c.size())
+      fail("accepted an invalid cache file");
+  }
+  remove(tmp);
+}
+
+// the lazy view selects the same records as a store of the whole file,
+// decoding only those looked at
+static void test_navview()
+{
+  for(const char *file: {"./data/rinex211.nav","./data/rinex304.nav"}){
+    NavFile f;
+    NavView v;
+    EphemerisStore st;
+    const Nav *a,*b;
+    int ns=0;
+    
+    if(!f.read(file)||!v.open(file))
+      fail("could not open nav file view");
+    if(v.size()!=f.eph.size()||v.decoded()||v.hdr.leaps!=f.leaps||
+       v.hdr.nskip!=f.nskip||v.hdr.ion[7]!=f.ion[7])
+      fail("wrong nav file view");
+    st.add(f.eph);
+    for(const Nav& e: f.eph)
+      for(double dt: {-8000.0,-7200.0,-3600.0,0.0,1800.0,7199.0,9000.0,90000.0}){
+        a=st.select(e.prn,e.toe+dt);
+        b=v.select(e.prn,e.toe+dt);
+        if(!a!=!b||(a&&!same(*a,*b)))
+          fail("nav file view selection differs");
+        ns+=a!=0;
+      }
+    if(ns<4)
+      fail("too few nav file view selections");
+    if(v.select("R05",f.eph[0].toe)||v.select("G32",f.eph[0].toe))
+      fail("nav file view selected a missing record");
+  }
+  
+  { // 4096 records, most of them repeated broadcasts: one decoded
+    Mem m;
+    NavView v;
+    std::string txt;
+    const Nav *a,*b;
+    Time t;
+    
+    m.load("./data/rinex304.nav");
+    txt.assign(m.data(),m.size());
+    for(int i=0;i<11;i++)
+      txt.append(txt.substr(txt.find("G01 2024")));
+    
+    if(!v.open(txt.data(),txt.size())||v.size()!=4096||v.hdr.nskip!=2048)
+      fail("wrong number of nav view records");
+    t.from_rnx("2024 07 15 22 30 00");
+    a=v.select("G01",t);
+    b=v.select("G01",t+600.0);
+    if(!a||a!=b||strcmp(a->prn,"G01")||v.decoded()!=1)
+      fail("nav view record not decoded once");
+  }
+}
+
+void test_rinex()
+{
+  test_navfile();
+  test_navcache();
+  test_navview();
+}
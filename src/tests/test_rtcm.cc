@@ -0,0 +1,421 @@
+#include "test.h"
+#include "../constants.h"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef HAVE_MMAP
+  #include <sys/stat.h>
+#endif
+
+#define RANGE_MS (CLIGHT*0.001)
+
+// message bits written in order
+struct Bits{
+  uint8_t b[1024];
+  int n;
+  Bits(): n(0){ memset(b,0,sizeof(b)); }
+  void put(int len, int64_t v){
+    for(int i=n+len-1;i>=n;i--,v>>=1)
+      if(v&1)
+        b[i>>3]|=1<<(7-(i&7));
+    n+=len;
+  }
+};
+
+// RTCM 3 frame of a message (bitwise CRC-24Q)
+static std::string frame(const Bits& m)
+{
+  std::string f;
+  uint32_t c=0;
+  int n=(m.n+7)/8;
+
+  f+=(char)0xD3;
+  f+=(char)(n>>8);
+  f+=(char)(n&0xff);
+  f.append((const char*)m.b,n);
+  for(std::size_t i=0;i<f.size();i++){
+    c^=(uint32_t)(uint8_t)f[i]<<16;
+    for(int k=0;k<8;k++)
+      c=c&0x800000?(c<<1)^0x1864CFB:c<<1;
+  }
+  f+=(char)(c>>16&0xff);
+  f+=(char)(c>>8&0xff);
+  f+=(char)(c&0xff);
+  return f;
+}
+
+struct Sig{
+  int sat,id;         // MSM satellite and signal (1-based)
+  double pr,adr;      // pseudorange, phase range (m)
+  double rr;          // range rate (m/s)
+  double cn;
+  int lock,half;
+};
+
+// MSM4/5/7 of one system; cells given in satellite, signal order
+static std::string msm(int type, uint32_t epoch, int sync, const Sig *s, int ns, int ext=15)
+{
+  Bits m;
+  uint64_t sm=0;
+  uint32_t gm=0;
+  int sat[64],sig[32],nsat=0,nsig=0,kind=type%10,k,j,c;
+  double rough[64],rate[64];
+
+  for(k=0;k<ns;k++){
+    sm|=1ull<<(63-(s[k].sat-1));
+    gm|=1u<<(31-(s[k].id-1));
+  }
+  for(k=0;k<64;k++)
+    if(sm>>(63-k)&1)
+      sat[nsat++]=k+1;
+  for(k=0;k<32;k++)
+    if(gm>>(31-k)&1)
+      sig[nsig++]=k+1;
+  m.put(12,type);
+  m.put(12,7);
+  m.put(30,epoch);
+  m.put(1,sync);
+  m.put(3+7+2+2+1+3,0);
+  m.put(32,sm>>32);
+  m.put(32,sm&0xffffffff);
+  m.put(32,gm);
+  for(k=0;k<nsat;k++)
+    for(j=0;j<nsig;j++){
+      for(c=0;c<ns&&!(s[c].sat==sat[k]&&s[c].id==sig[j]);c++);
+      m.put(1,c<ns);
+    }
+  for(k=0;k<nsat;k++){
+    for(c=0;s[c].sat!=sat[k];c++);
+    rough[k]=floor(s[c].pr/RANGE_MS*1024.0)/1024.0;
+    rate[k]=round(s[c].rr);
+  }
+  for(k=0;k<nsat;k++)
+    m.put(8,(int)rough[k]);
+  if(kind!=4)
+    for(k=0;k<nsat;k++)
+      m.put(4,ext);
+  for(k=0;k<nsat;k++)
+    m.put(10,llround((rough[k]-floor(rough[k]))*1024.0));
+  if(kind!=4)
+    for(k=0;k<nsat;k++)
+      m.put(14,(int)rate[k]);
+
+#define ROUGH(c) rough[std::find(sat,sat+nsat,s[c].sat)-sat]
+  for(c=0;c<ns;c++)
+    m.put(kind==7?20:15,llround((s[c].pr/RANGE_MS-ROUGH(c))*(kind==7?536870912.0:16777216.0)));
+  for(c=0;c<ns;c++)
+    m.put(kind==7?24:22,llround((s[c].adr/RANGE_MS-ROUGH(c))*(kind==7?2147483648.0:536870912.0)));
+  for(c=0;c<ns;c++)
+    m.put(kind==7?10:4,s[c].lock);
+  for(c=0;c<ns;c++)
+    m.put(1,s[c].half);
+  for(c=0;c<ns;c++)
+    m.put(kind==7?10:6,llround(s[c].cn*(kind==7?16.0:1.0)));
+  if(kind!=4)
+    for(c=0;c<ns;c++)
+      m.put(15,llround((s[c].rr-rate[std::find(sat,sat+nsat,s[c].sat)-sat])*1e4));
+#undef ROUGH
+  return frame(m);
+}
+
+static const Sig gps1[3]={
+  {5,2,21000123.4567,21000120.1234,-640.3,45.5,700,0},  // G05 1C
+  {5,16,21000125.9,21000119.77,-640.3,38.0,650,1},      // G05 2L
+  {12,2,23456789.012,23456790.5,210.04,41.0,300,0}};    // G12 1C
+static const Sig gal1[2]={
+  {11,2,24000001.5,24000003.25,-12.5,47.0,900,0},       // E11 1C
+  {11,23,24000003.5,24000004.0,-12.5,50.0,900,0}};      // E11 5Q
+
+static bool near(double a, double b, double tol)
+{
+  return fabs(a-b)<=tol;
+}
+
+// epochs merged from the messages of each system
+static void test_rtcmmsm()
+{
+  const double l1=CLIGHT/1.57542E9,l2=CLIGHT/1.22760E9,l5=CLIGHT/1.17645E9;
+  const double lr=CLIGHT/(1.602E9-2*0.5625E6);
+  RtcmReader u;
+  ObsEpoch ep;
+  Nav eph;
+  Sig g[3],r,many[24];
+  std::string s;
+  Time t0;
+  int i,c,k;
+
+  t0.from_gps(2323,86400.0+3600.0);
+  s=msm(1077,(86400+3600)*1000,1,gps1,3)+msm(1097,(86400+3600)*1000,0,gal1,2);
+  for(k=0;k<3;k++){
+    g[k]=gps1[k];
+    g[k].pr+=100.0;
+    g[k].adr+=100.0;
+  }
+  g[0].lock=20; // G05 L1C slipped
+  r={7,2,19100000.25,19100002.5,-300.0,44.0,15,0};
+  s+=msm(1077,(86400+3601)*1000,1,g,3);
+  s+=msm(1085,(1u<<27)|((3600+1-18+10800)*1000),0,&r,1,5); // Monday, UTC(SU)
+
+  u.tref=t0;
+  u.open(s.data(),s.size());
+  if(u.next(ep,eph)!=RTCM_OBS||ep.n!=3||u.code.size()!=12||ep.ncol!=12||
+     ep.t.to_double()!=t0.to_double()||u.staid!=7)
+    fail("wrong MSM7 epoch");
+  if(u.code[0]!="C1C"||u.code[4]!="C2L"||u.code[9]!="L5Q"||
+     strcmp(ep.prn(0),"G05")||strcmp(ep.prn(1),"G12")||strcmp(ep.prn(2),"E11"))
+    fail("wrong MSM7 columns or satellites");
+  i=0;
+  if(!near(ep.obs(0,i),gps1[0].pr,1e-3)||!near(ep.obs(1,i),gps1[0].adr/l1,1e-3)||
+     !near(ep.obs(2,i),640.3/l1,1e-3)||ep.obs(3,i)!=45.5||ep.ssi[i]!=7||
+     !near(ep.obs(4,i),gps1[1].pr,1e-3)||!near(ep.obs(5,i),gps1[1].adr/l2,1e-3)||
+     ep.lli[ep.cap+i]||ep.lli[5*ep.cap+i]!=2)
+    fail("wrong MSM7 G05 observations");
+  i=1;
+  if(!near(ep.obs(0,i),gps1[2].pr,1e-3)||!std::isnan(ep.obs(4,i))||!std::isnan(ep.obs(8,i)))
+    fail("wrong MSM7 G12 observations");
+  i=2;
+  if(!near(ep.obs(0,i),gal1[0].pr,1e-3)||!near(ep.obs(8,i),gal1[1].pr,1e-3)||
+     !near(ep.obs(9,i),gal1[1].adr/l5,1e-3)||!near(ep.obs(10,i),12.5/l5,1e-3)||
+     !std::isnan(ep.obs(4,i)))
+    fail("wrong MSM7 E11 observations");
+
+  if(u.next(ep,eph)!=RTCM_OBS||ep.n!=3||(ep.t-t0).to_double()!=1.0||
+     ep.lli[ep.cap]!=1||ep.lli[ep.cap+1]||ep.find("R07")!=2)
+    fail("wrong second epoch");
+  i=2;
+  if(!near(ep.obs(0,i),r.pr,0.02)||!near(ep.obs(1,i),r.adr/lr,0.01)||
+     !near(ep.obs(2,i),300.0/lr,1e-3)||ep.obs(3,i)!=44.0)
+    fail("wrong MSM5 GLONASS observations");
+  if(u.next(ep,eph)||u.nbad)
+    fail("extra epoch decoded");
+
+  // 14 + 10 satellites: capacity grows within the epoch; the last message
+  // lost, the epoch is returned as the next one starts
+  for(k=0;k<24;k++)
+    many[k]={k%14+1,2,2e7+1e5*k,2e7+1e5*k+1.0,10.0*k,40.0,k%14,0};
+  s=msm(1074,(86400+3700)*1000,1,many,14)+msm(1094,(86400+3700)*1000,1,many+14,10);
+  s+=msm(1074,(86400+3701)*1000,1,many,14);
+  u.open(s.data(),s.size());
+  if(u.next(ep,eph)!=RTCM_OBS||ep.n!=24||ep.cap<24||
+     !near(ep.obs(0,0),2e7,0.02)||!near(ep.obs(0,13),2e7+1.3e6,0.02)||
+     !near(ep.obs(0,14),2e7+1.4e6,0.02)||strcmp(ep.prn(23),"E10")||
+     !std::isnan(ep.obs(2,0))||!near(ep.obs(1,23),(2e7+2.3e6+1.0)/l1,0.01))
+    fail("wrong merged MSM4 epoch");
+  if(u.next(ep,eph)!=RTCM_OBS||ep.n!=14||(ep.t-t0).to_double()!=101.0||u.next(ep,eph))
+    fail("wrong epoch left open");
+
+  c=s.size()/2; // CRC error: the message is dropped
+  s[c]^=0x10;
+  u.open(s.data(),s.size());
+  k=0;
+  while(u.next(ep,eph))
+    k++;
+  if(u.nbad!=1||k!=2)
+    fail("corrupt MSM frame not dropped");
+}
+
+#define R(x,sc) (int64_t)llround((x)/(sc))
+
+static std::string m1019(const Nav& e)
+{
+  Bits m;
+
+  m.put(12,1019);
+  m.put(6,atoi(e.prn+1));
+  m.put(10,e.week%1024);
+  m.put(4,e.sva);
+  m.put(2,e.code);
+  m.put(14,R(e.idot,ldexp(PI,-43)));
+  m.put(8,e.iode);
+  m.put(16,R(e.toc.gps_tow(),16));
+  m.put(8,R(e.f2,ldexp(1,-55)));
+  m.put(16,R(e.f1,ldexp(1,-43)));
+  m.put(22,R(e.f0,ldexp(1,-31)));
+  m.put(10,e.iodc);
+  m.put(16,R(e.crs,ldexp(1,-5)));
+  m.put(16,R(e.deln,ldexp(PI,-43)));
+  m.put(32,R(e.M0,ldexp(PI,-31)));
+  m.put(16,R(e.cuc,ldexp(1,-29)));
+  m.put(32,R(e.e,ldexp(1,-33)));
+  m.put(16,R(e.cus,ldexp(1,-29)));
+  m.put(32,R(sqrt(e.A),ldexp(1,-19)));
+  m.put(16,R(e.toes,16));
+  m.put(16,R(e.cic,ldexp(1,-29)));
+  m.put(32,R(e.OMG0,ldexp(PI,-31)));
+  m.put(16,R(e.cis,ldexp(1,-29)));
+  m.put(32,R(e.i0,ldexp(PI,-31)));
+  m.put(16,R(e.crc,ldexp(1,-5)));
+  m.put(32,R(e.omg,ldexp(PI,-31)));
+  m.put(24,R(e.OMGd,ldexp(PI,-43)));
+  m.put(8,R(e.tgd[0],ldexp(1,-31)));
+  m.put(6,e.svh);
+  m.put(1,e.flag);
+  m.put(1,e.fit!=4.0);
+  return frame(m);
+}
+
+static std::string m1045(const Nav& e)
+{
+  Bits m;
+
+  m.put(12,1045);
+  m.put(6,atoi(e.prn+1));
+  m.put(12,e.week-1024);
+  m.put(10,e.iode);
+  m.put(8,e.sva);
+  m.put(14,R(e.idot,ldexp(PI,-43)));
+  m.put(14,R(e.toc.gps_tow(),60));
+  m.put(6,R(e.f2,ldexp(1,-59)));
+  m.put(21,R(e.f1,ldexp(1,-46)));
+  m.put(31,R(e.f0,ldexp(1,-34)));
+  m.put(16,R(e.crs,ldexp(1,-5)));
+  m.put(16,R(e.deln,ldexp(PI,-43)));
+  m.put(32,R(e.M0,ldexp(PI,-31)));
+  m.put(16,R(e.cuc,ldexp(1,-29)));
+  m.put(32,R(e.e,ldexp(1,-33)));
+  m.put(16,R(e.cus,ldexp(1,-29)));
+  m.put(32,R(sqrt(e.A),ldexp(1,-19)));
+  m.put(14,R(e.toes,60));
+  m.put(16,R(e.cic,ldexp(1,-29)));
+  m.put(32,R(e.OMG0,ldexp(PI,-31)));
+  m.put(16,R(e.cis,ldexp(1,-29)));
+  m.put(32,R(e.i0,ldexp(PI,-31)));
+  m.put(16,R(e.crc,ldexp(1,-5)));
+  m.put(32,R(e.omg,ldexp(PI,-31)));
+  m.put(24,R(e.OMGd,ldexp(PI,-43)));
+  m.put(10,R(e.tgd[0],ldexp(1,-32)));
+  m.put(2+1+7,0);
+  return frame(m);
+}
+
+// ephemerides encoded from RINEX records decode to the same parameters
+static void test_rtcmeph()
+{
+  NavFile f;
+  Nav g,e,a;
+  ObsEpoch ep;
+  RtcmReader u;
+  std::string s;
+
+  if(!f.read("./data/rinex304.nav"))
+    fail("could not read RINEX 3.04 nav file");
+  for(const Nav& x: f.eph){
+    if(!strcmp(x.prn,"G01"))
+      g=x;
+    if(!strcmp(x.prn,"E02"))
+      e=x;
+  }
+  s=m1019(g)+m1045(e);
+  s+=s; // repeated broadcast: returned once
+
+  u.tref=g.toc;
+  u.open(s.data(),s.size());
+#define CHK(x,sc) (fabs(a.x-g.x)>(sc))
+  if(u.next(ep,a)!=RTCM_NAV||strcmp(a.prn,"G01"))
+    fail("1019 not decoded");
+  if(a.week!=g.week||a.iode!=g.iode||a.iodc!=g.iodc||a.svh!=g.svh||a.sva!=g.sva||
+     a.toe.to_double()!=g.toe.to_double()||a.toc.to_double()!=g.toc.to_double()||
+     a.fit!=g.fit||CHK(A,1e-3)||CHK(e,ldexp(1,-33))||CHK(M0,ldexp(PI,-31))||
+     CHK(OMG0,ldexp(PI,-31))||CHK(omg,ldexp(PI,-31))||CHK(i0,ldexp(PI,-31))||
+     CHK(deln,ldexp(PI,-43))||CHK(OMGd,ldexp(PI,-43))||CHK(idot,ldexp(PI,-43))||
+     CHK(crs,ldexp(1,-5))||CHK(cic,ldexp(1,-29))||CHK(f0,ldexp(1,-31))||
+     CHK(f1,ldexp(1,-43))||CHK(tgd[0],ldexp(1,-31)))
+    fail("wrong 1019 ephemeris");
+
+  g=e;
+  if(u.next(ep,a)!=RTCM_NAV||strcmp(a.prn,"E02"))
+    fail("1045 not decoded");
+  if(a.week!=g.week||a.iode!=g.iode||a.toe.to_double()!=g.toe.to_double()||
+     a.toc.to_double()!=g.toc.to_double()||CHK(A,1e-3)||CHK(e,ldexp(1,-33))||
+     CHK(M0,ldexp(PI,-31))||CHK(omg,ldexp(PI,-31))||CHK(OMGd,ldexp(PI,-43))||
+     CHK(crc,ldexp(1,-5))||CHK(cis,ldexp(1,-29))||CHK(f0,ldexp(1,-34))||
+     CHK(f1,ldexp(1,-46))||CHK(tgd[0],ldexp(1,-32)))
+    fail("wrong 1045 ephemeris");
+#undef CHK
+  if(u.next(ep,a))
+    fail("repeated ephemeris returned again");
+}
+
+// a file larger than the window reads as memory; a pipe delivers each
+// epoch while the writer still holds it open
+static void test_rtcmstream()
+{
+  RtcmReader u,v;
+  ObsEpoch ea,eb;
+  Nav eph;
+  Sig g[3];
+  std::string s;
+  FILE *fp;
+  int k,na=0;
+
+  for(k=0;k<3000;k++){ // 250 KiB
+    for(int j=0;j<3;j++){
+      g[j]=gps1[j];
+      g[j].pr+=k;
+      g[j].adr+=k;
+    }
+    s+=msm(1077,(86400+k)*1000,1,g,3)+msm(1097,(86400+k)*1000,0,gal1,2);
+    if(k%100==0)
+      s+=std::string(k%5+1,(char)0xD3);
+  }
+  fp=fopen("./rtcm.tmp","wb");
+  fwrite(s.data(),1,s.size(),fp);
+  fclose(fp);
+
+  u.tref.from_gps(2323,86400.0);
+  v.tref=u.tref;
+  u.open(s.data(),s.size());
+  if(!v.open("./rtcm.tmp"))
+    fail("could not open RTCM file");
+  while(u.next(ea,eph)==RTCM_OBS){
+    if(v.next(eb,eph)!=RTCM_OBS||ea.n!=eb.n||ea.t.to_double()!=eb.t.to_double()||
+       memcmp(&ea.val[0],&eb.val[0],ea.val.size()*sizeof(double)))
+      fail("RTCM file epoch differs");
+    na++;
+  }
+  if(na!=3000||v.next(eb,eph)||u.nbad||v.nbad)
+    fail("wrong number of RTCM file epochs");
+  remove("./rtcm.tmp");
+
+#ifdef HAVE_MMAP
+  std::atomic<bool> got(false);
+  bool late=false;
+
+  remove("./rtcm.fifo");
+  if(mkfifo("./rtcm.fifo",0600))
+    fail("could not create a pipe");
+  std::thread w([&]{
+    FILE *f=fopen("./rtcm.fifo","wb");
+    std::string a=msm(1077,86400*1000,1,gps1,3)+msm(1097,86400*1000,0,gal1,2);
+    fwrite(a.data(),1,a.size(),f);
+    fflush(f);
+    for(int i=0;i<500&&!got;i++) // the reader has it before more comes
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    late=!got;
+    a=msm(1077,86401*1000,0,gps1,3);
+    fwrite(a.data(),1,a.size(),f);
+    fclose(f);
+  });
+  if(!v.open("./rtcm.fifo"))
+    fail("could not open pipe");
+  if(v.next(eb,eph)!=RTCM_OBS||eb.n!=3)
+    fail("wrong epoch from a pipe");
+  got=true;
+  if(v.next(eb,eph)!=RTCM_OBS||eb.n!=2||v.next(eb,eph))
+    fail("wrong last epoch from a pipe");
+  w.join();
+  v.close();
+  remove("./rtcm.fifo");
+  if(late)
+    fail("epoch from a pipe waited for more data");
+#endif
+}
+
+void test_rtcm()
+{
+  test_rtcmmsm();
+  test_rtcmeph();
+  test_rtcmstream();
+}
@@ -0,0 +1,210 @@
+#include "test.h"
+
+static void test_sp3file()
+{
+  { // CODE MGEX final orbits, one day at 300 s
+    Sp3File sp3;
+    int k;
+    
+    if(!sp3.read("./data/2024_197_sp3.txt"))
+      fail("could not read SP3 file");
+    if(sp3.ver!='d'||sp3.pv!='P'||strcmp(sp3.tsys,"GPS")||
+       strcmp(sp3.crd,"IGS20")||strcmp(sp3.agency,"AIUB"))
+      fail("wrong SP3 header");
+    if(sp3.size()!=289||sp3.sat.size()!=121||sp3.dt!=300.0)
+      fail("wrong SP3 dimensions");
+    if(strcmp(sp3.sat[0].prn,"G01")||strcmp(sp3.sat[120].prn,"J04"))
+      fail("wrong SP3 satellite list");
+    if((k=sp3.find("R03"))!=34||sp3.sat[k].acc!=6||sp3.sat[k+2].acc!=5)
+      fail("wrong SP3 accuracy codes");
+    if(sp3.find("G33")!=-1||sp3.find("R06")!=-1)
+      fail("found a satellite not in the file");
+    if(sp3.t[0].to_double()!=sp3.t0.to_double()||
+       sp3.t[288].to_double()-sp3.t[0].to_double()!=86400.0)
+      fail("wrong SP3 epochs");
+    
+    const Sp3File::Sat& g=sp3.sat[0];
+    if(fabs(g.x[0]-3477832.331)>1e-8||fabs(g.y[0]+22216336.050)>1e-8||
+       fabs(g.z[0]+14243859.587)>1e-8||fabs(g.clk[0]-241.828301e-6)>1e-18||
+       fabs(g.x[1]-3833213.775)>1e-8)
+      fail("wrong SP3 position record");
+    if(g.vx.size()||g.sdp.size()||g.sdv.size())
+      fail("unexpected SP3 velocity or EP/EV columns");
+    for(auto& s: sp3.sat)
+      if(!std::isnan(s.clk[288])||std::isnan(s.x[288]))
+        fail("999999.999999 clock not flagged as missing");
+  }
+  
+  { // SP3-c specification example 2: P, EP, V and EV records
+    Sp3File sp3;
+    int k;
+    
+    if(!sp3.read("./data/sp3c_example.sp3"))
+      fail("could not read SP3-c file");
+    if(sp3.ver!='c'||sp3.pv!='V'||sp3.size()!=2||sp3.sat.size()!=26||
+       sp3.dt!=900.0||strcmp(sp3.sat[25].prn,"G31")||sp3.sat[16].acc!=9)
+      fail("wrong SP3-c header");
+    
+    const Sp3File::Sat& g=sp3.sat[1];
+    if(fabs(g.vx[0]+948.1923808)>1e-10||fabs(g.clkr[0]-8.801258e-10)>1e-22||
+       fabs(g.sdp[0]-0.055)>1e-15||fabs(g.sdp[3]-222e-12)>1e-25||
+       fabs(g.sdv[2]-22e-7)>1e-20||fabs(g.sdv[3]-111e-16)>1e-28)
+      fail("wrong SP3-c V/EP/EV records");
+    k=sp3.find("G31");
+    if(!std::isnan(sp3.sat[k].x[0])||fabs(sp3.sat[k].z[1]+13851534.050)>1e-8||
+       fabs(sp3.sat[k].clkr[1]+14.371692e-10)>1e-22)
+      fail("wrong SP3-c missing records");
+    
+    // the same file with G31 renamed as an SBAS satellite
+    Mem m;
+    Sp3File s;
+    std::string txt;
+    std::size_t p;
+    
+    m.load("./data/sp3c_example.sp3");
+    txt.assign(m.data(),m.size());
+    while((p=txt.find("G31"))!=std::string::npos)
+      txt.replace(p,3,"S23");
+    if(!s.read(txt.data(),txt.size())||s.sat.size()!=26||(k=s.find("S23"))!=25||
+       fabs(s.sat[k].z[1]+13851534.050)>1e-8)
+      fail("SBAS satellite not read from SP3");
+  }
+  
+  { // parallel decoding gives the same columns
+    Mem m;
+    Sp3File a,b;
+    std::string txt;
+    std::size_t eof;
+    
+    m.load("./data/2024_197_sp3.txt");
+    txt.assign(m.data(),m.size());
+    eof=txt.find("EOF");
+    txt.insert(eof,txt.substr(txt.find("*  "),eof-txt.find("*  "))); // 578
+    
+    a.read(txt.data(),txt.size(),1);
+    b.read(txt.data(),txt.size(),4);
+    if(a.size()!=578||b.size()!=578)
+      fail("wrong number of SP3 epochs");
+    for(std::size_t i=0;i<a.sat.size();i++)
+      if(memcmp(&a.sat[i].x[0],&b.sat[i].x[0],578*sizeof(double))||
+         memcmp(&a.sat[i].clk[0],&b.sat[i].clk[0],578*sizeof(double)))
+        fail("parallel SP3 decoding differs");
+  }
+  
+#ifdef HAVE_ZLIB
+  { // gzip-compressed file
+    Mem m,z;
+    Sp3File a,b;
+    FILE *fp;
+    
+    m.load("./data/2024_197_sp3.txt");
+    z=m.gz_encode();
+    fp=fopen("./sp3.tmp.gz","wb");
+    fwrite(z.data(),1,z.size(),fp);
+    fclose(fp);
+    
+    if(!a.read("./data/2024_197_sp3.txt")||!b.read("./sp3.tmp.gz")||
+       a.size()!=b.size()||a.sat.size()!=b.sat.size())
+      fail("could not read gzip SP3 file");
+    for(std::size_t i=0;i<a.sat.size();i++)
+      if(memcmp(&a.sat[i].x[0],&b.sat[i].x[0],a.size()*sizeof(double)))
+        fail("gzip SP3 file differs");
+    remove("./sp3.tmp.gz");
+  }
+#endif
+}
+
+static double dist3(const double *a, const double *b)
+{
+  return sqrt((a[0]-b[0])*(a[0]-b[0])+(a[1]-b[1])*(a[1]-b[1])+
+              (a[2]-b[2])*(a[2]-b[2]));
+}
+
+static void test_sp3interp()
+{
+  Sp3File sp3;
+  double xyz[3],ref[3],clk,e;
+  int k;
+  
+  sp3.read("./data/2024_197_sp3.txt");
+  
+  { // on the grid: node values, exactly
+    Sp3Interp itp(sp3,10);
+    const Sp3File::Sat& g=sp3.sat[0];
+    
+    if(!itp.set(sp3.t[100])||!itp.eval(0,xyz,&clk))
+      fail("interpolation failed");
+    if(xyz[0]!=g.x[100]||xyz[1]!=g.y[100]||xyz[2]!=g.z[100]||clk!=g.clk[100])
+      fail("wrong value on a grid node");
+    if(!itp.set(sp3.t[288])||!itp.eval(0,xyz,&clk)||xyz[0]!=g.x[288]||
+       !std::isnan(clk))
+      fail("wrong value on the last node");
+    if(itp.set(sp3.t[0]-1.0)||itp.set(sp3.t[288]+1.0)||itp.eval(0,xyz,&clk))
+      fail("extrapolated outside the arc");
+  }
+  
+  { // leave-one-out: drop an epoch and interpolate it back (all GPS)
+    for(int ord=8;ord<=12;ord+=2){
+      Sp3File d(sp3);
+      Sp3Interp itp(d,ord);
+      double emax=0.0;
+      
+      for(int i: {1,144,287}){ // arc edges and middle
+        for(k=0;k<32;k++){
+          ref[0]=d.sat[k].x[i]; ref[1]=d.sat[k].y[i]; ref[2]=d.sat[k].z[i];
+          d.sat[k].x[i]=NAN;
+          if(!itp.eval(d.sat[k].prn,d.t[i],xyz,&clk))
+            fail("interpolation across a missing epoch failed");
+          e=dist3(xyz,ref);
+          emax=std::max(emax,i==144?e:e/20.0); // edges are less accurate
+          d.sat[k].x[i]=ref[0];
+        }
+      }
+      if(emax>0.01)
+        fail("leave-one-out interpolation error above 1 cm");
+    }
+  }
+  
+  { // orders agree at mid-interval, one weight set for all satellites
+    Sp3Interp a(sp3,10),b(sp3,12);
+    std::vector<double> xa(3*sp3.sat.size()),xb(xa),ca(sp3.sat.size()),cb(ca);
+    Time t=sp3.t[150]+150.0;
+    
+    if(!a.set(t)||!b.set(t))
+      fail("interpolation failed");
+    if(a.eval(&xa[0],&ca[0])!=121||b.eval(&xb[0],&cb[0])!=121)
+      fail("wrong number of interpolated satellites");
+    for(k=0;k<121;k++)
+      if(dist3(&xa[3*k],&xb[3*k])>1e-3||ca[k]!=cb[k])
+        fail("order 10 and 12 interpolation differ");
+    
+    const Sp3File::Sat& g=sp3.sat[0];
+    if(fabs(ca[0]-0.5*(g.clk[150]+g.clk[151]))>1e-18)
+      fail("wrong clock interpolation");
+  }
+  
+  { // satellite missing for a long gap is not bridged
+    Sp3File d(sp3);
+    Sp3Interp itp(d,10);
+    
+    for(int i=100;i<140;i++)
+      d.sat[5].x[i]=NAN;
+    if(itp.eval(d.sat[5].prn,d.t[120]+10.0,xyz,&clk))
+      fail("interpolated across a long gap");
+    if(itp.eval(d.sat[5].prn,d.t[99]+10.0,xyz,&clk))
+      fail("extrapolated past the end of an arc");
+    if(!itp.eval(d.sat[5].prn,d.t[99]-10.0,xyz,&clk))
+      fail("no interpolation next to a gap");
+    for(int i=100;i<140;i++)
+      d.sat[5].x[i]=i%2?NAN:sp3.sat[5].x[i]; // every other epoch
+    if(!itp.eval(d.sat[5].prn,d.t[121],xyz,&clk)||
+       fabs(xyz[0]-sp3.sat[5].x[121])>0.01)
+      fail("wrong interpolation across single missing epochs");
+  }
+}
+
+void test_sp3()
+{
+  test_sp3file();
+  test_sp3interp();
+}
@@ -0,0 +1,152 @@
+#include "test.h"
+#include "../constants.h"
+
+// GPS and Galileo constellations spread from the G01 and E02 records
+static void constellation(EphemerisStore& nav, Nav& g, Nav& e)
+{
+  NavFile f;
+  Nav a;
+  char prn[8];
+
+  if(!f.read("./data/rinex304.nav"))
+    fail("could not read RINEX 3.04 nav file");
+  for(const Nav& x: f.eph){
+    if(!strcmp(x.prn,"G01"))
+      g=x;
+    if(!strcmp(x.prn,"E02"))
+      e=x;
+  }
+  for(int k=0;k<24;k++){ // 6 planes x 4
+    a=g;
+    a.OMG0+=(k/4)*PI/3.0;
+    a.M0+=(k%4)*PI/2.0+(k/4)*0.3;
+    snprintf(prn,sizeof(prn),"G%02d",k+1);
+    memcpy(a.prn,prn,4);
+    nav.add(a);
+  }
+  for(int k=0;k<24;k++){ // 3 planes x 8
+    a=e;
+    a.OMG0+=(k/8)*2.0*PI/3.0;
+    a.M0+=(k%8)*PI/4.0+(k/8)*0.2;
+    snprintf(prn,sizeof(prn),"E%02d",k+1);
+    memcpy(a.prn,prn,4);
+    nav.add(a);
+  }
+}
+
+// Pseudoranges of a receiver at rec (clock dtr (m), Galileo offset isb)
+// at true time t with the models of the solver; returns the satellites
+// above elmask
+static int observe(EphemerisStore& nav, const Klob& klob, const double *rec,
+  const Time& t, double dtr, double isb, double elmask, ObsEpoch& ep)
+{
+  Spheroid ell;
+  double geo[3],xs[3],los[3],azel[2],rho,dts,tgd,p;
+  int n=0;
+  char prn[8];
+
+  ell.ecf2geo(rec,geo);
+  geo[0]*=D2R;
+  geo[1]*=D2R;
+  ep.t=t+dtr/CLIGHT;
+  ep.flag=0;
+  ep.clk=0.0;
+  ep.resize(1,48);
+  ep.clear(48);
+  ep.n=0;
+  for(int k=0;k<48;k++){
+    snprintf(prn,sizeof(prn),"%c%02d",k<24?'G':'E',k%24+1);
+    const Nav *e=nav.select(prn,t);
+    Time tt=t;
+    for(int i=0;i<3;i++){
+      e->nav2ecf(tt,xs,&dts);
+      rho=geomdist(xs,rec,los);
+      tt=t-rho/CLIGHT;
+    }
+    e->nav2ecf(tt,xs,&dts);
+    rho=geomdist(xs,rec,los);
+    if(satazel(geo,los,azel)<0.0)
+      continue;
+    tgd=k<24?e->tgd[0]:(e->code>>9&1?e->tgd[1]:e->tgd[0]);
+    p=rho+dtr+(k<24?0.0:isb)-CLIGHT*(dts-tgd);
+    p+=klob.ionmod(t,geo,azel)+tropmod(geo,azel,0.7);
+    memcpy(&ep.sat[4*ep.n],prn,4);
+    ep.val[ep.n]=p;
+    ep.n++;
+    if(azel[1]>=elmask)
+      n++;
+  }
+  return n;
+}
+
+static void test_sppsolve()
+{
+  const double ref[3]={-23.5505,-46.6333,760.0}; // deg, deg, m
+  EphemerisStore nav;
+  Spheroid ell;
+  Nav g,e;
+  ObsEpoch ep;
+  std::vector<std::string> code={"C1C"};
+  double rec[3],sum;
+  Time t;
+  Spp spp;
+  int nv,ne;
+
+  constellation(nav,g,e);
+  ell.geo2ecf(ref,rec);
+  t=g.toe+600.0;
+
+  nv=observe(nav,spp.klob,rec,t,3e4,15.0,spp.elmask,ep);
+  if(nv<8)
+    fail("too few satellites in view");
+  if(!spp.solve(ep,code,nav)||spp.sol.nsat!=nv)
+    fail("no solution from the center of the earth");
+  if(fabs(spp.sol.pos[0]-rec[0])>0.01||fabs(spp.sol.pos[1]-rec[1])>0.01||
+     fabs(spp.sol.pos[2]-rec[2])>0.01||fabs(spp.sol.clk[0]-3e4)>0.01||
+     fabs(spp.sol.clk[1]-3e4-15.0)>0.01||spp.sol.rms>0.01||
+     fabs(spp.sol.geo[0]-ref[0])>1e-6||fabs(spp.sol.geo[2]-ref[2])>0.01||
+     !(spp.sol.pdop>1.0&&spp.sol.pdop<10.0)||spp.sol.t.to_double()!=ep.t.to_double())
+    fail("wrong SPP solution");
+
+  // next epochs start from the last solution: fewer iterations, and no
+  // allocation once the workspace and the ephemeris store are set up
+  sum=0.0;
+  count_allocs(true);
+  for(int k=1;k<=100;k++){
+    observe(nav,spp.klob,rec,t+(double)k,3e4+k,15.0,spp.elmask,ep);
+    if(!spp.solve(ep,code,nav)||spp.sol.niter>3)
+      fail("no SPP solution from the last one");
+    sum+=fabs(spp.sol.pos[0]-rec[0])+fabs(spp.sol.pos[1]-rec[1])+fabs(spp.sol.pos[2]-rec[2]);
+  }
+  count_allocs(false);
+  if(allocs()!=0)
+    fail("SPP solve allocates");
+  if(sum/100>0.01)
+    fail("wrong SPP solutions");
+
+  // a higher mask drops satellites
+  spp.elmask=40.0*D2R;
+  ne=observe(nav,spp.klob,rec,t,3e4,15.0,spp.elmask,ep);
+  if(ne>=nv||(ne>=5&&(!spp.solve(ep,code,nav)||spp.sol.nsat!=ne)))
+    fail("elevation mask not applied");
+
+  // GPS only: the Galileo clock is not estimated
+  spp.elmask=15.0*D2R;
+  observe(nav,spp.klob,rec,t,3e4,15.0,spp.elmask,ep);
+  for(int i=0;i<ep.n;i++)
+    if(ep.prn(i)[0]=='E')
+      ep.val[i]=NAN;
+  if(!spp.solve(ep,code,nav)||spp.sol.clk[1]!=0.0||
+     fabs(spp.sol.pos[2]-rec[2])>0.01)
+    fail("wrong GPS only SPP solution");
+
+  // too few satellites
+  ep.n=3;
+  if(spp.solve(ep,code,nav)||spp.sol.ok)
+    fail("SPP solution from 3 satellites");
+}
+
+void test_spp()
+{
+  test_sppsolve();
+}
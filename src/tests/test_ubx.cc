@@ -0,0 +1,380 @@
+#include "test.h"
+#include "../constants.h"
+
+// UBX frame around a payload (serial Fletcher checksum)
+static std::string frame(int cls, int id, const std::string& pay)
+{
+  std::string f("\xB5\x62",2);
+  uint8_t a=0,b=0;
+
+  f+=(char)cls;
+  f+=(char)id;
+  f+=(char)(pay.size()&0xff);
+  f+=(char)(pay.size()>>8);
+  f+=pay;
+  for(std::size_t i=2;i<f.size();i++){
+    a+=(uint8_t)f[i];
+    b+=a;
+  }
+  f+=(char)a;
+  f+=(char)b;
+  return f;
+}
+
+static void put(std::string& s, const void *v, int n)
+{
+  s.append((const char*)v,n);
+}
+
+static void setbits(uint8_t *b, int pos, int len, int64_t v)
+{
+  for(int i=pos+len-1;i>=pos;i--,v>>=1)
+    if(v&1)
+      b[i>>3]|=1<<(7-(i&7));
+}
+
+static uint32_t bits(const uint8_t *b, int pos)
+{
+  uint32_t v=0;
+  for(int i=pos;i<pos+32;i++)
+    v=v<<1|((b[i>>3]>>(7-(i&7)))&1);
+  return v;
+}
+
+// SFRBX of the words of one subframe or page pair
+static std::string sfrbx(int gnss, int sv, const uint32_t *w, int nw)
+{
+  std::string p;
+
+  p+=(char)gnss;
+  p+=(char)sv;
+  p+=(char)(gnss==2?1:0);
+  p+=(char)0;
+  p+=(char)nw;
+  p+=std::string(3,'\0');
+  for(int k=0;k<nw;k++)
+    put(p,&w[k],4);
+  return frame(0x02,0x13,p);
+}
+
+#define R(x,sc) (int64_t)llround((x)/(sc))
+
+// GPS LNAV subframes 1-3 of a record, 24 data bits per word
+static std::string lnav(const Nav& e, int tow)
+{
+  std::string out;
+  uint8_t b[30];
+  uint32_t w[10];
+  int i;
+
+  for(int id=1;id<=3;id++){
+    memset(b,0,sizeof(b));
+    setbits(b,0,8,0x8B);
+    setbits(b,24,17,tow/6+id);
+    setbits(b,43,3,id);
+    i=48;
+    if(id==1){
+      setbits(b,i,10,e.week%1024);           i+=10;
+      setbits(b,i,2,e.code);                 i+=2;
+      setbits(b,i,4,e.sva);                  i+=4;
+      setbits(b,i,6,e.svh);                  i+=6;
+      setbits(b,i,2,e.iodc>>8);              i+=2;
+      setbits(b,i,1,e.flag);                 i+=1+87;
+      setbits(b,i,8,R(e.tgd[0],ldexp(1,-31)));i+=8;
+      setbits(b,i,8,e.iodc&0xff);            i+=8;
+      setbits(b,i,16,R(e.toc.gps_tow(),16)); i+=16;
+      setbits(b,i,8,R(e.f2,ldexp(1,-55)));   i+=8;
+      setbits(b,i,16,R(e.f1,ldexp(1,-43)));  i+=16;
+      setbits(b,i,22,R(e.f0,ldexp(1,-31)));
+    } else if(id==2){
+      setbits(b,i,8,e.iode);                 i+=8;
+      setbits(b,i,16,R(e.crs,ldexp(1,-5)));  i+=16;
+      setbits(b,i,16,R(e.deln,ldexp(PI,-43)));i+=16;
+      setbits(b,i,32,R(e.M0,ldexp(PI,-31))); i+=32;
+      setbits(b,i,16,R(e.cuc,ldexp(1,-29))); i+=16;
+      setbits(b,i,32,R(e.e,ldexp(1,-33)));   i+=32;
+      setbits(b,i,16,R(e.cus,ldexp(1,-29))); i+=16;
+      setbits(b,i,32,R(sqrt(e.A),ldexp(1,-19)));i+=32;
+      setbits(b,i,16,R(e.toes,16));          i+=16;
+      setbits(b,i,1,e.fit!=4.0);
+    } else {
+      setbits(b,i,16,R(e.cic,ldexp(1,-29))); i+=16;
+      setbits(b,i,32,R(e.OMG0,ldexp(PI,-31)));i+=32;
+      setbits(b,i,16,R(e.cis,ldexp(1,-29))); i+=16;
+      setbits(b,i,32,R(e.i0,ldexp(PI,-31))); i+=32;
+      setbits(b,i,16,R(e.crc,ldexp(1,-5)));  i+=16;
+      setbits(b,i,32,R(e.omg,ldexp(PI,-31)));i+=32;
+      setbits(b,i,24,R(e.OMGd,ldexp(PI,-43)));i+=24;
+      setbits(b,i,8,e.iode);                 i+=8;
+      setbits(b,i,14,R(e.idot,ldexp(PI,-43)));
+    }
+    for(int k=0;k<10;k++)
+      w[k]=(bits(b,24*k)>>8)<<6; // parity bits left 0
+    out+=sfrbx(0,atoi(e.prn+1),w,10);
+  }
+  return out;
+}
+
+// Galileo I/NAV word types 1-5 of a record, each as an even/odd page pair
+static std::string inav(const Nav& e, int tow)
+{
+  std::string out;
+  uint8_t wd[16],pg[32];
+  uint32_t w[8];
+  int i,iod=e.iode;
+
+  for(int t=1;t<=5;t++){
+    memset(wd,0,sizeof(wd));
+    setbits(wd,0,6,t);
+    i=6;
+    if(t==1){
+      setbits(wd,i,10,iod);                  i+=10;
+      setbits(wd,i,14,R(e.toes,60));         i+=14;
+      setbits(wd,i,32,R(e.M0,ldexp(PI,-31)));i+=32;
+      setbits(wd,i,32,R(e.e,ldexp(1,-33)));  i+=32;
+      setbits(wd,i,32,R(sqrt(e.A),ldexp(1,-19)));
+    } else if(t==2){
+      setbits(wd,i,10,iod);                  i+=10;
+      setbits(wd,i,32,R(e.OMG0,ldexp(PI,-31)));i+=32;
+      setbits(wd,i,32,R(e.i0,ldexp(PI,-31)));i+=32;
+      setbits(wd,i,32,R(e.omg,ldexp(PI,-31)));i+=32;
+      setbits(wd,i,14,R(e.idot,ldexp(PI,-43)));
+    } else if(t==3){
+      setbits(wd,i,10,iod);                  i+=10;
+      setbits(wd,i,24,R(e.OMGd,ldexp(PI,-43)));i+=24;
+      setbits(wd,i,16,R(e.deln,ldexp(PI,-43)));i+=16;
+      setbits(wd,i,16,R(e.cuc,ldexp(1,-29)));i+=16;
+      setbits(wd,i,16,R(e.cus,ldexp(1,-29)));i+=16;
+      setbits(wd,i,16,R(e.crc,ldexp(1,-5))); i+=16;
+      setbits(wd,i,16,R(e.crs,ldexp(1,-5))); i+=16;
+      setbits(wd,i,8,e.sva);
+    } else if(t==4){
+      setbits(wd,i,10,iod);                  i+=10;
+      setbits(wd,i,6,atoi(e.prn+1));         i+=6;
+      setbits(wd,i,16,R(e.cic,ldexp(1,-29)));i+=16;
+      setbits(wd,i,16,R(e.cis,ldexp(1,-29)));i+=16;
+      setbits(wd,i,14,R(e.toc.gps_tow(),60));i+=14;
+      setbits(wd,i,31,R(e.f0,ldexp(1,-34))); i+=31;
+      setbits(wd,i,21,R(e.f1,ldexp(1,-46))); i+=21;
+      setbits(wd,i,6,R(e.f2,ldexp(1,-59)));
+    } else {
+      i+=11+11+14+5;
+      setbits(wd,i,10,R(e.tgd[0],ldexp(1,-32)));i+=10;
+      setbits(wd,i,10,R(e.tgd[1],ldexp(1,-32)));i+=10+6;
+      setbits(wd,i,12,e.week-1024);          i+=12;
+      setbits(wd,i,20,tow+2*t);
+    }
+    memset(pg,0,sizeof(pg));
+    for(i=0;i<112;i++) // even page: bits 2-113, odd page: bits 130-145
+      setbits(pg,2+i,1,wd[i>>3]>>(7-(i&7)));
+    setbits(pg,128,1,1);
+    for(i=112;i<128;i++)
+      setbits(pg,130+i-112,1,wd[i>>3]>>(7-(i&7)));
+    for(int k=0;k<8;k++)
+      w[k]=bits(pg,32*k);
+    out+=sfrbx(2,atoi(e.prn+1),w,8);
+  }
+  return out;
+}
+
+struct Meas{ int gnss,sv,sig; double pr,cp; float dop; int lock,cno,trk; };
+
+static std::string rawx(int week, double tow, const Meas *m, int n)
+{
+  std::string p;
+  uint16_t w=week;
+
+  put(p,&tow,8);
+  put(p,&w,2);
+  p+=(char)18;
+  p+=(char)n;
+  p+=std::string(4,'\0');
+  for(int k=0;k<n;k++){
+    uint16_t lt=m[k].lock;
+    put(p,&m[k].pr,8);
+    put(p,&m[k].cp,8);
+    put(p,&m[k].dop,4);
+    p+=(char)m[k].gnss;
+    p+=(char)m[k].sv;
+    p+=(char)m[k].sig;
+    p+=(char)0;
+    put(p,&lt,2);
+    p+=(char)m[k].cno;
+    p+=std::string(3,'\0');
+    p+=(char)m[k].trk;
+    p+=(char)0;
+  }
+  return frame(0x02,0x15,p);
+}
+
+// epochs of signals named by their RINEX codes
+static void test_ubxrawx()
+{
+  Meas m[5]={{0,5,0,2.1e7,1.1e8,-1200.5f,5000,45,7},  // G05 C1C
+             {0,5,3,2.1e7+3.5,8.6e7,-935.25f,4000,38,15}, // G05 C2L, half cycle subtracted
+             {2,11,1,2.4e7,1.3e8,300.0f,7000,41,1},   // E11 C1B, phase invalid
+             {6,7,0,1.9e7,1.0e8,55.0f,100,30,3},      // R07 C1C
+             {1,133,0,3.7e7,1.9e8,1.5f,2000,44,3}};   // S33 C1C
+  ObsEpoch ep;
+  Nav eph;
+  UbxReader u;
+  std::string s;
+  int c,i;
+
+  s=rawx(2323,86400.5,m,5);
+  m[0].lock=10; // G05 L1C slipped
+  m[0].pr+=1.0;
+  s+="\x01\x02\xB5"+rawx(2323,86401.5,m,5)+std::string("\xB5\x62\x02\x15\x40",5);
+
+  u.open(s.data(),s.size());
+  if(u.next(ep,eph)!=UBX_RAWX||ep.n!=4||u.code.size()!=12||ep.ncol!=12||
+     u.code[0]!="C1C"||u.code[5]!="L2L"||u.code[8]!="C1B"||
+     ep.t.to_double()!=Time().from_gps(2323,86400.5).to_double())
+    fail("wrong RAWX epoch");
+  if(strcmp(ep.prn(0),"G05")||strcmp(ep.prn(2),"R07")||strcmp(ep.prn(3),"S33")||
+     ep.find("E11")!=1)
+    fail("wrong RAWX satellites");
+  c=0; i=0;
+  if(ep.obs(c,i)!=2.1e7||ep.obs(c+1,i)!=1.1e8||ep.obs(c+2,i)!=-1200.5||
+     ep.obs(c+3,i)!=45||ep.obs(4,i)!=2.1e7+3.5||ep.obs(6,i)!=-935.25||
+     ep.ssi[i]!=7||ep.lli[ep.cap+i]||ep.lli[5*ep.cap+i])
+    fail("wrong RAWX G05 observations");
+  if(ep.obs(8,1)!=2.4e7||!std::isnan(ep.obs(9,1))||!std::isnan(ep.obs(0,1))||
+     ep.obs(0,2)!=1.9e7||ep.lli[ep.cap+2]!=2)
+    fail("wrong RAWX observations");
+
+  if(u.next(ep,eph)!=UBX_RAWX||ep.n!=4||ep.obs(0,0)!=2.1e7+1.0||
+     ep.lli[ep.cap]!=1||ep.lli[5*ep.cap]||ep.lli[ep.cap+2]!=2)
+    fail("RAWX lock time slip not flagged");
+  if(u.next(ep,eph)||u.nbad)
+    fail("truncated RAWX frame decoded");
+
+  s[20]^=1; // checksum error: dropped, the next frame found
+  u.open(s.data(),s.size());
+  if(u.next(ep,eph)!=UBX_RAWX||ep.obs(0,0)!=2.1e7+1.0||u.nbad!=1||u.next(ep,eph))
+    fail("corrupt RAWX frame not dropped");
+}
+
+// ephemerides encoded from RINEX records decode to the same parameters
+static void test_ubxsfrbx()
+{
+  NavFile f;
+  Nav g,e,a;
+  ObsEpoch ep;
+  UbxReader u;
+  std::string s;
+  Meas m={0,1,0,2e7,1e8,0.0f,0,40,3};
+
+  if(!f.read("./data/rinex304.nav"))
+    fail("could not read RINEX 3.04 nav file");
+  for(const Nav& x: f.eph){
+    if(!strcmp(x.prn,"G01"))
+      g=x;
+    if(!strcmp(x.prn,"E02"))
+      e=x;
+  }
+  s=lnav(g,(int)g.toc.gps_tow())+inav(e,(int)e.toc.gps_tow());
+  s+=s; // repeated broadcast: returned once
+  s=rawx(2323,g.toc.gps_tow(),&m,1)+s;
+
+  u.open(s.data(),s.size());
+  if(u.next(ep,a)!=UBX_RAWX||u.next(ep,a)!=UBX_NAV||strcmp(a.prn,"G01"))
+    fail("GPS LNAV subframes not decoded");
+#define CHK(x,sc) (fabs(a.x-g.x)>(sc))
+  if(a.week!=g.week||a.iode!=g.iode||a.iodc!=g.iodc||a.svh!=g.svh||
+     a.toe.to_double()!=g.toe.to_double()||a.toc.to_double()!=g.toc.to_double()||
+     a.toes!=g.toes||a.fit!=g.fit||CHK(A,1e-3)||CHK(e,ldexp(1,-33))||
+     CHK(M0,ldexp(PI,-31))||CHK(OMG0,ldexp(PI,-31))||CHK(omg,ldexp(PI,-31))||
+     CHK(i0,ldexp(PI,-31))||CHK(deln,ldexp(PI,-43))||CHK(OMGd,ldexp(PI,-43))||
+     CHK(idot,ldexp(PI,-43))||CHK(crs,ldexp(1,-5))||CHK(cic,ldexp(1,-29))||
+     CHK(f0,ldexp(1,-31))||CHK(f1,ldexp(1,-43))||CHK(tgd[0],ldexp(1,-31)))
+    fail("wrong GPS LNAV ephemeris");
+
+  g=e;
+  if(u.next(ep,a)!=UBX_NAV||strcmp(a.prn,"E02"))
+    fail("Galileo I/NAV words not decoded");
+  if(a.week!=g.week||a.iode!=g.iode||a.toe.to_double()!=g.toe.to_double()||
+     a.toc.to_double()!=g.toc.to_double()||CHK(A,1e-3)||CHK(e,ldexp(1,-33))||
+     CHK(M0,ldexp(PI,-31))||CHK(omg,ldexp(PI,-31))||CHK(OMGd,ldexp(PI,-43))||
+     CHK(crc,ldexp(1,-5))||CHK(cis,ldexp(1,-29))||CHK(f0,ldexp(1,-34))||
+     CHK(f1,ldexp(1,-46))||CHK(tgd[0],ldexp(1,-32)))
+    fail("wrong Galileo I/NAV ephemeris");
+#undef CHK
+  if(u.next(ep,a))
+    fail("repeated ephemeris returned again");
+
+  { // same orbit, to the broadcast resolution (angles 2^-31 pi: 4 cm)
+    double x[3],y[3],c0,c1;
+    a.nav2ecf(g.toe+600.0,x,&c0);
+    g.nav2ecf(g.toe+600.0,y,&c1);
+    if(fabs(x[0]-y[0])>0.1||fabs(x[1]-y[1])>0.1||fabs(x[2]-y[2])>0.1||
+       fabs(c0-c1)>1e-12)
+      fail("decoded Galileo ephemeris orbit differs");
+  }
+}
+
+// NAV-PVT; a file stream of many frames reads as the memory one
+static void test_ubxstream()
+{
+  UbxReader u,v;
+  ObsEpoch ea,eb;
+  Nav eph;
+  std::string p(92,'\0'),s;
+  Meas m[20];
+  int32_t x;
+  FILE *fp;
+  int k,na=0,nb=0;
+
+  p[4]=(char)0xE8; p[5]=0x07; // 2024-07-15 10:20:30.25
+  p[6]=7; p[7]=15; p[8]=10; p[9]=20; p[10]=30; p[11]=7;
+  x=250000000; memcpy(&p[16],&x,4);
+  p[20]=3; p[21]=1; p[23]=17;
+  x=-477000000; memcpy(&p[24],&x,4);
+  x=-225000000; memcpy(&p[28],&x,4);
+  x=812345; memcpy(&p[32],&x,4);
+  x=-150; memcpy(&p[56],&x,4);
+  p[76]=(char)0x8F; p[77]=0x01;
+
+  s=frame(0x01,0x07,p);
+  u.open(s.data(),s.size());
+  if(u.next(ea,eph)!=UBX_PVT||u.pvt.fix!=3||!u.pvt.ok||u.pvt.nsat!=17||
+     fabs(u.pvt.lat+22.5)>1e-9||fabs(u.pvt.lon+47.7)>1e-9||fabs(u.pvt.hgt-812.345)>1e-9||
+     fabs(u.pvt.vel[2]+0.15)>1e-9||fabs(u.pvt.pdop-3.99)>1e-9||
+     fabs(u.pvt.t.to_double()-Time().from_rnx("2024 07 15 10 20 30.25").to_double())>1e-6)
+    fail("wrong NAV-PVT solution");
+
+  for(k=0;k<20;k++)
+    m[k]={k%3==0?2:0,k+1,0,2e7+k,1e8+k,(float)k,k,30+k,3};
+  s.clear();
+  for(k=0;k<2000;k++){ // 1.3 MiB, larger than the file window
+    m[k%20].pr+=k;
+    s+=rawx(2323,k,m,20);
+    if(k%100==0)
+      s+=std::string(k%7+1,(char)0xB5);
+  }
+  fp=fopen("./ubx.tmp","wb");
+  fwrite(s.data(),1,s.size(),fp);
+  fclose(fp);
+
+  u.open(s.data(),s.size());
+  if(!v.open("./ubx.tmp"))
+    fail("could not open UBX file");
+  while(u.next(ea,eph)==UBX_RAWX){
+    if(v.next(eb,eph)!=UBX_RAWX||ea.n!=eb.n||ea.t.to_double()!=eb.t.to_double()||
+       memcmp(&ea.val[0],&eb.val[0],ea.val.size()*sizeof(double)))
+      fail("UBX file epoch differs");
+    na++;
+  }
+  while(v.next(eb,eph))
+    nb++;
+  if(na!=2000||nb||u.nbad||v.nbad)
+    fail("wrong number of UBX file epochs");
+  remove("./ubx.tmp");
+}
+
+void test_ubx()
+{
+  test_ubxrawx();
+  test_ubxsfrbx();
+  test_ubxstream();
+}
@@ -0,0 +1,558 @@
+// ---------------------------------------------------------------------------
+//  Copyright (C) 2009-2024, All rights reserved. Andre Caceres Carrilho
+//
+//   ubx.cc --u-blox UBX binary stream decoder (RAWX, SFRBX, NAV-PVT)
+// ---------------------------------------------------------------------------
+
+#include "kepler.h"
+#include "constants.h"
+
+#define UBX_BUFSIZE (1<<20)  // file window, holds the largest frame
+#define UBX_SLOTS   (8*64)   // gnssId x svId
+#define UBX_SUBLEN  96       // LNAV subframes 1-3 (3x30) or I/NAV words 1-5 (5x16)
+
+#define P2_5  0.03125
+#define P2_19 1.9073486328125E-06
+#define P2_29 1.862645149230957E-09
+#define P2_31 4.656612873077393E-10
+#define P2_32 2.328306436538696E-10
+#define P2_33 1.164153218269348E-10
+#define P2_34 5.820766091346741E-11
+#define P2_43 1.136868377216160E-13
+#define P2_46 1.421085471520200E-14
+#define P2_55 2.775557561562891E-17
+#define P2_59 1.734723475976807E-18
+
+// little-endian payload fields
+static inline uint16_t U2(const uint8_t *p){ return p[0]|p[1]<<8; }
+static inline uint32_t U4(const uint8_t *p){ return U2(p)|(uint32_t)U2(p+2)<<16; }
+static inline int32_t  I4(const uint8_t *p){ return (int32_t)U4(p); }
+static inline float R4(const uint8_t *p){ uint32_t u=U4(p); float f; memcpy(&f,&u,4); return f; }
+static inline double R8(const uint8_t *p)
+{
+  uint64_t u=U4(p)|(uint64_t)U4(p+4)<<32;
+  double d;
+  memcpy(&d,&u,8);
+  return d;
+}
+
+// big-endian bit fields of navigation words
+static uint32_t getbitu(const uint8_t *b, int pos, int len)
+{
+  uint32_t v=0;
+  for(int i=pos;i<pos+len;i++)
+    v=v<<1|((b[i>>3]>>(7-(i&7)))&1);
+  return v;
+}
+
+static int32_t getbits(const uint8_t *b, int pos, int len)
+{
+  uint32_t v=getbitu(b,pos,len);
+  return len<32&&(v>>(len-1))?(int32_t)(v|(~0u<<len)):(int32_t)v;
+}
+
+static void setbitu(uint8_t *b, int pos, int len, uint32_t v)
+{
+  for(int i=pos+len-1;i>=pos;i--,v>>=1)
+    if(v&1)
+      b[i>>3]|=1<<(7-(i&7));
+    else
+      b[i>>3]&=~(1<<(7-(i&7)));
+}
+
+// Fletcher checksum as sums: ck_a is the byte sum and ck_b the sum of
+// the bytes weighted by their distance from the end, so the loop has
+// no carried dependency and vectorizes
+static inline bool checksum(const uint8_t *p, int n, const uint8_t *ck)
+{
+  uint32_t a=0,b=0;
+  for(int i=0;i<n;i++){
+    a+=p[i];
+    b+=(uint32_t)(n-i)*p[i];
+  }
+  return (uint8_t)a==ck[0]&&(uint8_t)b==ck[1];
+}
+
+// satellite id and slot of gnssId, svId (-1 if not a satellite)
+static int satid(int gnss, int sv, char *prn)
+{
+  static const char sys[]="GSEC?JRI";
+  int k;
+
+  if(gnss<0||gnss>7||gnss==4)
+    return -1;
+  k=sv;
+  if(gnss==1)
+    k=sv-100; // SBAS 120-158: "S20"
+  if(gnss==5&&sv>=193)
+    k=sv-192; // QZSS 193-202
+  if(k<1||k>64)
+    return -1;
+  prn[0]=sys[gnss];
+  prn[1]='0'+k/10;
+  prn[2]='0'+k%10;
+  prn[3]='\0';
+  return gnss*64+k-1;
+}
+
+// RINEX band and attribute of gnssId, sigId ("1C"), 0: not a signal
+static const char *sigcode(int gnss, int sig)
+{
+  static const char *tab[8][10]={
+    {"1C",0,0,"2L","2S",0,"5I","5Q",0,0},         // GPS
+    {"1C",0,0,0,0,0,0,0,0,0},                     // SBAS
+    {"1C","1B",0,"5I","5Q","7I","7Q",0,0,0},      // Galileo
+    {"2I","2I","7I","7I",0,"1P","1D","5P","5D",0},// BeiDou
+    {0,0,0,0,0,0,0,0,0,0},
+    {"1C","1Z",0,0,"2S","2L",0,0,"5I","5Q"},      // QZSS
+    {"1C",0,"2C",0,0,0,0,0,0,0},                  // GLONASS
+    {"5A",0,0,0,0,0,0,0,0,0}};                    // NavIC
+  return gnss>=0&&gnss<8&&sig>=0&&sig<10?tab[gnss][sig]:0;
+}
+
+static void adjweek(Time& t, const Time& t0)
+{
+  double tt=(t-t0).to_double();
+  if(tt<-302400.0)
+    t.t_sec+=604800;
+  if(tt> 302400.0)
+    t.t_sec-=604800;
+}
+
+//////////////////////////////////////////////////////////////////////
+//  UBX stream reader
+
+UbxReader::UbxReader()
+  : nbad(0), fp(0), src(0), beg(0), end(0), eof(true)
+{
+  reset();
+}
+
+UbxReader::~UbxReader()
+{
+  close();
+}
+
+void UbxReader::reset()
+{
+  code.clear();
+  pvt=UbxPvt();
+  nbad=0;
+  for(auto& c: col)
+    for(int& k: c)
+      k=-1;
+  lock.clear();
+  row.assign(UBX_SLOTS,-1);
+  sub.assign(UBX_SLOTS*UBX_SUBLEN,0);
+  have.assign(UBX_SLOTS,0);
+  iod.assign(UBX_SLOTS,-1);
+  week=0;
+}
+
+// files are read in windows, pipes as well (fread blocks for data)
+bool UbxReader::open(const char *filepath)
+{
+  close();
+  reset();
+  if(!(fp=fopen(filepath,"rb"))){
+#ifdef DEBUG
+    warn("cannot open file");
+#endif
+    return false;
+  }
+  buf.resize(UBX_BUFSIZE);
+  eof=false;
+  return true;
+}
+
+void UbxReader::open(const char *s, std::size_t n)
+{
+  close();
+  reset();
+  src=s;
+  beg=0;
+  end=n;
+  eof=true;
+}
+
+void UbxReader::close()
+{
+  if(fp)
+    fclose(fp);
+  fp=0;
+  src=0;
+  beg=end=0;
+  eof=true;
+}
+
+// keeps the unscanned bytes, reads more after them
+void UbxReader::fill()
+{
+  std::size_t k;
+
+  if(!fp){
+    eof=true;
+    return;
+  }
+  if(beg){
+    memmove(buf.data(),buf.data()+beg,end-beg);
+    end-=beg;
+    beg=0;
+  }
+  k=fread(buf.data()+end,1,buf.size()-end,fp);
+  end+=k;
+  if(!k)
+    eof=true;
+}
+
+// Frames are returned in place: the pointer (at the sync characters)
+// is valid until the next call. A frame whose checksum fails is
+// dropped one byte at a time, a sync pair inside it may start a frame.
+const uint8_t *UbxReader::frame(int *len)
+{
+  const uint8_t *p,*q;
+  std::size_t k;
+  int n;
+
+  for(;;){
+    p=(const uint8_t*)(src?src:buf.data());
+    q=(const uint8_t*)memchr(p+beg,0xB5,end-beg);
+    if(!q){
+      beg=end;
+      if(eof)
+        return 0;
+      fill();
+      continue;
+    }
+    k=q-p;
+    if(end-k<8||(q[1]==0x62&&end-k<8+(std::size_t)U2(q+4))){ // not all in the window
+      if(!eof){
+        beg=k;
+        fill();
+        continue;
+      }
+      beg=end-k<8?end:k+1; // truncated by the end of the data
+      continue;
+    }
+    n=U2(q+4);
+    if(q[1]!=0x62){
+      beg=k+1;
+      continue;
+    }
+    if(!checksum(q+2,n+4,q+6+n)){
+      nbad++;
+      beg=k+1;
+      continue;
+    }
+    beg=k+8+n;
+    *len=n;
+    return q;
+  }
+}
+
+int UbxReader::next(ObsEpoch& ep, Nav& eph)
+{
+  const uint8_t *p;
+  int n;
+
+  while((p=frame(&n))){
+    if(p[2]==0x02&&p[3]==0x15&&rawx(p+6,n,ep))
+      return UBX_RAWX;
+    if(p[2]==0x02&&p[3]==0x13&&sfrbx(p+6,n,eph))
+      return UBX_NAV;
+    if(p[2]==0x01&&p[3]==0x07&&navpvt(p+6,n))
+      return UBX_PVT;
+  }
+  return 0;
+}
+
+// first of the C, L, D and S columns of a signal, added when first seen;
+// columns are shared by the systems with the same code, as in ObsFile
+int UbxReader::sigcol(int gnss, int sig)
+{
+  const char *s;
+  std::string c;
+  std::size_t j;
+
+  if(col[gnss][sig]>=0)
+    return col[gnss][sig];
+  if(!(s=sigcode(gnss,sig)))
+    return -1;
+  c=std::string("C")+s;
+  for(j=0;j<code.size()&&code[j]!=c;j++);
+  if(j==code.size()){
+    for(const char *o="CLDS";*o;o++)
+      code.push_back(std::string(1,*o)+s);
+    lock.resize(code.size()/4*UBX_SLOTS,0);
+  }
+  return col[gnss][sig]=j;
+}
+
+// RXM-RAWX: receiver time, then 32 bytes per signal. Lock time going
+// down is a cycle slip (LLI 1), unresolved half cycles are LLI 2.
+bool UbxReader::rawx(const uint8_t *p, int n, ObsEpoch& ep)
+{
+  const uint8_t *m;
+  int i,k,c,nm,g,sl,st;
+  uint16_t lt;
+  char prn[4];
+  std::size_t j;
+
+  if(n<16||n<16+32*(nm=p[11]))
+    return false;
+  for(k=0,m=p+16;k<nm;k++,m+=32) // new signals first: columns are fixed below
+    if(m[20]<8&&m[22]<10&&satid(m[20],m[21],prn)>=0)
+      sigcol(m[20],m[22]);
+
+  week=U2(p+8);
+  ep.t.from_gps(week,R8(p));
+  ep.flag=0;
+  ep.clk=0.0;
+  ep.n=0;
+  ep.resize(code.size(),nm);
+  ep.clear(nm);
+
+  for(k=0,m=p+16;k<nm;k++,m+=32){
+    if(m[20]>=8||m[22]>=10||(sl=satid(m[20],m[21],prn))<0||
+       (c=col[m[20]][m[22]])<0)
+      continue;
+    if((i=row[sl])<0){
+      i=row[sl]=ep.n++;
+      memcpy(&ep.sat[4*i],prn,4);
+    }
+    st=m[30];
+    j=(std::size_t)c*ep.cap+i;
+    if(st&1)
+      ep.val[j]=R8(m);
+    if(st&2)
+      ep.val[j+ep.cap]=R8(m+8);
+    ep.val[j+2*ep.cap]=R4(m+16);
+    ep.val[j+3*ep.cap]=m[26];
+
+    g=c/4*UBX_SLOTS+sl;
+    lt=U2(m+24);
+    ep.lli[j+ep.cap]=(lt<lock[g]?1:0)|((st&2)&&!(st&4)?2:0);
+    lock[g]=lt;
+    for(int o=0;o<4;o++)
+      ep.ssi[j+o*ep.cap]=m[26]?std::min(std::max(m[26]/6,1),9):0;
+  }
+  for(k=0,m=p+16;k<nm;k++,m+=32) // rows free for the next epoch
+    if((sl=satid(m[20],m[21],prn))>=0)
+      row[sl]=-1;
+  return true;
+}
+
+// GPS/QZSS LNAV subframes 1-3 (24 data bits of each word, TLM first)
+static bool lnav(const uint8_t *b, int week0, char sys, int sv, Nav& e)
+{
+  const uint8_t *s1=b,*s2=b+30,*s3=b+60;
+  int i,iodc,iode2,iode3,tow;
+  double toc,sqrtA;
+  Time ttr;
+
+  i=48;
+  e.week=getbitu(s1,i,10);          i+=10;
+  e.code=getbitu(s1,i,2);           i+=2;
+  e.sva =getbitu(s1,i,4);           i+=4;
+  e.svh =getbitu(s1,i,6);           i+=6;
+  iodc  =getbitu(s1,i,2)<<8;        i+=2;
+  e.flag=getbitu(s1,i,1);           i+=1+87;
+  e.tgd[0]=getbits(s1,i,8)*P2_31;   i+=8;
+  iodc |=getbitu(s1,i,8);           i+=8;
+  toc   =getbitu(s1,i,16)*16.0;     i+=16;
+  e.f2  =getbits(s1,i,8)*P2_55;     i+=8;
+  e.f1  =getbits(s1,i,16)*P2_43;    i+=16;
+  e.f0  =getbits(s1,i,22)*P2_31;
+
+  i=48;
+  iode2 =getbitu(s2,i,8);           i+=8;
+  e.crs =getbits(s2,i,16)*P2_5;     i+=16;
+  e.deln=getbits(s2,i,16)*P2_43*PI; i+=16;
+  e.M0  =getbits(s2,i,32)*P2_31*PI; i+=32;
+  e.cuc =getbits(s2,i,16)*P2_29;    i+=16;
+  e.e   =getbitu(s2,i,32)*P2_33;    i+=32;
+  e.cus =getbits(s2,i,16)*P2_29;    i+=16;
+  sqrtA =getbitu(s2,i,32)*P2_19;    i+=32;
+  e.toes=getbitu(s2,i,16)*16.0;     i+=16;
+  e.fit =getbitu(s2,i,1)?0.0:4.0;   // 0: 4 hours
+
+  i=48;
+  e.cic =getbits(s3,i,16)*P2_29;    i+=16;
+  e.OMG0=getbits(s3,i,32)*P2_31*PI; i+=32;
+  e.cis =getbits(s3,i,16)*P2_29;    i+=16;
+  e.i0  =getbits(s3,i,32)*P2_31*PI; i+=32;
+  e.crc =getbits(s3,i,16)*P2_5;     i+=16;
+  e.omg =getbits(s3,i,32)*P2_31*PI; i+=32;
+  e.OMGd=getbits(s3,i,24)*P2_43*PI; i+=24;
+  iode3 =getbitu(s3,i,8);           i+=8;
+  e.idot=getbits(s3,i,14)*P2_43*PI;
+
+  if(iode2!=iode3||iode2!=(iodc&0xff))
+    return false; // subframes of different issues
+  e.iode=iode2;
+  e.iodc=iodc;
+  e.A=sqrtA*sqrtA;
+  e.tgd[1]=e.tgd[2]=e.tgd[3]=0.0;
+  e.Adot=e.ndot=0.0;
+  e.prn[0]=sys;
+  e.prn[1]='0'+sv/10;
+  e.prn[2]='0'+sv%10;
+  e.prn[3]='\0';
+
+  // 10-bit week next to the receiver week (GPS week 2048 on before one)
+  e.week+=week0>0?(week0-e.week+512)/1024*1024:2048;
+  tow=getbitu(s1,24,17)*6;
+  ttr.from_gps(e.week,tow-6.0);
+  e.ttr=ttr;
+  e.toe.from_gps(e.week,e.toes);
+  e.toc.from_gps(e.week,toc);
+  adjweek(e.toe,ttr);
+  adjweek(e.toc,ttr);
+  return true;
+}
+
+// Galileo I/NAV word types 1-5 (16 bytes each)
+static bool inav(const uint8_t *b, char *prn, Nav& e)
+{
+  const uint8_t *w1=b,*w2=b+16,*w3=b+32,*w4=b+48,*w5=b+64;
+  int i,iod[4],e5hs,e1hs,e5dv,e1dv,tow;
+  double sqrtA,toc;
+
+  i=6;
+  iod[0]=getbitu(w1,i,10);          i+=10;
+  e.toes=getbitu(w1,i,14)*60.0;     i+=14;
+  e.M0  =getbits(w1,i,32)*P2_31*PI; i+=32;
+  e.e   =getbitu(w1,i,32)*P2_33;    i+=32;
+  sqrtA =getbitu(w1,i,32)*P2_19;
+
+  i=6;
+  iod[1]=getbitu(w2,i,10);          i+=10;
+  e.OMG0=getbits(w2,i,32)*P2_31*PI; i+=32;
+  e.i0  =getbits(w2,i,32)*P2_31*PI; i+=32;
+  e.omg =getbits(w2,i,32)*P2_31*PI; i+=32;
+  e.idot=getbits(w2,i,14)*P2_43*PI;
+
+  i=6;
+  iod[2]=getbitu(w3,i,10);          i+=10;
+  e.OMGd=getbits(w3,i,24)*P2_43*PI; i+=24;
+  e.deln=getbits(w3,i,16)*P2_43*PI; i+=16;
+  e.cuc =getbits(w3,i,16)*P2_29;    i+=16;
+  e.cus =getbits(w3,i,16)*P2_29;    i+=16;
+  e.crc =getbits(w3,i,16)*P2_5;     i+=16;
+  e.crs =getbits(w3,i,16)*P2_5;     i+=16;
+  e.sva =getbitu(w3,i,8);
+
+  i=6;
+  iod[3]=getbitu(w4,i,10);          i+=10+6; // SVID
+  e.cic =getbits(w4,i,16)*P2_29;    i+=16;
+  e.cis =getbits(w4,i,16)*P2_29;    i+=16;
+  toc   =getbitu(w4,i,14)*60.0;     i+=14;
+  e.f0  =getbits(w4,i,31)*P2_34;    i+=31;
+  e.f1  =getbits(w4,i,21)*P2_46;    i+=21;
+  e.f2  =getbits(w4,i,6)*P2_59;
+
+  i=6+11+11+14+5; // ionosphere ai0-ai2, storm flags
+  e.tgd[0]=getbits(w5,i,10)*P2_32;  i+=10; // BGD E5a/E1
+  e.tgd[1]=getbits(w5,i,10)*P2_32;  i+=10; // BGD E5b/E1
+  e5hs  =getbitu(w5,i,2);           i+=2;
+  e1hs  =getbitu(w5,i,2);           i+=2;
+  e5dv  =getbitu(w5,i,1);           i+=1;
+  e1dv  =getbitu(w5,i,1);           i+=1;
+  e.week=getbitu(w5,i,12)+1024;     i+=12; // GST week, GPS numbering
+  tow   =getbitu(w5,i,20);
+
+  if(iod[0]!=iod[1]||iod[0]!=iod[2]||iod[0]!=iod[3])
+    return false;
+  e.iode=e.iodc=iod[0];
+  e.A=sqrtA*sqrtA;
+  e.svh=e5hs<<7|e5dv<<6|e1hs<<1|e1dv;
+  e.code=1|1<<9; // I/NAV E1-B, af0-af2 for E5b,E1
+  e.flag=0;
+  e.fit=0.0;
+  e.tgd[2]=e.tgd[3]=0.0;
+  e.Adot=e.ndot=0.0;
+  memcpy(e.prn,prn,4);
+  e.ttr.from_gps(e.week,tow);
+  e.toe.from_gps(e.week,e.toes);
+  e.toc.from_gps(e.week,toc);
+  adjweek(e.toe,e.ttr);
+  adjweek(e.toc,e.ttr);
+  return true;
+}
+
+// RXM-SFRBX: words are kept by slot until a whole ephemeris of one
+// issue is there; each issue is returned once
+bool UbxReader::sfrbx(const uint8_t *p, int n, Nav& eph)
+{
+  uint8_t b[32],*w;
+  int k,id,sl,nw,key;
+  char prn[4];
+
+  if(n<8||n<8+4*(nw=p[4])||(sl=satid(p[0],p[1],prn))<0)
+    return false;
+  w=&sub[(std::size_t)sl*UBX_SUBLEN];
+
+  if((p[0]==0||p[0]==5)&&nw==10){ // GPS, QZSS LNAV
+    for(k=0;k<10;k++)
+      setbitu(b,24*k,24,U4(p+8+4*k)>>6);
+    if(getbitu(b,0,8)!=0x8B||(id=getbitu(b,43,3))<1||id>3)
+      return false;
+    memcpy(w+30*(id-1),b,30);
+    if((have[sl]|=1<<id)!=0xE||id!=3)
+      return false;
+    if(!lnav(w,week,prn[0],(prn[1]-'0')*10+prn[2]-'0',eph))
+      return false;
+    key=eph.iodc<<16|(int)(eph.toes/16.0);
+  }
+  else if(p[0]==2&&nw==8){ // Galileo I/NAV, even and odd page
+    for(k=0;k<8;k++)
+      setbitu(b,32*k,32,U4(p+8+4*k));
+    if(getbitu(b,0,1)!=0||getbitu(b,128,1)!=1||getbitu(b,1,1)||getbitu(b,129,1))
+      return false; // not an even/odd nominal page pair
+    if((id=getbitu(b,2,6))<1||id>5)
+      return false;
+    for(k=0;k<14;k++)
+      w[16*(id-1)+k]=getbitu(b,2+8*k,8);
+    for(k=14;k<16;k++)
+      w[16*(id-1)+k]=getbitu(b,130+8*(k-14),8);
+    if((have[sl]|=1<<id)!=0x3E)
+      return false;
+    if(!inav(w,prn,eph))
+      return false;
+    key=eph.iode<<16|(int)(eph.toes/60.0);
+  }
+  else
+    return false;
+
+  if(key==iod[sl])
+    return false;
+  iod[sl]=key;
+  return true;
+}
+
+// NAV-PVT: UTC date and time, fix, geodetic position and NED velocity
+bool UbxReader::navpvt(const uint8_t *p, int n)
+{
+  int cal[6];
+
+  if(n<92)
+    return false;
+  cal[0]=U2(p+4);
+  for(int k=1;k<6;k++)
+    cal[k]=p[5+k];
+  pvt.t.from_cal(cal);
+  pvt.t=pvt.t+Time(I4(p+16)*1e-9);
+  pvt.fix=p[20];
+  pvt.ok=p[21]&1;
+  pvt.nsat=p[23];
+  pvt.lon =I4(p+24)*1e-7;
+  pvt.lat =I4(p+28)*1e-7;
+  pvt.hgt =I4(p+32)*1e-3;
+  pvt.hmsl=I4(p+36)*1e-3;
+  pvt.hacc=U4(p+40)*1e-3;
+  pvt.vacc=U4(p+44)*1e-3;
+  for(int k=0;k<3;k++)
+    pvt.vel[k]=I4(p+48+4*k)*1e-3;
+  pvt.pdop=U2(p+76)*0.01;
+  return true;
+}